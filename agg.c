@@ -0,0 +1,774 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Aggregation mode groups records by the values of a list of format
+  fields and reports a line per group every interval, in place of a
+  line per record. Each group is reported with any of: its request
+  count, its rate over the interval, the sum of its Content-Length
+  values, and percentiles of its paired response times.
+
+  Counting works as in rate statistics mode (see writers.c): each
+  capture thread writes groups into tables of its own, and the reporter
+  swaps every writer over to its other table before it folds the old
+  ones into its group table. Groups are held across intervals so their
+  names stay interned, and are dropped after an interval with no
+  requests.
+
+  Response times are counted in a histogram with exact buckets under
+  16 us and eight buckets per power of two above, so a percentile is
+  reported within about 6% of the true value.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include "agg.h"
+#include "config.h"
+#include "error.h"
+#include "format.h"
+#include "strtab.h"
+#include "utility.h"
+#include "writers.h"
+
+#define AGG_KEY_LEN 512
+#define NUM_LEN 24                /* Longest Content-Length or latency value kept */
+#define MAX_GROUP_FIELDS 16
+#define MAX_AGGREGATES 16
+#define GROUP_HASHSIZE 2048
+#define WRITER_NAMES_SIZE 131072
+#define LATENCY_LINEAR 16
+#define LATENCY_BUCKETS (LATENCY_LINEAR + (32 - 4) * 8)
+
+#define AGG_COUNT 1
+#define AGG_RPS 2
+#define AGG_BYTES 3
+#define AGG_PERCENTILE 4
+
+struct aggregate {
+        int type;
+        unsigned int percentile;
+};
+
+struct group {
+        const char *key;
+        unsigned int count;
+        unsigned long long bytes;
+        unsigned int timed;       /* Requests with a response time */
+        unsigned int *latency;    /* Histogram, if percentiles are reported */
+};
+
+/* Groups seen by one writer during one interval; groups the table has
+   no room for only count towards the totals */
+struct group_counts {
+        WRITER_TABLE *groups;
+        struct group totals;
+        time_t first_packet;
+        time_t last_packet;
+};
+
+struct writer {
+        struct group_counts counts[2];
+} __attribute__((aligned(64)));
+
+struct thread_args {
+        char *use_infile;
+        unsigned int interval;
+};
+
+void create_aggregate_thread(int interval, char *use_infile);
+void exit_aggregate_thread();
+void *run_aggregate(void *args);
+void swap_group_counts();
+void merge_group_counts(struct group_counts *counts);
+void merge_writer_group(void *entry, void *arg);
+void merge_group(struct group *dst, struct group *src);
+void count_group(struct group *group, const char *bytes, const char *usec);
+void clear_group(struct group *group);
+struct group *new_group();
+struct group *get_writer_group(struct group_counts *counts, const char *key, size_t len);
+int collect_group(const char *key, void *value, void *arg);
+int free_group(const char *key, void *value, void *arg);
+int compare_groups(const void *a, const void *b);
+void print_group(char *st_time, const char *key, struct group *group, float elapsed);
+unsigned int latency_bucket(unsigned long usec);
+unsigned long latency_percentile(struct group *group, unsigned int percentile);
+
+static pthread_t thread;
+static int thread_created = 0;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static WRITERS *writer_set = NULL;
+static struct writer *writers = NULL;
+static int num_writers = 0;
+static unsigned int groups_missed = 0;
+static unsigned int missed_reported = 0;
+static char *group_fields[MAX_GROUP_FIELDS];
+static int group_slots[MAX_GROUP_FIELDS];
+static int num_group_fields = 0;
+static struct aggregate aggregates[MAX_AGGREGATES];
+static int num_aggregates = 0;
+static int bytes_slot = -1;
+static int latency_slot = -1;
+static int want_bytes = 0;
+static int want_latency = 0;
+static char *format = NULL;
+static STRTAB *groups = NULL;
+static struct group **sorted = NULL;
+static unsigned int sorted_size = 0;
+static unsigned int num_sorted = 0;
+static struct group *totals = NULL;
+static time_t first_packet = 0;
+static time_t last_packet = 0;
+static time_t last_report = 0;
+static int header_printed = 0;
+static struct thread_args thread_args;
+static char default_aggregates[] = DEFAULT_AGGREGATES;
+
+/* Parse the -g argument: fields[:aggregates], where fields are format
+   fields to group by and aggregates are any of count, rps, bytes and
+   pN for the Nth percentile of response time */
+void parse_aggregate_spec(char *spec) {
+        char *list, *name, *i;
+        unsigned int percentile;
+        char c;
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if ((list = strchr(spec, ':')) != NULL) {
+                *list++ = '\0';
+        } else {
+                list = default_aggregates;
+        }
+
+        num_group_fields = 0;
+        for (i = spec; (name = strtok(i, ",")); i = NULL) {
+                name = str_strip_whitespace(name);
+                if (*name == '\0') continue;
+
+                if (num_group_fields == MAX_GROUP_FIELDS)
+                        LOG_DIE("Too many -g fields, at most %d are allowed", MAX_GROUP_FIELDS);
+
+                if ((group_fields[num_group_fields++] = str_duplicate(str_tolower(name))) == NULL)
+                        LOG_DIE("Cannot allocate memory for group field");
+        }
+
+        if (num_group_fields == 0)
+                LOG_DIE("Invalid -g value, must be 'fields[:aggregates]'");
+
+        num_aggregates = 0;
+        for (i = list; (name = strtok(i, ",")); i = NULL) {
+                name = str_tolower(str_strip_whitespace(name));
+                if (*name == '\0') continue;
+
+                if (num_aggregates == MAX_AGGREGATES)
+                        LOG_DIE("Too many -g aggregates, at most %d are allowed", MAX_AGGREGATES);
+
+                if (strcmp(name, "count") == 0) {
+                        aggregates[num_aggregates].type = AGG_COUNT;
+                } else if (strcmp(name, "rps") == 0) {
+                        aggregates[num_aggregates].type = AGG_RPS;
+                } else if (strcmp(name, "bytes") == 0) {
+                        aggregates[num_aggregates].type = AGG_BYTES;
+                        want_bytes = 1;
+                } else if ((sscanf(name, "p%u%c", &percentile, &c) == 1) &&
+                           (percentile > 0) && (percentile < 100)) {
+                        aggregates[num_aggregates].type = AGG_PERCENTILE;
+                        aggregates[num_aggregates].percentile = percentile;
+                        want_latency = 1;
+                } else {
+                        LOG_DIE("Invalid -g aggregate '%s', must be count, rps, bytes or p1-p99", name);
+                }
+
+                num_aggregates++;
+        }
+
+        if (num_aggregates == 0)
+                LOG_DIE("Invalid -g value, must be 'fields[:aggregates]'");
+
+        return;
+}
+
+/* Return the format string holding the group fields and the fields
+   the aggregates are taken from */
+char *aggregate_format() {
+        size_t len = 0;
+        int i, has_bytes = 0, has_latency = 0;
+
+        for (i = 0; i < num_group_fields; i++) {
+                len += strlen(group_fields[i]) + 1;
+                if (strcmp(group_fields[i], "content-length") == 0) has_bytes = 1;
+                if (strcmp(group_fields[i], "response-time-us") == 0) has_latency = 1;
+        }
+        len += sizeof("content-length,response-time-us");
+
+        free(format);
+        if ((format = (char *) malloc(len)) == NULL)
+                LOG_DIE("Cannot allocate memory for aggregate format string");
+
+        *format = '\0';
+        for (i = 0; i < num_group_fields; i++) {
+                if (i > 0) strcat(format, ",");
+                strcat(format, group_fields[i]);
+        }
+
+        if (want_bytes && !has_bytes) strcat(format, ",content-length");
+        if (want_latency && !has_latency) strcat(format, ",response-time-us");
+
+        return format;
+}
+
+/* Initialize the group tables for the given number of capture threads
+   and start up the stats thread if necessary; must be called after
+   the format string from aggregate_format() has been parsed */
+void init_aggregate_stats(int display_interval, char *use_infile, int writer_count) {
+        struct group_counts *counts;
+        size_t entry_size;
+        int i, j;
+
+        for (i = 0; i < num_group_fields; i++)
+                group_slots[i] = format_slot(group_fields[i]);
+        bytes_slot = want_bytes ? format_slot("content-length") : -1;
+        latency_slot = want_latency ? format_slot("response-time-us") : -1;
+
+        groups = strtab_new(GROUP_HASHSIZE);
+        totals = new_group();
+
+        writer_set = writers_new(writer_count);
+        if (posix_memalign((void **) &writers, 64, writer_count * sizeof(struct writer)) != 0)
+                LOG_DIE("Cannot allocate memory for writer groups");
+        memset(writers, 0, writer_count * sizeof(struct writer));
+
+        /* Writer groups carry their histogram right behind them */
+        entry_size = sizeof(struct group);
+        if (want_latency) entry_size += LATENCY_BUCKETS * sizeof(unsigned int);
+
+        for (i = 0; i < writer_count; i++) {
+                for (j = 0; j < 2; j++) {
+                        counts = &writers[i].counts[j];
+                        counts->groups = writer_table_new(entry_size, WRITER_NAMES_SIZE);
+
+                        if (!want_latency) continue;
+
+                        if ((counts->totals.latency = (unsigned int *) calloc(LATENCY_BUCKETS, sizeof(unsigned int))) == NULL)
+                                LOG_DIE("Cannot allocate memory for writer histograms");
+                }
+        }
+        num_writers = writer_count;
+
+        if (!use_infile)
+                create_aggregate_thread(display_interval, use_infile);
+
+        return;
+}
+
+/* Spawn a thread for printing aggregate statistics */
+void create_aggregate_thread(int interval, char *use_infile) {
+        sigset_t set;
+        int s;
+
+        if (thread_created) return;
+
+        thread_args.use_infile = use_infile;
+        thread_args.interval = interval;
+        last_report = time(NULL);
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Aggregate thread signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_aggregate, (void *) &thread_args);
+        if (s != 0)
+                LOG_DIE("Aggregate thread creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Aggregate thread signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Cancel the stats thread and free the group tables */
+void cleanup_aggregate_stats() {
+        int i, j;
+
+        exit_aggregate_thread();
+
+        if (writers != NULL) {
+                for (i = 0; i < num_writers; i++) {
+                        for (j = 0; j < 2; j++) {
+                                writer_table_free(writers[i].counts[j].groups);
+                                free(writers[i].counts[j].totals.latency);
+                        }
+                }
+
+                free(writers);
+                writers = NULL;
+                num_writers = 0;
+                writers_free(writer_set);
+                writer_set = NULL;
+        }
+
+        if (groups != NULL) {
+                strtab_clear(groups, free_group, NULL);
+                strtab_free(groups);
+                groups = NULL;
+        }
+
+        free(totals);
+        totals = NULL;
+        free(sorted);
+        sorted = NULL;
+        sorted_size = 0;
+
+        for (i = 0; i < num_group_fields; i++)
+                free(group_fields[i]);
+        num_group_fields = 0;
+
+        free(format);
+        format = NULL;
+
+        return;
+}
+
+/* Drop all counts gathered so far, leaving the stats thread and the
+   writer tables in place so capture can continue */
+void reset_aggregate_stats() {
+        if (groups == NULL) return;
+
+        pthread_mutex_lock(&report_lock);
+
+        swap_group_counts();
+        strtab_clear(groups, free_group, NULL);
+        clear_group(totals);
+        first_packet = last_packet = 0;
+        last_report = time(NULL);
+
+        /* The output file may have been reopened */
+        header_printed = 0;
+
+        pthread_mutex_unlock(&report_lock);
+
+        return;
+}
+
+/* Explicitly exit the stats thread */
+void exit_aggregate_thread() {
+        int s;
+        void *retval;
+
+        if (!thread_created) return;
+
+        s = pthread_cancel(thread);
+        if (s != 0)
+                LOG_WARN("Aggregate thread cancellation failed with error %d", s);
+
+        s = pthread_join(thread, &retval);
+        if (s != 0)
+                LOG_WARN("Aggregate thread join failed with error %d", s);
+
+        if (retval != PTHREAD_CANCELED)
+                LOG_WARN("Aggregate thread exit value was unexpected");
+
+        thread_created = 0;
+
+        return;
+}
+
+/* This is our statistics thread */
+void *run_aggregate(void *args) {
+        struct thread_args *thread_args = (struct thread_args *) args;
+        int state;
+
+        while (1) {
+                sleep(thread_args->interval);
+
+                /* Don't get cancelled while holding the report lock */
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+                display_aggregate_stats(thread_args->use_infile);
+                pthread_setcancelstate(state, NULL);
+        }
+
+        return (void *) 0;
+}
+
+/* Display a line for every group with requests since the last report,
+   busiest first, followed by the totals; rates are taken over the time
+   since the last report, or over the packets seen when reading a file */
+void display_aggregate_stats(char *use_infile) {
+        char st_time[MAX_TIME_LEN];
+        time_t now;
+        float elapsed;
+        unsigned int i;
+        int j;
+
+        if (groups == NULL) return;
+
+        pthread_mutex_lock(&report_lock);
+
+        swap_group_counts();
+
+        if (use_infile) {
+                now = last_packet;
+                elapsed = (float) (last_packet - first_packet + 1);
+        } else {
+                now = time(NULL);
+                elapsed = (float) (now - last_report);
+                last_report = now;
+        }
+        if (elapsed < 1) elapsed = 1;
+
+        strftime(st_time, MAX_TIME_LEN, "%Y-%m-%d %H:%M:%S", localtime(&now));
+
+#ifdef DEBUG
+        struct strtab_stats tab_stats;
+
+        strtab_stats(groups, &tab_stats);
+
+        PRINT("----------------------------");
+        PRINT("Hash slots:         %u", tab_stats.size);
+        PRINT("Groups inserted:    %u", tab_stats.count);
+        PRINT("Longest probe:      %u", tab_stats.max_probe);
+        PRINT("Groups not counted: %u", groups_missed);
+        PRINT("----------------------------");
+#endif
+
+        if (!header_printed) {
+                printf("# Fields: timestamp");
+                for (j = 0; j < num_group_fields; j++)
+                        printf(",%s", group_fields[j]);
+                for (j = 0; j < num_aggregates; j++) {
+                        switch (aggregates[j].type) {
+                                case AGG_COUNT: printf(",count"); break;
+                                case AGG_RPS: printf(",rps"); break;
+                                case AGG_BYTES: printf(",bytes"); break;
+                                case AGG_PERCENTILE: printf(",p%u", aggregates[j].percentile); break;
+                        }
+                }
+                printf("\n");
+                header_printed = 1;
+        }
+
+        /* Gather the groups seen in this interval, dropping idle ones */
+        num_sorted = 0;
+        if (strtab_count(groups) > sorted_size) {
+                free(sorted);
+                sorted_size = strtab_count(groups) * 2;
+                if ((sorted = (struct group **) malloc(sorted_size * sizeof(struct group *))) == NULL)
+                        LOG_DIE("Cannot allocate memory for group report");
+        }
+        strtab_walk(groups, collect_group, NULL);
+
+        qsort(sorted, num_sorted, sizeof(struct group *), compare_groups);
+
+        for (i = 0; i < num_sorted; i++) {
+                print_group(st_time, sorted[i]->key, sorted[i], elapsed);
+                clear_group(sorted[i]);
+        }
+
+        if (totals->count) {
+                print_group(st_time, NULL, totals, elapsed);
+                clear_group(totals);
+        }
+        first_packet = last_packet = 0;
+
+        if (groups_missed != missed_reported) {
+                printf("# %u records since the last report not counted by group\n", groups_missed - missed_reported);
+                missed_reported = groups_missed;
+        }
+
+        fflush(stdout);
+
+        pthread_mutex_unlock(&report_lock);
+
+        return;
+}
+
+/* Add a group with requests in this interval to the report, or drop
+   it from the table if it had none */
+int collect_group(const char *key, void *value, void *arg) {
+        struct group *group = (struct group *) value;
+
+        if (group->count == 0)
+                return free_group(key, value, arg);
+
+        sorted[num_sorted++] = group;
+
+        return 0;
+}
+
+int free_group(const char *key, void *value, void *arg) {
+        free(value);
+
+        return 1;
+}
+
+/* Order groups by count, busiest first, then by key */
+int compare_groups(const void *a, const void *b) {
+        const struct group *x = *(struct group * const *) a, *y = *(struct group * const *) b;
+
+        if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+
+        return strcmp(x->key, y->key);
+}
+
+/* Print a group's line; a NULL key prints the totals */
+void print_group(char *st_time, const char *key, struct group *group, float elapsed) {
+        int i;
+
+        printf("%s%s", st_time, FIELD_DELIM);
+        if (key) {
+                printf("%s", key);
+        } else {
+                printf("totals");
+                for (i = 1; i < num_group_fields; i++)
+                        printf("%s%s", FIELD_DELIM, EMPTY_FIELD);
+        }
+
+        for (i = 0; i < num_aggregates; i++) {
+                printf("%s", FIELD_DELIM);
+
+                switch (aggregates[i].type) {
+                        case AGG_COUNT:
+                                printf("%u", group->count);
+                                break;
+                        case AGG_RPS:
+                                printf("%0.2f", group->count / elapsed);
+                                break;
+                        case AGG_BYTES:
+                                printf("%llu", group->bytes);
+                                break;
+                        case AGG_PERCENTILE:
+                                if (group->timed) {
+                                        printf("%lu", latency_percentile(group, aggregates[i].percentile));
+                                } else {
+                                        printf("%s", EMPTY_FIELD);
+                                }
+                                break;
+                }
+        }
+        printf("\n");
+
+        return;
+}
+
+/* Point the writers at their other table, then fold the old tables
+   into the group table */
+void swap_group_counts() {
+        unsigned int old;
+        int i;
+
+        if (writers == NULL) return;
+
+        old = writers_swap(writer_set);
+
+        for (i = 0; i < num_writers; i++)
+                merge_group_counts(&writers[i].counts[old]);
+
+        return;
+}
+
+/* Add a writer's groups for the last interval to the group table and
+   clear them for reuse */
+void merge_group_counts(struct group_counts *counts) {
+        groups_missed += writer_table_clear(counts->groups, merge_writer_group, NULL);
+
+        if (counts->totals.count) {
+                merge_group(totals, &counts->totals);
+                clear_group(&counts->totals);
+
+                if ((first_packet == 0) || (counts->first_packet < first_packet))
+                        first_packet = counts->first_packet;
+                if (counts->last_packet > last_packet)
+                        last_packet = counts->last_packet;
+        }
+        counts->first_packet = counts->last_packet = 0;
+
+        return;
+}
+
+/* Add a group's counts from a writer table to the group table */
+void merge_writer_group(void *entry, void *arg) {
+        struct group *group, *slot = (struct group *) entry;
+
+        if ((group = (struct group *) strtab_get(groups, slot->key)) == NULL) {
+                group = new_group();
+                group->key = strtab_insert(groups, slot->key, group);
+        }
+
+        merge_group(group, slot);
+
+        return;
+}
+
+void merge_group(struct group *dst, struct group *src) {
+        unsigned int i;
+
+        dst->count += src->count;
+        dst->bytes += src->bytes;
+        dst->timed += src->timed;
+
+        if (src->timed) {
+                for (i = 0; i < LATENCY_BUCKETS; i++)
+                        dst->latency[i] += src->latency[i];
+        }
+
+        return;
+}
+
+/* Count a request in a group, given its Content-Length and response
+   time values if any */
+void count_group(struct group *group, const char *bytes, const char *usec) {
+        group->count++;
+
+        if (bytes)
+                group->bytes += strtoull(bytes, NULL, 10);
+
+        if (usec && group->latency) {
+                group->latency[latency_bucket(strtoul(usec, NULL, 10))]++;
+                group->timed++;
+        }
+
+        return;
+}
+
+/* Zero a group's counts, keeping its key and histogram */
+void clear_group(struct group *group) {
+        if (group->timed)
+                memset(group->latency, 0, LATENCY_BUCKETS * sizeof(unsigned int));
+
+        group->count = 0;
+        group->bytes = 0;
+        group->timed = 0;
+
+        return;
+}
+
+/* Allocate a reporter group, with its histogram if one is needed */
+struct group *new_group() {
+        struct group *group;
+        size_t size = sizeof(struct group);
+
+        if (want_latency) size += LATENCY_BUCKETS * sizeof(unsigned int);
+
+        if ((group = (struct group *) calloc(1, size)) == NULL)
+                LOG_DIE("Cannot allocate memory for group");
+
+        if (want_latency) group->latency = (unsigned int *) (group + 1);
+
+        return group;
+}
+
+/* Count a record in the calling writer's table for the current epoch,
+   grouped by the values of the group fields. Each writer must only be
+   updated from a single thread. */
+void update_aggregate_stats(int writer, FORMAT_RECORD *rec, time_t t) {
+        struct writer *w;
+        struct group_counts *counts;
+        struct group *group;
+        char key[AGG_KEY_LEN];
+        char bytes_buf[NUM_LEN], usec_buf[NUM_LEN];
+        const char *value;
+        char *bytes, *usec;
+        size_t len = 0, n;
+        int i;
+
+        if (writers == NULL) return;
+
+        /* The key is the group values as they would be printed */
+        for (i = 0; i < num_group_fields; i++) {
+                if ((value = get_value(rec, group_slots[i], &n)) == NULL) {
+                        value = EMPTY_FIELD;
+                        n = sizeof(EMPTY_FIELD) - 1;
+                }
+                if (i > 0) len += str_copy(key + len, FIELD_DELIM, AGG_KEY_LEN - len);
+                if (n > AGG_KEY_LEN - 1 - len) n = AGG_KEY_LEN - 1 - len;
+                memcpy(key + len, value, n);
+                len += n;
+                key[len] = '\0';
+        }
+
+        bytes = copy_value(rec, bytes_slot, bytes_buf, NUM_LEN);
+        usec = copy_value(rec, latency_slot, usec_buf, NUM_LEN);
+
+        w = &writers[writer];
+        counts = &w->counts[writers_begin(writer_set, writer)];
+
+        if ((group = get_writer_group(counts, key, len)))
+                count_group(group, bytes, usec);
+        count_group(&counts->totals, bytes, usec);
+
+        if (counts->first_packet == 0) counts->first_packet = t;
+        counts->last_packet = t;
+
+        writers_end(writer_set, writer);
+
+        return;
+}
+
+/* Find the group in a writer's table, adding it if there is room;
+   returns NULL if the table is full */
+struct group *get_writer_group(struct group_counts *counts, const char *key, size_t len) {
+        struct group *group;
+        int added;
+
+        if ((group = (struct group *) writer_table_get(counts->groups, key, len, &added)) && added && want_latency)
+                group->latency = (unsigned int *) (group + 1);
+
+        return group;
+}
+
+/* Return the histogram bucket of a response time: one per microsecond
+   below LATENCY_LINEAR, then eight per power of two */
+unsigned int latency_bucket(unsigned long usec) {
+        unsigned int exp;
+
+        if (usec < LATENCY_LINEAR) return usec;
+        if (usec > 0xffffffffUL) usec = 0xffffffffUL;
+
+        for (exp = 4; (exp < 31) && ((usec >> (exp + 1)) != 0); exp++);
+
+        return LATENCY_LINEAR + (exp - 4) * 8 + ((usec >> (exp - 3)) & 7);
+}
+
+/* Return the middle of the bucket holding the given percentile of a
+   group's response times */
+unsigned long latency_percentile(struct group *group, unsigned int percentile) {
+        unsigned long long target, seen = 0;
+        unsigned int i, exp, sub;
+
+        target = ((unsigned long long) group->timed * percentile + 99) / 100;
+        if (target == 0) target = 1;
+
+        for (i = 0; i < LATENCY_BUCKETS - 1; i++) {
+                seen += group->latency[i];
+                if (seen >= target) break;
+        }
+
+        if (i < LATENCY_LINEAR) return i;
+
+        exp = 4 + (i - LATENCY_LINEAR) / 8;
+        sub = (i - LATENCY_LINEAR) % 8;
+
+        return (1UL << exp) + (sub << (exp - 3)) + (1UL << (exp - 4));
+}
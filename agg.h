@@ -0,0 +1,26 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_AGG_H
+#define _HAVE_AGG_H
+
+#include <time.h>
+#include "format.h"
+
+void parse_aggregate_spec(char *spec);
+char *aggregate_format();
+void init_aggregate_stats(int display_interval, char *use_infile, int writer_count);
+void cleanup_aggregate_stats();
+void reset_aggregate_stats();
+void display_aggregate_stats(char *use_infile);
+void update_aggregate_stats(int writer, FORMAT_RECORD *rec, time_t t);
+
+#endif /* ! _HAVE_AGG_H */
@@ -0,0 +1,158 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Packets are handed to the parser in batches so each stage can run
+  over many packets at once, while the next packets' data is already
+  on its way into the cache. The ring backend builds its batches in
+  place from the mapped blocks. Through pcap, packets are only valid
+  while the callback runs, as libpcap reuses its buffer for the next
+  packet read from a file and returns frames to the kernel as soon as
+  they are handled. So packets taken with pcap_dispatch() are copied
+  into the batch, and the batch is parsed once the call returns.
+
+  A batch of one is parsed straight from the callback, without a copy,
+  exactly as a plain pcap_loop() would.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+#include "batch.h"
+#include "error.h"
+
+#define COPY_ALIGN 8
+#define COPY_SIZE 2048            /* Initial copy space per packet */
+
+struct dispatch_args {
+        PACKET_BATCH *batch;
+        batch_handler handler;
+        u_char *args;
+};
+
+void collect_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt);
+void handle_single(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt);
+
+/* Create a batch of up to size packets */
+PACKET_BATCH *batch_new(unsigned int size) {
+        PACKET_BATCH *batch;
+
+#ifdef DEBUG
+        ASSERT(size > 0);
+#endif
+
+        if ((batch = (PACKET_BATCH *) calloc(1, sizeof(PACKET_BATCH))) == NULL)
+                LOG_DIE("Cannot allocate memory for packet batch");
+
+        batch->size = size;
+        batch->headers = (struct pcap_pkthdr *) malloc(size * sizeof(struct pcap_pkthdr));
+        batch->pkts = (const u_char **) malloc(size * sizeof(u_char *));
+        batch->offsets = (size_t *) malloc(size * sizeof(size_t));
+        if (!batch->headers || !batch->pkts || !batch->offsets)
+                LOG_DIE("Cannot allocate memory for packet batch");
+
+        return batch;
+}
+
+/* Read packets from pcap a batch at a time and hand each batch to the
+   handler; mirrors pcap_loop() return values */
+int batch_loop(pcap_t *pcap_hnd, PACKET_BATCH *batch, batch_handler handler, u_char *args) {
+        struct dispatch_args da;
+        unsigned int i;
+        int offline, n;
+
+#ifdef DEBUG
+        ASSERT(pcap_hnd);
+        ASSERT(batch);
+        ASSERT(handler);
+#endif
+
+        da.batch = batch;
+        da.handler = handler;
+        da.args = args;
+
+        if (batch->size == 1)
+                return pcap_loop(pcap_hnd, -1, &handle_single, (u_char *) &da);
+
+        if (!batch->data) {
+                batch->data_size = (size_t) batch->size * COPY_SIZE;
+                if ((batch->data = (u_char *) malloc(batch->data_size)) == NULL)
+                        LOG_DIE("Cannot allocate memory for packet batch");
+        }
+
+        offline = (pcap_file(pcap_hnd) != NULL);
+
+        while (1) {
+                batch->count = 0;
+                batch->data_len = 0;
+
+                n = pcap_dispatch(pcap_hnd, batch->size, &collect_packet, (u_char *) batch);
+
+                /* The copy space may have moved while it was filled */
+                if (batch->count > 0) {
+                        for (i = 0; i < batch->count; i++)
+                                batch->pkts[i] = batch->data + batch->offsets[i];
+
+                        handler(args, batch);
+                }
+
+                if (n < 0) return n;
+                if ((n == 0) && offline) return 0;
+        }
+}
+
+/* Copy a packet into the batch being filled */
+void collect_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt) {
+        PACKET_BATCH *batch = (PACKET_BATCH *) args;
+        size_t need = batch->data_len + header->caplen;
+        u_char *data;
+
+        if (need > batch->data_size) {
+                if (need < batch->data_size * 2) need = batch->data_size * 2;
+                if ((data = (u_char *) realloc(batch->data, need)) == NULL)
+                        LOG_DIE("Cannot allocate memory for packet batch");
+                batch->data = data;
+                batch->data_size = need;
+        }
+
+        memcpy(batch->data + batch->data_len, pkt, header->caplen);
+        batch->headers[batch->count] = *header;
+        batch->offsets[batch->count] = batch->data_len;
+        batch->count++;
+
+        batch->data_len += (header->caplen + COPY_ALIGN - 1) & ~(COPY_ALIGN - 1);
+
+        return;
+}
+
+/* Hand a single packet on as a batch of one */
+void handle_single(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt) {
+        struct dispatch_args *da = (struct dispatch_args *) args;
+
+        da->batch->headers[0] = *header;
+        da->batch->pkts[0] = pkt;
+        da->batch->count = 1;
+
+        da->handler(da->args, da->batch);
+
+        return;
+}
+
+void batch_free(PACKET_BATCH *batch) {
+        if (!batch) return;
+
+        free(batch->headers);
+        free(batch->pkts);
+        free(batch->offsets);
+        free(batch->data);
+        free(batch);
+
+        return;
+}
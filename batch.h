@@ -0,0 +1,36 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_BATCH_H
+#define _HAVE_BATCH_H
+
+#include <pcap.h>
+
+/* A vector of captured packets handed to the parser at once; the
+   packet pointers are only valid until the handler returns */
+typedef struct packet_batch {
+        unsigned int count;
+        unsigned int size;
+        struct pcap_pkthdr *headers;
+        const u_char **pkts;
+        size_t *offsets;          /* Where each copied packet starts in data */
+        u_char *data;             /* Packet copies taken from pcap */
+        size_t data_size;
+        size_t data_len;
+} PACKET_BATCH;
+
+typedef void (*batch_handler)(u_char *args, PACKET_BATCH *batch);
+
+PACKET_BATCH *batch_new(unsigned int size);
+int batch_loop(pcap_t *pcap_hnd, PACKET_BATCH *batch, batch_handler handler, u_char *args);
+void batch_free(PACKET_BATCH *batch);
+
+#endif /* ! _HAVE_BATCH_H */
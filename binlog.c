@@ -0,0 +1,482 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The binary log holds the same records as the text output, packed
+  into compressed blocks. A file starts with a header naming the
+  fields every record holds, and each block carries the number of
+  records in it and the earliest and latest record times, so a reader
+  can skip whole blocks outside a time range without inflating them.
+  The full layout is described in doc/binlog.
+
+  The writing half only encodes into caller supplied buffers; records
+  are assembled by format.c and batches are turned into blocks by the
+  output buffers (see output.c), one block per batch. The reading half
+  is self-contained so tools can link it with nothing but zlib.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "binlog.h"
+
+#define NO_TIME_MIN 0x7fffffffffffffffLL
+#define NO_TIME_MAX (-0x7fffffffffffffffLL - 1)
+
+struct block_header {
+        unsigned int method;
+        unsigned int comp_len;
+        unsigned int raw_len;
+        unsigned int records;
+        unsigned int crc;
+        long long min_us;
+        long long max_us;
+};
+
+struct binlog_reader {
+        FILE *fp;
+        char *fields;
+        unsigned int num_fields;
+        unsigned int schema_changes;
+        char *comp;               /* Block as read */
+        size_t comp_size;
+        char *raw;                /* Block inflated */
+        size_t raw_size;
+        size_t raw_len;
+        size_t raw_pos;
+        char *rec_buf;            /* Values of the current record */
+        size_t rec_size;
+        const char **values;
+        size_t *lengths;
+        long long start_us;
+        long long end_us;
+        char error[128];
+};
+
+void put_u32(char *dst, unsigned int val);
+void put_u64(char *dst, unsigned long long val);
+unsigned int get_u32(const char *src);
+unsigned long long get_u64(const char *src);
+size_t get_varint(const char *src, size_t len, unsigned long long *val);
+int read_file_header(BINLOG_READER *reader, const char *magic);
+int read_block(BINLOG_READER *reader);
+int skip_bytes(BINLOG_READER *reader, size_t len);
+int grow_buffer(char **buf, size_t *size, size_t need);
+int reader_error(BINLOG_READER *reader, const char *msg);
+
+/* Write the file header for the given comma-delimited field list into
+   dst; returns its length, or 0 if dst is too small */
+size_t binlog_header(char *dst, size_t size, const char *fields) {
+        size_t len = strlen(fields);
+
+        if (size < BINLOG_MAGIC_LEN + 4 + len) return 0;
+
+        memcpy(dst, BINLOG_MAGIC, BINLOG_MAGIC_LEN);
+        put_u32(dst + BINLOG_MAGIC_LEN, len);
+        memcpy(dst + BINLOG_MAGIC_LEN + 4, fields, len);
+
+        return BINLOG_MAGIC_LEN + 4 + len;
+}
+
+/* Encode val as a little-endian base 128 varint; dst must have room
+   for BINLOG_VARINT_MAX bytes */
+size_t binlog_put_varint(char *dst, unsigned long long val) {
+        size_t n = 0;
+
+        while (val >= 0x80) {
+                dst[n++] = (char) ((val & 0x7f) | 0x80);
+                val >>= 7;
+        }
+        dst[n++] = (char) val;
+
+        return n;
+}
+
+/* Write the start of a record whose fields take len bytes: its length
+   and time; dst must have room for BINLOG_VARINT_MAX + 8 bytes */
+size_t binlog_record_head(char *dst, size_t len, const struct timeval *ts) {
+        size_t n;
+
+        n = binlog_put_varint(dst, len + 8);
+        put_u64(dst + n, (unsigned long long) ts->tv_sec * 1000000ULL + ts->tv_usec);
+
+        return n + 8;
+}
+
+/* Return the most bytes a block holding len bytes of records can take */
+size_t binlog_block_bound(size_t len) {
+        return BINLOG_BLOCK_HEADER_LEN + compressBound(len);
+}
+
+/* Compress a batch of whole records into a block in dst, which must
+   hold binlog_block_bound(len) bytes; returns the block length */
+size_t binlog_encode_block(const char *data, size_t len, char *dst, size_t size) {
+        unsigned long long rec_len;
+        long long min_us = NO_TIME_MIN, max_us = NO_TIME_MAX, t;
+        unsigned int records = 0, method = BINLOG_DEFLATE;
+        uLongf comp_len = size - BINLOG_BLOCK_HEADER_LEN;
+        size_t pos = 0, n;
+
+        /* Count the records and find their time range */
+        while (pos < len) {
+                if ((n = get_varint(data + pos, len - pos, &rec_len)) == 0) break;
+                if ((rec_len < 8) || (rec_len > len - pos - n)) break;
+
+                t = (long long) get_u64(data + pos + n);
+                if (t < min_us) min_us = t;
+                if (t > max_us) max_us = t;
+
+                pos += n + rec_len;
+                records++;
+        }
+
+        if ((compress2((Bytef *) dst + BINLOG_BLOCK_HEADER_LEN, &comp_len, (const Bytef *) data, len,
+                       Z_BEST_SPEED) != Z_OK) || (comp_len >= len)) {
+                method = BINLOG_STORED;
+                comp_len = len;
+                memcpy(dst + BINLOG_BLOCK_HEADER_LEN, data, len);
+        }
+
+        memcpy(dst, BINLOG_BLOCK_MAGIC, 4);
+        put_u32(dst + 4, method);
+        put_u32(dst + 8, comp_len);
+        put_u32(dst + 12, len);
+        put_u32(dst + 16, records);
+        put_u32(dst + 20, crc32(0, (const Bytef *) dst + BINLOG_BLOCK_HEADER_LEN, comp_len));
+        put_u64(dst + 24, records ? min_us : 0);
+        put_u64(dst + 32, records ? max_us : 0);
+
+        return BINLOG_BLOCK_HEADER_LEN + comp_len;
+}
+
+/* Start reading a binary log from fp; returns NULL if it does not
+   start with a binary log header */
+BINLOG_READER *binlog_open(FILE *fp) {
+        BINLOG_READER *reader;
+
+        if ((reader = (BINLOG_READER *) calloc(1, sizeof(BINLOG_READER))) == NULL)
+                return NULL;
+
+        reader->fp = fp;
+        reader->start_us = NO_TIME_MAX;
+        reader->end_us = NO_TIME_MIN;
+
+        if (read_file_header(reader, NULL) != 1) {
+                binlog_close(reader);
+                return NULL;
+        }
+
+        return reader;
+}
+
+/* Only return records from start to end inclusive; either may be NULL
+   to leave that end open. Blocks wholly outside the range are skipped
+   without being inflated. */
+void binlog_set_range(BINLOG_READER *reader, const struct timeval *start, const struct timeval *end) {
+        reader->start_us = start ? (long long) start->tv_sec * 1000000LL + start->tv_usec : NO_TIME_MAX;
+        reader->end_us = end ? (long long) end->tv_sec * 1000000LL + end->tv_usec : NO_TIME_MIN;
+
+        return;
+}
+
+/* Read the next record; the values stay valid until the next call.
+   Returns 1 for a record, 0 at the end of the log, -1 on error. */
+int binlog_next(BINLOG_READER *reader, BINLOG_RECORD *rec) {
+        unsigned long long rec_len, field_len;
+        const char *data;
+        size_t n, pos, out;
+        long long t;
+        unsigned int i;
+        int s;
+
+        for (;;) {
+                while (reader->raw_pos >= reader->raw_len) {
+                        if ((s = read_block(reader)) != 1) return s;
+                }
+
+                data = reader->raw + reader->raw_pos;
+                n = get_varint(data, reader->raw_len - reader->raw_pos, &rec_len);
+                if ((n == 0) || (rec_len < 8) || (rec_len > reader->raw_len - reader->raw_pos - n))
+                        return reader_error(reader, "Corrupt record");
+
+                reader->raw_pos += n + rec_len;
+                data += n;
+
+                t = (long long) get_u64(data);
+                if ((t < reader->start_us) || (t > reader->end_us)) continue;
+
+                if (grow_buffer(&reader->rec_buf, &reader->rec_size, rec_len + reader->num_fields) == -1)
+                        return reader_error(reader, "Cannot allocate memory for record");
+
+                /* Copy each value out with a terminator */
+                for (i = 0, pos = 8, out = 0; i < reader->num_fields; i++) {
+                        n = get_varint(data + pos, rec_len - pos, &field_len);
+                        if ((n == 0) || (field_len > rec_len - pos - n + 1))
+                                return reader_error(reader, "Corrupt record field");
+                        pos += n;
+
+                        if (field_len == 0) {
+                                reader->values[i] = NULL;
+                                reader->lengths[i] = 0;
+                                continue;
+                        }
+
+                        field_len--;
+                        memcpy(reader->rec_buf + out, data + pos, field_len);
+                        reader->rec_buf[out + field_len] = '\0';
+                        reader->values[i] = reader->rec_buf + out;
+                        reader->lengths[i] = field_len;
+                        out += field_len + 1;
+                        pos += field_len;
+                }
+
+                rec->ts.tv_sec = t / 1000000LL;
+                rec->ts.tv_usec = t % 1000000LL;
+                rec->num_fields = reader->num_fields;
+                rec->values = reader->values;
+                rec->lengths = reader->lengths;
+
+                return 1;
+        }
+}
+
+/* Return the comma-delimited field list of the records being read */
+const char *binlog_fields(BINLOG_READER *reader) {
+        return reader->fields;
+}
+
+/* Return the number of file headers read so far; logs appended to one
+   another each start with their own, and the fields may differ */
+unsigned int binlog_schema_changes(BINLOG_READER *reader) {
+        return reader->schema_changes;
+}
+
+/* Return a description of the last error */
+const char *binlog_error(BINLOG_READER *reader) {
+        return reader->error;
+}
+
+/* Free a reader; the file is left open */
+void binlog_close(BINLOG_READER *reader) {
+        if (!reader) return;
+
+        free(reader->fields);
+        free(reader->comp);
+        free(reader->raw);
+        free(reader->rec_buf);
+        free(reader->values);
+        free(reader->lengths);
+        free(reader);
+
+        return;
+}
+
+void put_u32(char *dst, unsigned int val) {
+        int i;
+
+        for (i = 0; i < 4; i++, val >>= 8)
+                dst[i] = (char) (val & 0xff);
+
+        return;
+}
+
+void put_u64(char *dst, unsigned long long val) {
+        int i;
+
+        for (i = 0; i < 8; i++, val >>= 8)
+                dst[i] = (char) (val & 0xff);
+
+        return;
+}
+
+unsigned int get_u32(const char *src) {
+        unsigned int val = 0;
+        int i;
+
+        for (i = 3; i >= 0; i--)
+                val = (val << 8) | (unsigned char) src[i];
+
+        return val;
+}
+
+unsigned long long get_u64(const char *src) {
+        unsigned long long val = 0;
+        int i;
+
+        for (i = 7; i >= 0; i--)
+                val = (val << 8) | (unsigned char) src[i];
+
+        return val;
+}
+
+/* Decode a varint from at most len bytes; returns the bytes used, or
+   0 if it is truncated or too long */
+size_t get_varint(const char *src, size_t len, unsigned long long *val) {
+        size_t n;
+        int shift = 0;
+
+        *val = 0;
+        for (n = 0; (n < len) && (n < BINLOG_VARINT_MAX); n++, shift += 7) {
+                *val |= (unsigned long long) ((unsigned char) src[n] & 0x7f) << shift;
+                if (!((unsigned char) src[n] & 0x80)) return n + 1;
+        }
+
+        return 0;
+}
+
+/* Read a file header, passing the first four bytes of it if the
+   caller has already read them; returns 1 on success, 0 at the end of
+   the file, -1 on error */
+int read_file_header(BINLOG_READER *reader, const char *magic) {
+        char buf[BINLOG_MAGIC_LEN + 4];
+        unsigned int len, i;
+        size_t got, have = 0;
+
+        if (magic) {
+                memcpy(buf, magic, 4);
+                have = 4;
+        }
+
+        got = fread(buf + have, 1, sizeof(buf) - have, reader->fp);
+        if (got + have == 0) return 0;
+        if ((got + have < sizeof(buf)) || (memcmp(buf, BINLOG_MAGIC, BINLOG_MAGIC_LEN) != 0))
+                return reader_error(reader, "Not a binary log header");
+
+        len = get_u32(buf + BINLOG_MAGIC_LEN);
+
+        free(reader->fields);
+        if ((reader->fields = (char *) malloc(len + 1)) == NULL)
+                return reader_error(reader, "Cannot allocate memory for field list");
+        if (fread(reader->fields, 1, len, reader->fp) != len)
+                return reader_error(reader, "Truncated binary log header");
+        reader->fields[len] = '\0';
+
+        reader->num_fields = 1;
+        for (i = 0; i < len; i++)
+                if (reader->fields[i] == ',') reader->num_fields++;
+
+        free(reader->values);
+        free(reader->lengths);
+        reader->values = (const char **) calloc(reader->num_fields, sizeof(char *));
+        reader->lengths = (size_t *) calloc(reader->num_fields, sizeof(size_t));
+        if (!reader->values || !reader->lengths)
+                return reader_error(reader, "Cannot allocate memory for field values");
+
+        reader->schema_changes++;
+
+        return 1;
+}
+
+/* Read and inflate the next block in the time range, taking in any
+   file header in between; returns 1 on success, 0 at the end of the
+   file, -1 on error */
+int read_block(BINLOG_READER *reader) {
+        char buf[BINLOG_BLOCK_HEADER_LEN];
+        struct block_header hdr;
+        uLongf raw_len;
+        size_t got;
+
+        for (;;) {
+                if ((got = fread(buf, 1, 4, reader->fp)) == 0) return 0;
+                if (got < 4) return reader_error(reader, "Truncated block header");
+
+                if (memcmp(buf, BINLOG_MAGIC, 4) == 0) {
+                        /* Another log appended to this one */
+                        if (read_file_header(reader, buf) != 1) return -1;
+                        continue;
+                }
+
+                if (memcmp(buf, BINLOG_BLOCK_MAGIC, 4) != 0)
+                        return reader_error(reader, "Bad block magic");
+
+                if (fread(buf + 4, 1, BINLOG_BLOCK_HEADER_LEN - 4, reader->fp) != BINLOG_BLOCK_HEADER_LEN - 4)
+                        return reader_error(reader, "Truncated block header");
+
+                hdr.method = get_u32(buf + 4);
+                hdr.comp_len = get_u32(buf + 8);
+                hdr.raw_len = get_u32(buf + 12);
+                hdr.records = get_u32(buf + 16);
+                hdr.crc = get_u32(buf + 20);
+                hdr.min_us = (long long) get_u64(buf + 24);
+                hdr.max_us = (long long) get_u64(buf + 32);
+
+                /* Skip blocks with nothing in the time range */
+                if ((hdr.records == 0) || (hdr.max_us < reader->start_us) || (hdr.min_us > reader->end_us)) {
+                        if (skip_bytes(reader, hdr.comp_len) == -1) return -1;
+                        continue;
+                }
+
+                if (grow_buffer(&reader->comp, &reader->comp_size, hdr.comp_len) == -1)
+                        return reader_error(reader, "Cannot allocate memory for block");
+                if (fread(reader->comp, 1, hdr.comp_len, reader->fp) != hdr.comp_len)
+                        return reader_error(reader, "Truncated block");
+
+                if (crc32(0, (const Bytef *) reader->comp, hdr.comp_len) != hdr.crc)
+                        return reader_error(reader, "Block checksum mismatch");
+
+                if (grow_buffer(&reader->raw, &reader->raw_size, hdr.raw_len) == -1)
+                        return reader_error(reader, "Cannot allocate memory for block");
+
+                if (hdr.method == BINLOG_STORED) {
+                        if (hdr.comp_len != hdr.raw_len) return reader_error(reader, "Bad stored block length");
+                        memcpy(reader->raw, reader->comp, hdr.raw_len);
+                } else if (hdr.method == BINLOG_DEFLATE) {
+                        raw_len = hdr.raw_len;
+                        if ((uncompress((Bytef *) reader->raw, &raw_len, (const Bytef *) reader->comp,
+                                        hdr.comp_len) != Z_OK) || (raw_len != hdr.raw_len))
+                                return reader_error(reader, "Cannot inflate block");
+                } else {
+                        return reader_error(reader, "Unknown block compression");
+                }
+
+                reader->raw_len = hdr.raw_len;
+                reader->raw_pos = 0;
+
+                return 1;
+        }
+}
+
+/* Move past len bytes, seeking if the file allows it */
+int skip_bytes(BINLOG_READER *reader, size_t len) {
+        size_t n;
+
+        if (fseek(reader->fp, len, SEEK_CUR) == 0) return 0;
+
+        /* A pipe has to be read through */
+        if (grow_buffer(&reader->comp, &reader->comp_size, len) == -1)
+                return reader_error(reader, "Cannot allocate memory for block");
+
+        n = fread(reader->comp, 1, len, reader->fp);
+        if (n != len) return reader_error(reader, "Truncated block");
+
+        return 0;
+}
+
+/* Make sure a buffer holds at least need bytes */
+int grow_buffer(char **buf, size_t *size, size_t need) {
+        char *tmp;
+
+        if (need <= *size) return 0;
+        if (need < 4096) need = 4096;
+
+        if ((tmp = (char *) realloc(*buf, need)) == NULL) return -1;
+        *buf = tmp;
+        *size = need;
+
+        return 0;
+}
+
+int reader_error(BINLOG_READER *reader, const char *msg) {
+        snprintf(reader->error, sizeof(reader->error), "%s", msg);
+
+        return -1;
+}
@@ -0,0 +1,54 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_BINLOG_H
+#define _HAVE_BINLOG_H
+
+#include <stdio.h>
+#include <sys/time.h>
+#include <sys/types.h>
+
+/* See doc/binlog for the layout of the format */
+#define BINLOG_MAGIC "HTRYLOG1"
+#define BINLOG_MAGIC_LEN 8
+#define BINLOG_BLOCK_MAGIC "HBLK"
+#define BINLOG_BLOCK_HEADER_LEN 40
+#define BINLOG_VARINT_MAX 10
+
+#define BINLOG_STORED 0
+#define BINLOG_DEFLATE 1
+
+/* Writing */
+size_t binlog_header(char *dst, size_t size, const char *fields);
+size_t binlog_put_varint(char *dst, unsigned long long val);
+size_t binlog_record_head(char *dst, size_t len, const struct timeval *ts);
+size_t binlog_block_bound(size_t len);
+size_t binlog_encode_block(const char *data, size_t len, char *dst, size_t size);
+
+/* Reading */
+typedef struct binlog_reader BINLOG_READER;
+
+typedef struct binlog_record {
+        struct timeval ts;
+        unsigned int num_fields;
+        const char **values;      /* NULL for an empty field */
+        const size_t *lengths;
+} BINLOG_RECORD;
+
+BINLOG_READER *binlog_open(FILE *fp);
+void binlog_set_range(BINLOG_READER *reader, const struct timeval *start, const struct timeval *end);
+int binlog_next(BINLOG_READER *reader, BINLOG_RECORD *rec);
+const char *binlog_fields(BINLOG_READER *reader);
+unsigned int binlog_schema_changes(BINLOG_READER *reader);
+const char *binlog_error(BINLOG_READER *reader);
+void binlog_close(BINLOG_READER *reader);
+
+#endif /* ! _HAVE_BINLOG_H */
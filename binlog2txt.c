@@ -0,0 +1,108 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Convert binary logs written with -B back into the text output
+  format, optionally keeping only the records within a time range.
+  A field list line is printed at the start of each log read, the
+  same as httpry writes when logging text to a file.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "binlog.h"
+#include "config.h"
+
+int convert(FILE *fp, const char *name);
+void display_usage();
+
+static struct timeval start, end;
+static int use_start = 0, use_end = 0;
+
+int main(int argc, char **argv) {
+        int opt, i, status = EXIT_SUCCESS;
+        extern char *optarg;
+        extern int optind;
+        FILE *fp;
+
+        while ((opt = getopt(argc, argv, "e:hs:")) != -1) {
+                switch (opt) {
+                        case 'e': end.tv_sec = atol(optarg); end.tv_usec = 999999; use_end = 1; break;
+                        case 'h': display_usage(); break;
+                        case 's': start.tv_sec = atol(optarg); use_start = 1; break;
+                        default: display_usage();
+                }
+        }
+
+        if (optind == argc)
+                return convert(stdin, "stdin") ? EXIT_FAILURE : EXIT_SUCCESS;
+
+        for (i = optind; i < argc; i++) {
+                if ((fp = fopen(argv[i], "rb")) == NULL) {
+                        fprintf(stderr, "Cannot open input file '%s'\n", argv[i]);
+                        status = EXIT_FAILURE;
+                        continue;
+                }
+
+                if (convert(fp, argv[i])) status = EXIT_FAILURE;
+                fclose(fp);
+        }
+
+        return status;
+}
+
+/* Print every record in the time range as a text line; returns
+   nonzero if the log could not be read to the end */
+int convert(FILE *fp, const char *name) {
+        BINLOG_READER *reader;
+        BINLOG_RECORD rec;
+        unsigned int schema = 0, i;
+        int s;
+
+        if ((reader = binlog_open(fp)) == NULL) {
+                fprintf(stderr, "%s: not a binary log\n", name);
+                return 1;
+        }
+
+        binlog_set_range(reader, use_start ? &start : NULL, use_end ? &end : NULL);
+
+        while ((s = binlog_next(reader, &rec)) == 1) {
+                if (binlog_schema_changes(reader) != schema) {
+                        schema = binlog_schema_changes(reader);
+                        printf("# Fields: %s\n", binlog_fields(reader));
+                }
+
+                for (i = 0; i < rec.num_fields; i++) {
+                        fputs(rec.values[i] ? rec.values[i] : EMPTY_FIELD, stdout);
+                        fputs((i < rec.num_fields - 1) ? FIELD_DELIM : "\n", stdout);
+                }
+        }
+
+        if (s == -1)
+                fprintf(stderr, "%s: %s\n", name, binlog_error(reader));
+
+        binlog_close(reader);
+
+        return s == -1;
+}
+
+void display_usage() {
+        printf("Usage: binlog2txt [ -h ] [ -s start ] [ -e end ] [ file ... ]\n\n");
+
+        printf("   -e end       skip records after this time (seconds since the epoch)\n"
+               "   -h           print this help information\n"
+               "   -s start     skip records before this time (seconds since the epoch)\n"
+               "   file         binary logs to read; standard input if none are given\n\n");
+
+        exit(EXIT_SUCCESS);
+}
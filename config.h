@@ -34,10 +34,90 @@
    *** Can be overridden with -l */
 #define DEFAULT_RATE_THRESHOLD 2
 
-/* Default display interval for rate statistics
+/* Default number of keys tracked in rate statistics top-K mode
+   *** Can be overridden with -k */
+#define DEFAULT_TOPK_SIZE 100
+
+/* Default aggregates reported for each group in aggregation mode; any
+   of count, rps, bytes and p1 to p99
+   *** Can be overridden with -g */
+#define DEFAULT_AGGREGATES "count,rps"
+
+/* Default display interval for rate statistics and aggregation mode
    *** Can be overridden with -t */
 #define DEFAULT_RATE_INTERVAL 5
 
+/* Default capture ring geometry and block retire timeout (ms) when
+   capturing through a memory-mapped ring
+   *** Can be overridden with -R */
+#define DEFAULT_RING_BLOCK_SIZE (1024 * 1024)
+#define DEFAULT_RING_BLOCK_NUM 64
+#define DEFAULT_RING_TIMEOUT 100
+
+/* Default number of bytes captured from each packet when capturing
+   live, and the smallest and largest allowed; this bounds the header
+   block that can be parsed from a single packet. The minimum covers
+   an Ethernet header, a VLAN tag and IP and TCP headers of the
+   largest size, so any packet we can use is decoded in full
+   *** Can be overridden with -y */
+#define DEFAULT_SNAPLEN 8192
+#define MIN_SNAPLEN (14 + 4 + 60 + 60)
+#define MAX_SNAPLEN 65535
+
+/* Default number of packets taken from the capture source and parsed
+   together as a batch, and the largest batch allowed. Packets read
+   through libpcap have to be copied to be batched, which costs more
+   than batching saves, so by default they are parsed one at a time
+   *** Can be overridden with -x */
+#define DEFAULT_BATCH_SIZE 32
+#define DEFAULT_PCAP_BATCH_SIZE 1
+#define MAX_BATCH_SIZE 256
+
+/* Default longest time (ms) a parsed record is held in the output
+   buffers; zero holds records until a buffer fills
+   *** Can be overridden with -L */
+#define DEFAULT_FLUSH_INTERVAL 1000
+
+/* Default byte cap, idle timeout (seconds) and number of flows per
+   worker for TCP reassembly
+   *** Can be overridden with -a */
+#define DEFAULT_STREAM_BYTES 16384
+#define DEFAULT_STREAM_TIMEOUT 30
+#define DEFAULT_STREAM_FLOWS 1024
+
+/* Default number of flows, requests queued per flow and request
+   timeout (seconds) per worker for request/response pairing
+   *** Can be overridden with -c */
+#define DEFAULT_PAIR_FLOWS 1024
+#define DEFAULT_PAIR_DEPTH 8
+#define DEFAULT_PAIR_TIMEOUT 60
+
+/* Default packets and bytes written for each matched flow and the
+   snaplen packets are cut to in the flow dump; zero means no limit
+   *** Can be overridden with -D */
+#define DEFAULT_FLOWDUMP_PACKETS 32
+#define DEFAULT_FLOWDUMP_BYTES 65536
+#define DEFAULT_FLOWDUMP_SNAPLEN 0
+
+/* Connections tracked per worker for the flow dump; the least
+   recently active is dropped when more are seen */
+#define FLOWDUMP_FLOWS 4096
+
+/* Default file size (MB) and age (seconds) at which the output file
+   is rotated; zero disables either limit
+   *** Can be overridden with -O */
+#define DEFAULT_ROTATE_SIZE 0
+#define DEFAULT_ROTATE_INTERVAL 0
+
+/* zlib compression level (1-9) used for the output file with -z;
+   higher levels save little on log lines for the CPU they cost */
+#define LOG_COMPRESS_LEVEL 1
+
+/* Hosts listed on the metrics endpoint, heaviest first, and the time
+   (ms) a client is given to send its request and read the reply */
+#define METRICS_TOP_HOSTS 10
+#define METRICS_TIMEOUT 1000
+
 /* Default location to store the PID file when running in daemon mode
    *** Can be overridden with -P */
 #define PID_FILENAME "/var/run/httpry.pid"
@@ -54,7 +134,12 @@
 /* HTTP specific constant; should never change! */
 #define HTTP_STRING "HTTP/"
 
+/* Most header lines kept from a single packet; any beyond this
+   are ignored */
+#define MAX_HEADER_FIELDS 64
+
 #define MAX_TIME_LEN 32
 #define PORTSTRLEN 6
+#define USECSTRLEN 24
 
 #endif /* ! _HAVE_CONFIG_H */
@@ -19,11 +19,14 @@
 extern int quiet_mode;
 extern int use_syslog;
 
+/* Called by DIE once the error is reported; never returns */
+void die() __attribute__((noreturn));
+
 /* Macros for logging/displaying status messages */
 #define PRINT(x...) { if (!quiet_mode) { fprintf(stderr, x); fprintf(stderr, "\n"); } }
 #define WARN(x...) { fprintf(stderr, "Warning: " x); fprintf(stderr, "\n"); }
 #define LOG(x...) { if (use_syslog) { openlog(PROG_NAME, LOG_PID, LOG_DAEMON); syslog(LOG_ERR, x); closelog(); } }
-#define DIE(x...) { fprintf(stderr, "Error: " x); fprintf(stderr, "\n"); raise(SIGINT); }
+#define DIE(x...) { fprintf(stderr, "Error: " x); fprintf(stderr, "\n"); die(); }
 #define LOG_PRINT(x...) { LOG(x); PRINT(x); }
 #define LOG_WARN(x...) { LOG(x); WARN(x); }
 #define LOG_DIE(x...) { LOG(x); DIE(x); }
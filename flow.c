@@ -0,0 +1,49 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#include <string.h>
+#include <stdint.h>
+#include "flow.h"
+
+/* Hash a flow key; the result is well mixed in all bits so callers
+   can mask it down to a power of 2 table size */
+unsigned int hash_flow(const FLOW_KEY *key) {
+        const u_char *p = (const u_char *) key;
+        uint64_t hash = 0xcbf29ce484222325ULL;
+        size_t i;
+
+        /* FNV-1a over the key, then a final avalanche */
+        for (i = 0; i < sizeof(FLOW_KEY); i++) {
+                hash ^= p[i];
+                hash *= 0x100000001b3ULL;
+        }
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdULL;
+        hash ^= hash >> 33;
+
+        return (unsigned int) hash;
+}
+
+int flow_equal(const FLOW_KEY *a, const FLOW_KEY *b) {
+        return memcmp(a, b, sizeof(FLOW_KEY)) == 0;
+}
+
+/* Build the key for the opposite direction of a flow */
+void reverse_flow(FLOW_KEY *dst, const FLOW_KEY *src) {
+        memset(dst, 0, sizeof(FLOW_KEY));
+        memcpy(dst->saddr, src->daddr, sizeof(dst->saddr));
+        memcpy(dst->daddr, src->saddr, sizeof(dst->daddr));
+        dst->sport = src->dport;
+        dst->dport = src->sport;
+        dst->family = src->family;
+
+        return;
+}
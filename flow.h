@@ -0,0 +1,32 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_FLOW_H
+#define _HAVE_FLOW_H
+
+#include <sys/types.h>
+
+/* One direction of a TCP connection; keys must be zeroed before they
+   are filled in so they can be compared as a whole. Addresses and
+   ports are kept in network byte order. */
+typedef struct flow_key {
+        u_char saddr[16];
+        u_char daddr[16];
+        u_short sport;
+        u_short dport;
+        int family;
+} FLOW_KEY;
+
+unsigned int hash_flow(const FLOW_KEY *key);
+int flow_equal(const FLOW_KEY *a, const FLOW_KEY *b);
+void reverse_flow(FLOW_KEY *dst, const FLOW_KEY *src);
+
+#endif /* ! _HAVE_FLOW_H */
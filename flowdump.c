@@ -0,0 +1,607 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  A flow dump writes the start of every connection that carried a
+  logged HTTP message to a pcap file: the handshake, the packet that
+  matched and the packets that follow in both directions, up to a
+  packet and byte limit per connection and cut to a dump snaplen.
+
+  Each capture worker owns a flow table, as packet fanout sends both
+  directions of a connection to the same worker. A connection is only
+  known to match once a message on it has been parsed, so the packets
+  of its handshake are copied into the flow entry when seen and only
+  written out if it matches. Entries are keyed on the lower of the two
+  directions and kept on a list in order of use; the least recently
+  used is dropped when the table is full, and entries idle for the
+  timeout are dropped by flowdump_expire().
+
+  Packets are written by a background thread. The workers append pcap
+  records to a queue of large page aligned buffers; the thread writes
+  each buffer once it fills, or once output has been idle a second,
+  with a single write() call. A worker only waits when every buffer is
+  queued.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "flowdump.h"
+#include "tcp.h"
+
+#define HOLD_PACKETS 3             /* Handshake packets held per flow */
+#define HOLD_SNAPLEN 128           /* Bytes held of each */
+#define FLOW_TIMEOUT 60
+#define DUMP_BUFFERS 8
+#define DUMP_BUFSIZE 1048576
+#define DUMP_ALIGN 4096
+#define IDLE_FLUSH 1
+
+/* Record header as stored in a pcap file */
+struct dump_record {
+        unsigned int ts_sec;
+        unsigned int ts_usec;
+        unsigned int caplen;
+        unsigned int len;
+};
+
+struct held_packet {
+        struct pcap_pkthdr header;
+        u_char data[HOLD_SNAPLEN];
+};
+
+typedef struct dump_flow DUMP_FLOW;
+struct dump_flow {
+        FLOW_KEY key;             /* Lower of the two directions */
+        int matched;
+        unsigned int packets;     /* Written so far */
+        unsigned long bytes;
+        unsigned int held;
+        struct held_packet hold[HOLD_PACKETS];
+        time_t last;
+        DUMP_FLOW *next;          /* Hash chain or free list */
+        DUMP_FLOW *prev_use, *next_use;
+};
+
+struct flowdump_table {
+        DUMP_FLOW *pool;
+        DUMP_FLOW **buckets;
+        unsigned int hash_mask;
+        DUMP_FLOW *free_list;
+        DUMP_FLOW *newest, *oldest;
+        unsigned int max_packets;
+        unsigned long max_bytes;
+        unsigned int snaplen;
+        struct flowdump_stats stats;
+};
+
+struct dump_buffer {
+        char *data;
+        size_t len;
+};
+
+void canonical_key(FLOW_KEY *dst, const FLOW_KEY *key);
+DUMP_FLOW *find_flow(FLOWDUMP_TABLE *table, const FLOW_KEY *key);
+DUMP_FLOW *add_flow(FLOWDUMP_TABLE *table, const FLOW_KEY *key);
+void release_flow(FLOWDUMP_TABLE *table, DUMP_FLOW *flow);
+void touch_flow(FLOWDUMP_TABLE *table, DUMP_FLOW *flow, time_t now);
+void write_flow_packet(FLOWDUMP_TABLE *table, DUMP_FLOW *flow, const struct pcap_pkthdr *header,
+                       const u_char *pkt);
+void queue_record(const struct pcap_pkthdr *header, unsigned int caplen, const u_char *pkt);
+void hand_over_buffer();
+void *run_dump_writer(void *args);
+void write_buffers(unsigned int first, unsigned int count);
+void open_dump_file();
+
+static struct dump_buffer buffers[DUMP_BUFFERS];
+static unsigned int buffer_head = 0;     /* Oldest buffer handed to the writer */
+static unsigned int buffer_count = 0;    /* Buffers handed to the writer */
+static pthread_mutex_t buffer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t buffer_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t buffer_free = PTHREAD_COND_INITIALIZER;
+
+static pthread_t thread;
+static int thread_created = 0;
+static int stopping = 0;
+static volatile sig_atomic_t reopen_requested = 0;
+
+static char *dump_path = NULL;
+static int dump_fd = -1;
+static int dump_linktype = 0;
+static unsigned int dump_snaplen = 0;
+
+/* Open the dump file and allocate the write buffers; linktype and
+   snaplen are recorded in the file header */
+void flowdump_open(char *path, int linktype, unsigned int snaplen) {
+        int i;
+
+#ifdef DEBUG
+        ASSERT(path);
+#endif
+
+        dump_path = path;
+        dump_linktype = linktype;
+        dump_snaplen = snaplen ? snaplen : 65535;
+
+        for (i = 0; i < DUMP_BUFFERS; i++) {
+                if (posix_memalign((void **) &buffers[i].data, DUMP_ALIGN, DUMP_BUFSIZE) != 0)
+                        LOG_DIE("Cannot allocate memory for flow dump buffers");
+                buffers[i].len = 0;
+        }
+
+        open_dump_file();
+        if (dump_fd == -1)
+                LOG_DIE("Cannot open flow dump file '%s'", path);
+
+        return;
+}
+
+/* Spawn the writer thread */
+void flowdump_start() {
+        sigset_t set;
+        int s;
+
+        if (thread_created || (dump_fd == -1)) return;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Flow dump thread signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_dump_writer, NULL);
+        if (s != 0)
+                LOG_DIE("Flow dump thread creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Flow dump thread signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Ask the writer thread to start the dump file over, as -b does on
+   SIGHUP; safe to call from a signal handler */
+void flowdump_reopen() {
+        reopen_requested = 1;
+
+        return;
+}
+
+/* Write out everything queued, stop the writer thread and close the
+   dump file */
+void flowdump_close() {
+        int s, i;
+
+        if (thread_created) {
+                pthread_mutex_lock(&buffer_lock);
+                stopping = 1;
+                pthread_cond_signal(&buffer_ready);
+                pthread_mutex_unlock(&buffer_lock);
+
+                s = pthread_join(thread, NULL);
+                if (s != 0)
+                        LOG_WARN("Flow dump thread join failed with error %d", s);
+
+                thread_created = 0;
+        } else if (dump_fd != -1) {
+                write_buffers(buffer_head, 1);
+        }
+
+        if (dump_fd != -1) close(dump_fd);
+        dump_fd = -1;
+
+        for (i = 0; i < DUMP_BUFFERS; i++) {
+                free(buffers[i].data);
+                buffers[i].data = NULL;
+        }
+
+        return;
+}
+
+/* Create a table of up to max_flows connections, each dumped for up
+   to max_packets packets and max_bytes bytes (0 for no limit) with
+   packets cut to snaplen bytes (0 for the whole packet) */
+FLOWDUMP_TABLE *flowdump_table_new(unsigned int max_flows, unsigned int max_packets, unsigned long max_bytes,
+                                   unsigned int snaplen) {
+        FLOWDUMP_TABLE *table;
+        unsigned int size, i;
+
+#ifdef DEBUG
+        ASSERT(max_flows > 0);
+#endif
+
+        if ((table = (FLOWDUMP_TABLE *) calloc(1, sizeof(FLOWDUMP_TABLE))) == NULL)
+                LOG_DIE("Cannot allocate memory for flow dump table");
+
+        if ((table->pool = (DUMP_FLOW *) calloc(max_flows, sizeof(DUMP_FLOW))) == NULL)
+                LOG_DIE("Cannot allocate memory for flow dump pool");
+
+        for (size = 1; size < max_flows * 2; size <<= 1);
+        if ((table->buckets = (DUMP_FLOW **) calloc(size, sizeof(DUMP_FLOW *))) == NULL)
+                LOG_DIE("Cannot allocate memory for flow dump hash");
+
+        for (i = 0; i < max_flows; i++) {
+                table->pool[i].next = table->free_list;
+                table->free_list = &table->pool[i];
+        }
+
+        table->hash_mask = size - 1;
+        table->max_packets = max_packets;
+        table->max_bytes = max_bytes;
+        table->snaplen = snaplen;
+
+        return table;
+}
+
+/* Look at every TCP packet the worker sees: packets of a matched flow
+   are written while within its limits, and handshake packets are held
+   in case the flow matches later */
+void flowdump_packet(FLOWDUMP_TABLE *table, const FLOW_KEY *key, int flags, int payload_len,
+                     const struct pcap_pkthdr *header, const u_char *pkt) {
+        struct held_packet *held;
+        DUMP_FLOW *flow;
+
+        if (!(flow = find_flow(table, key))) {
+                /* Only a new connection is worth holding packets for */
+                if ((flags & (TH_SYN | TH_ACK)) != TH_SYN) return;
+                flow = add_flow(table, key);
+        } else if (((flags & (TH_SYN | TH_ACK)) == TH_SYN) && (flow->matched || flow->held)) {
+                /* The ports have been reused for a new connection */
+                flow->matched = 0;
+                flow->packets = 0;
+                flow->bytes = 0;
+                flow->held = 0;
+        }
+
+        touch_flow(table, flow, header->ts.tv_sec);
+
+        if (flow->matched) {
+                write_flow_packet(table, flow, header, pkt);
+        } else if ((payload_len <= 0) && (flow->held < HOLD_PACKETS)) {
+                held = &flow->hold[flow->held++];
+                held->header = *header;
+                if (held->header.caplen > HOLD_SNAPLEN) held->header.caplen = HOLD_SNAPLEN;
+                memcpy(held->data, pkt, held->header.caplen);
+        }
+
+        return;
+}
+
+/* Mark the flow of a packet that carried a logged message as matched,
+   writing any held handshake packets and then the packet itself; a
+   flow that already matched has had the packet written already */
+void flowdump_match(FLOWDUMP_TABLE *table, const FLOW_KEY *key, const struct pcap_pkthdr *header,
+                    const u_char *pkt) {
+        struct held_packet *held;
+        DUMP_FLOW *flow;
+        unsigned int i;
+
+        if (!(flow = find_flow(table, key))) flow = add_flow(table, key);
+        if (flow->matched) return;
+
+        touch_flow(table, flow, header->ts.tv_sec);
+        flow->matched = 1;
+        table->stats.matched++;
+
+        for (i = 0; i < flow->held; i++) {
+                held = &flow->hold[i];
+                write_flow_packet(table, flow, &held->header, held->data);
+        }
+        flow->held = 0;
+
+        write_flow_packet(table, flow, header, pkt);
+
+        return;
+}
+
+/* Drop the flows idle for longer than the timeout */
+void flowdump_expire(FLOWDUMP_TABLE *table, time_t now) {
+        while (table->oldest && (table->oldest->last + FLOW_TIMEOUT < now))
+                release_flow(table, table->oldest);
+
+        return;
+}
+
+void flowdump_stats(FLOWDUMP_TABLE *table, struct flowdump_stats *stats) {
+        if (!table) {
+                memset(stats, 0, sizeof(struct flowdump_stats));
+                return;
+        }
+
+        memcpy(stats, &table->stats, sizeof(struct flowdump_stats));
+
+        return;
+}
+
+void flowdump_table_free(FLOWDUMP_TABLE *table) {
+        if (!table) return;
+
+        free(table->pool);
+        free(table->buckets);
+        free(table);
+
+        return;
+}
+
+/* Key a flow on the lower of its two directions, so both find it */
+void canonical_key(FLOW_KEY *dst, const FLOW_KEY *key) {
+        reverse_flow(dst, key);
+        if (memcmp(key, dst, sizeof(FLOW_KEY)) < 0)
+                memcpy(dst, key, sizeof(FLOW_KEY));
+
+        return;
+}
+
+DUMP_FLOW *find_flow(FLOWDUMP_TABLE *table, const FLOW_KEY *key) {
+        DUMP_FLOW *flow;
+        FLOW_KEY canon;
+
+        canonical_key(&canon, key);
+
+        for (flow = table->buckets[hash_flow(&canon) & table->hash_mask]; flow; flow = flow->next) {
+                if (flow_equal(&flow->key, &canon)) return flow;
+        }
+
+        return NULL;
+}
+
+/* Add an entry for a flow, dropping the least recently used flow if
+   the table is full */
+DUMP_FLOW *add_flow(FLOWDUMP_TABLE *table, const FLOW_KEY *key) {
+        DUMP_FLOW *flow, **bucket;
+
+        if (!table->free_list) {
+                table->stats.evicted++;
+                release_flow(table, table->oldest);
+        }
+
+        flow = table->free_list;
+        table->free_list = flow->next;
+
+        canonical_key(&flow->key, key);
+        flow->matched = 0;
+        flow->packets = 0;
+        flow->bytes = 0;
+        flow->held = 0;
+        flow->last = 0;
+        flow->prev_use = flow->next_use = NULL;
+
+        bucket = &table->buckets[hash_flow(&flow->key) & table->hash_mask];
+        flow->next = *bucket;
+        *bucket = flow;
+
+        return flow;
+}
+
+void release_flow(FLOWDUMP_TABLE *table, DUMP_FLOW *flow) {
+        DUMP_FLOW **link;
+
+        for (link = &table->buckets[hash_flow(&flow->key) & table->hash_mask]; *link; link = &(*link)->next) {
+                if (*link == flow) {
+                        *link = flow->next;
+                        break;
+                }
+        }
+
+        if (flow->prev_use) flow->prev_use->next_use = flow->next_use;
+        else if (table->newest == flow) table->newest = flow->next_use;
+        if (flow->next_use) flow->next_use->prev_use = flow->prev_use;
+        else if (table->oldest == flow) table->oldest = flow->prev_use;
+
+        flow->next = table->free_list;
+        table->free_list = flow;
+
+        return;
+}
+
+/* Move a flow to the front of the use list */
+void touch_flow(FLOWDUMP_TABLE *table, DUMP_FLOW *flow, time_t now) {
+        flow->last = now;
+        if (table->newest == flow) return;
+
+        if (flow->prev_use) flow->prev_use->next_use = flow->next_use;
+        if (flow->next_use) flow->next_use->prev_use = flow->prev_use;
+        else if (table->oldest == flow) table->oldest = flow->prev_use;
+
+        flow->prev_use = NULL;
+        flow->next_use = table->newest;
+        if (table->newest) table->newest->prev_use = flow;
+        table->newest = flow;
+        if (!table->oldest) table->oldest = flow;
+
+        return;
+}
+
+/* Write a packet of a matched flow if it is still within its limits */
+void write_flow_packet(FLOWDUMP_TABLE *table, DUMP_FLOW *flow, const struct pcap_pkthdr *header,
+                       const u_char *pkt) {
+        unsigned int caplen = header->caplen;
+
+        if ((table->max_packets && (flow->packets >= table->max_packets)) ||
+            (table->max_bytes && (flow->bytes >= table->max_bytes)))
+                return;
+
+        if (table->snaplen && (caplen > table->snaplen)) caplen = table->snaplen;
+
+        queue_record(header, caplen, pkt);
+
+        flow->packets++;
+        flow->bytes += caplen;
+        table->stats.packets++;
+        table->stats.bytes += caplen;
+
+        if ((table->max_packets && (flow->packets == table->max_packets)) ||
+            (table->max_bytes && (flow->bytes >= table->max_bytes)))
+                table->stats.capped++;
+
+        return;
+}
+
+/* Append a pcap record to the buffer being filled */
+void queue_record(const struct pcap_pkthdr *header, unsigned int caplen, const u_char *pkt) {
+        struct dump_record rec;
+        struct dump_buffer *buf;
+
+        rec.ts_sec = header->ts.tv_sec;
+        rec.ts_usec = header->ts.tv_usec;
+        rec.caplen = caplen;
+        rec.len = header->len;
+
+        pthread_mutex_lock(&buffer_lock);
+
+        buf = &buffers[(buffer_head + buffer_count) % DUMP_BUFFERS];
+        if (buf->len + sizeof(rec) + caplen > DUMP_BUFSIZE) {
+                hand_over_buffer();
+                buf = &buffers[(buffer_head + buffer_count) % DUMP_BUFFERS];
+        }
+
+        memcpy(buf->data + buf->len, &rec, sizeof(rec));
+        memcpy(buf->data + buf->len + sizeof(rec), pkt, caplen);
+        buf->len += sizeof(rec) + caplen;
+
+        pthread_mutex_unlock(&buffer_lock);
+
+        return;
+}
+
+/* Hand the buffer being filled to the writer thread, which writes it
+   directly if not yet running; the caller must hold the buffer lock */
+void hand_over_buffer() {
+        if (!thread_created) {
+                write_buffers(buffer_head, 1);
+                return;
+        }
+
+        while (buffer_count == DUMP_BUFFERS - 1)
+                pthread_cond_wait(&buffer_free, &buffer_lock);
+
+        buffer_count++;
+        pthread_cond_signal(&buffer_ready);
+
+        return;
+}
+
+/* This is our writer thread; it writes each buffer as it is handed
+   over, and any partial buffer once output has been idle a while */
+void *run_dump_writer(void *args) {
+        struct timespec ts;
+        unsigned int first, count;
+        int done;
+
+        pthread_mutex_lock(&buffer_lock);
+
+        while (1) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += IDLE_FLUSH;
+
+                while ((buffer_count == 0) && !stopping && !reopen_requested) {
+                        if (pthread_cond_timedwait(&buffer_ready, &buffer_lock, &ts) == ETIMEDOUT)
+                                break;
+                }
+
+                /* Take the partial buffer if nothing else is waiting */
+                if ((buffer_count == 0) && (buffers[buffer_head].len > 0)) buffer_count++;
+
+                first = buffer_head;
+                count = buffer_count;
+                done = stopping;
+                pthread_mutex_unlock(&buffer_lock);
+
+                write_buffers(first, count);
+
+                if (reopen_requested) {
+                        reopen_requested = 0;
+                        if (dump_fd != -1) close(dump_fd);
+                        open_dump_file();
+                }
+
+                pthread_mutex_lock(&buffer_lock);
+                buffer_head = (buffer_head + count) % DUMP_BUFFERS;
+                buffer_count -= count;
+                pthread_cond_broadcast(&buffer_free);
+
+                /* Stop once a final pass finds nothing left */
+                if (done && (count == 0)) break;
+        }
+
+        pthread_mutex_unlock(&buffer_lock);
+
+        return (void *) 0;
+}
+
+/* Write a run of queued buffers, retrying on short writes */
+void write_buffers(unsigned int first, unsigned int count) {
+        struct dump_buffer *buf;
+        size_t pos;
+        ssize_t n;
+
+        while (count--) {
+                buf = &buffers[first];
+                first = (first + 1) % DUMP_BUFFERS;
+
+                for (pos = 0; (dump_fd != -1) && (pos < buf->len); pos += n) {
+                        n = write(dump_fd, buf->data + pos, buf->len - pos);
+                        if (n == -1) {
+                                if (errno == EINTR) {
+                                        n = 0;
+                                        continue;
+                                }
+                                LOG_WARN("Cannot write flow dump file '%s': %s", dump_path, strerror(errno));
+                                break;
+                        }
+                }
+
+                buf->len = 0;
+        }
+
+        return;
+}
+
+/* Create the dump file and write the pcap file header; on failure
+   packets are dropped until the next reopen */
+void open_dump_file() {
+        struct {
+                unsigned int magic;
+                unsigned short version_major, version_minor;
+                int thiszone;
+                unsigned int sigfigs, snaplen, linktype;
+        } hdr;
+
+        if ((dump_fd = open(dump_path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) == -1) {
+                LOG_WARN("Cannot open flow dump file '%s': %s", dump_path, strerror(errno));
+                return;
+        }
+
+        hdr.magic = 0xa1b2c3d4;
+        hdr.version_major = PCAP_VERSION_MAJOR;
+        hdr.version_minor = PCAP_VERSION_MINOR;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.snaplen = dump_snaplen;
+        hdr.linktype = dump_linktype;
+
+        if (write(dump_fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+                LOG_WARN("Cannot write flow dump file header to '%s'", dump_path);
+
+        return;
+}
@@ -0,0 +1,43 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_FLOWDUMP_H
+#define _HAVE_FLOWDUMP_H
+
+#include <pcap.h>
+#include <time.h>
+#include "flow.h"
+
+typedef struct flowdump_table FLOWDUMP_TABLE;
+
+struct flowdump_stats {
+        unsigned int matched;     /* Flows dumped */
+        unsigned int packets;     /* Packets written */
+        unsigned int capped;      /* Flows that reached a limit */
+        unsigned int evicted;     /* Flows dropped for room */
+        unsigned long bytes;      /* Packet bytes written */
+};
+
+void flowdump_open(char *path, int linktype, unsigned int snaplen);
+void flowdump_start();
+void flowdump_reopen();
+void flowdump_close();
+FLOWDUMP_TABLE *flowdump_table_new(unsigned int max_flows, unsigned int max_packets, unsigned long max_bytes,
+                                   unsigned int snaplen);
+void flowdump_packet(FLOWDUMP_TABLE *table, const FLOW_KEY *key, int flags, int payload_len,
+                     const struct pcap_pkthdr *header, const u_char *pkt);
+void flowdump_match(FLOWDUMP_TABLE *table, const FLOW_KEY *key, const struct pcap_pkthdr *header,
+                    const u_char *pkt);
+void flowdump_expire(FLOWDUMP_TABLE *table, time_t now);
+void flowdump_stats(FLOWDUMP_TABLE *table, struct flowdump_stats *stats);
+void flowdump_table_free(FLOWDUMP_TABLE *table);
+
+#endif /* ! _HAVE_FLOWDUMP_H */
@@ -12,7 +12,7 @@
 /*
   The output format data structure is stored as a hash table
   with all of the nodes additionally chained together as a linked
-  list. This allows insert_value() to utilize the more efficient
+  list. This allows format_slot() to utilize the more efficient
   hash structure to find nodes, while functions that need to
   traverse all nodes in insertion order can use the linked list.
   A separate head pointer is maintained for the start of the
@@ -21,6 +21,24 @@
   The hash table creates some wasted space as the table tends to
   be rather sparse, but the efficiency amortizes on longer runs
   and it scales well to longer format strings.
+
+  The field nodes are shared and never modified once the format
+  string has been parsed. Packet values are kept separately in a
+  format record, indexed by each node's position in the list, so
+  that every capture worker can fill in its own record. A value is
+  a pointer and length, usually into the packet itself, so values
+  need not be terminated and the packet is never copied or written.
+
+  The hash is only used at startup. Each field a caller fills in is
+  resolved once to its slot in the record with format_slot(), and
+  values are then stored with set_value() without any name lookup.
+  A missing field resolves to -1, which lets the packet path skip
+  work whose result would never be printed.
+
+  Fields copied from header lines are also entered in a small open
+  addressing table keyed on the name length and its first and last
+  characters, so a header name from a packet is matched with one
+  probe and a case-insensitive compare rather than a full hash.
 */
 
 #include <ctype.h>
@@ -28,23 +46,54 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include "binlog.h"
 #include "error.h"
 #include "format.h"
+#include "output.h"
 #include "utility.h"
 
 #define HASHSIZE 64
+#define HEADER_TABLE_SIZE 256  /* Must be a power of 2 */
 
 typedef struct format_node FORMAT_NODE;
 struct format_node {
-        char *name, *value;
+        char *name;
+        int index;
+        int header;               /* Filled from a header line */
         FORMAT_NODE *next, *list;
 };
 
+struct format_record {
+        const char **values;
+        size_t *lens;
+};
+
 FORMAT_NODE *insert_field(char *str, size_t len);
 FORMAT_NODE *get_field(char *str);
+void insert_header_name(char *name, size_t len, int slot);
+unsigned int hash_header_name(const char *name, size_t len);
 
 static FORMAT_NODE *fields[HASHSIZE];
 static FORMAT_NODE *head = NULL;
+static int num_fields = 0;
+static int num_header_fields = 0;
+static char *field_names = NULL;
+
+static struct {
+        char *name;
+        size_t len;
+        int slot;
+} header_table[HEADER_TABLE_SIZE];
+
+/* Fields derived from the packet rather than copied from a header */
+static char *derived_fields[] = {
+        "timestamp", "timestamp-utc", "timestamp-ms",
+        "source-ip", "dest-ip", "source-port", "dest-port",
+        "direction", "method", "request-uri", "http-version",
+        "status-code", "reason-phrase",
+        "response-time-us", "paired-method", "paired-uri",
+        NULL
+};
 
 /* Parse and insert output fields from format string */
 void parse_format_string(char *str) {
@@ -108,6 +157,7 @@ FORMAT_NODE *insert_field(char *name, size_t len) {
         FORMAT_NODE *node;
         static FORMAT_NODE *prev = NULL;
         unsigned int hashval;
+        int i;
 
 #ifdef DEBUG
         ASSERT(name);
@@ -135,9 +185,22 @@ FORMAT_NODE *insert_field(char *name, size_t len) {
                 LOG_DIE("Cannot allocate memory for node name");
         str_copy(node->name, name, len + 1);
 
-        node->value = NULL;
+        node->index = num_fields++;
         node->list = NULL;
 
+        node->header = 1;
+        for (i = 0; derived_fields[i]; i++) {
+                if (strcmp(name, derived_fields[i]) == 0) {
+                        node->header = 0;
+                        break;
+                }
+        }
+
+        if (node->header) {
+                insert_header_name(node->name, len, node->index);
+                num_header_fields++;
+        }
+
         /* Update the linked list pointers */
         if (prev) prev->list = node;
         prev = node;
@@ -146,53 +209,205 @@ FORMAT_NODE *insert_field(char *name, size_t len) {
         return node;
 }
 
-/* If the node exists, update its value field */
-void insert_value(char *name, char *value) {
+/* Allocate an empty record able to hold a value for each field;
+   must be called after the format string has been parsed */
+FORMAT_RECORD *new_format_record() {
+        FORMAT_RECORD *rec;
+
+#ifdef DEBUG
+        ASSERT(num_fields > 0);
+#endif
+
+        if ((rec = (FORMAT_RECORD *) malloc(sizeof(FORMAT_RECORD))) == NULL)
+                LOG_DIE("Cannot allocate memory for format record");
+
+        if ((rec->values = (const char **) calloc(num_fields, sizeof(char *))) == NULL)
+                LOG_DIE("Cannot allocate memory for format record values");
+
+        if ((rec->lens = (size_t *) calloc(num_fields, sizeof(size_t))) == NULL)
+                LOG_DIE("Cannot allocate memory for format record lengths");
+
+        return rec;
+}
+
+/* Free a record allocated by new_format_record() */
+void free_format_record(FORMAT_RECORD *rec) {
+        if (!rec) return;
+
+        free(rec->values);
+        free(rec->lens);
+        free(rec);
+
+        return;
+}
+
+/* Enter a header field name in the header table; the name must
+   already be lowercase and stay allocated */
+void insert_header_name(char *name, size_t len, int slot) {
+        unsigned int i, n;
+
+        i = hash_header_name(name, len);
+        for (n = 0; header_table[i].name; n++) {
+                if (n == HEADER_TABLE_SIZE - 1)
+                        LOG_DIE("Too many header fields in format string");
+
+                i = (i + 1) & (HEADER_TABLE_SIZE - 1);
+        }
+
+        header_table[i].name = name;
+        header_table[i].len = len;
+        header_table[i].slot = slot;
+
+        return;
+}
+
+/* Hash a header name on its length and first and last characters;
+   setting the 0x20 bit folds the case of letters */
+unsigned int hash_header_name(const char *name, size_t len) {
+        return ((len * 31) + ((name[0] | 0x20) * 7) + (name[len - 1] | 0x20)) & (HEADER_TABLE_SIZE - 1);
+}
+
+/* Return the record slot for a field name, or -1 if the field is not
+   in the format string; intended to be called once at startup */
+int format_slot(char *name) {
         FORMAT_NODE *node;
 
 #ifdef DEBUG
         ASSERT(name);
+        ASSERT(strlen(name) > 0);
+#endif
+
+        if ((node = get_field(name)) == NULL)
+                return -1;
+
+        return node->index;
+}
+
+/* Return the number of fields that are filled from header lines */
+int format_header_fields() {
+        return num_header_fields;
+}
+
+/* Store a string value in the given slot; empty values and a slot
+   of -1 are ignored */
+void set_value(FORMAT_RECORD *rec, int slot, const char *value) {
+
+#ifdef DEBUG
         ASSERT(value);
 #endif
 
-        if ((strlen(name) == 0) || (strlen(value) == 0))
+        if (slot < 0) return;
+
+        set_slice(rec, slot, value, strlen(value));
+
+        return;
+}
+
+/* Store len bytes at value in the given slot; the bytes are not
+   copied, so they must stay in place until the record is printed
+   or cleared. Empty values and a slot of -1 are ignored. */
+void set_slice(FORMAT_RECORD *rec, int slot, const char *value, size_t len) {
+
+#ifdef DEBUG
+        ASSERT(rec);
+        ASSERT(value);
+        ASSERT(slot < num_fields);
+#endif
+
+        if ((slot < 0) || (len == 0))
                 return;
 
-        if ((node = get_field(name)))
-                node->value = value;
+        rec->values[slot] = value;
+        rec->lens[slot] = len;
 
         return;
 }
 
-/* Given the name, return a value from the hash */
-char *get_value(char *name) {
-        FORMAT_NODE *node;
+/* Return the value in the given slot and store its length in len, or
+   return NULL if it is empty */
+const char *get_value(FORMAT_RECORD *rec, int slot, size_t *len) {
+
+#ifdef DEBUG
+        ASSERT(rec);
+        ASSERT(slot < num_fields);
+#endif
+
+        if ((slot < 0) || (rec->values[slot] == NULL))
+                return NULL;
+
+        *len = rec->lens[slot];
+
+        return rec->values[slot];
+}
+
+/* Copy the value in the given slot into buf as a string, truncated
+   to fit in size bytes; returns buf, or NULL if the slot is empty */
+char *copy_value(FORMAT_RECORD *rec, int slot, char *buf, size_t size) {
+        const char *value;
+        size_t len;
+
+#ifdef DEBUG
+        ASSERT(buf);
+        ASSERT(size > 0);
+#endif
+
+        if ((value = get_value(rec, slot, &len)) == NULL)
+                return NULL;
+
+        if (len > size - 1) len = size - 1;
+        memcpy(buf, value, len);
+        buf[len] = '\0';
+
+        return buf;
+}
+
+/* Store a value parsed from a header line, given the header name and
+   value and their lengths, keeping the first value seen for repeated
+   headers; returns 1 if this filled an empty header field, so the
+   caller can stop once format_header_fields() fields have been found */
+int insert_header(FORMAT_RECORD *rec, const char *name, size_t len, const char *value, size_t value_len) {
+        unsigned int i;
+        size_t j;
+        char c;
 
 #ifdef DEBUG
+        ASSERT(rec);
         ASSERT(name);
+        ASSERT(value);
 #endif
 
-        if (strlen(name) == 0)
-                return EMPTY_FIELD;
+        if ((len == 0) || (value_len == 0))
+                return 0;
 
-        if ((node = get_field(name))) {
-                return node->value;
-        } else {
-                return EMPTY_FIELD;
+        for (i = hash_header_name(name, len); header_table[i].name; i = (i + 1) & (HEADER_TABLE_SIZE - 1)) {
+                if (header_table[i].len != len) continue;
+
+                for (j = 0; j < len; j++) {
+                        c = name[j];
+                        if ((c >= 'A') && (c <= 'Z')) c += 'a' - 'A';
+                        if (c != header_table[i].name[j]) break;
+                }
+                if (j < len) continue;
+
+                if (rec->values[header_table[i].slot])
+                        return 0;
+
+                rec->values[header_table[i].slot] = value;
+                rec->lens[header_table[i].slot] = value_len;
+
+                return 1;
         }
+
+        return 0;
 }
 
-void clear_values() {
-        FORMAT_NODE *node = head;
+void clear_values(FORMAT_RECORD *rec) {
 
 #ifdef DEBUG
-        ASSERT(node);
+        ASSERT(rec);
 #endif
 
-        while (node) {
-                node->value = NULL;
-                node = node->list;
-        }
+        memset(rec->values, 0, num_fields * sizeof(char *));
 
         return;
 }
@@ -217,31 +432,107 @@ void print_format_list() {
         return;
 }
 
-/* Destructively print each node value; once printed, each existing
-   value is assigned to NULL to clear it for the next packet */
-void print_format_values() {
+/* Return the field names in the output format as a comma-delimited
+   list, in the order values are written */
+const char *format_names() {
+        FORMAT_NODE *node;
+        size_t len = 0;
+
+#ifdef DEBUG
+        ASSERT(head);
+#endif
+
+        if (field_names) return field_names;
+
+        for (node = head; node; node = node->list)
+                len += strlen(node->name) + 1;
+
+        if ((field_names = (char *) malloc(len)) == NULL)
+                LOG_DIE("Cannot allocate memory for field name list");
+
+        for (node = head, len = 0; node; node = node->list) {
+                if (len) field_names[len++] = ',';
+                strcpy(field_names + len, node->name);
+                len += strlen(node->name);
+        }
+
+        return field_names;
+}
+
+/* Destructively write each record value to the output buffer as a
+   binary log record (see binlog.c); values are cleared as in
+   print_format_values(). Returns the record length. */
+size_t print_format_binary(FORMAT_RECORD *rec, const struct timeval *ts, OUTPUT_BUF *out) {
+        char buf[BINLOG_VARINT_MAX + 8];
+        FORMAT_NODE *node;
+        size_t len = 0, n;
+        const char **value;
+
+#ifdef DEBUG
+        ASSERT(head);
+        ASSERT(rec);
+        ASSERT(ts);
+        ASSERT(out);
+#endif
+
+        /* The record length comes first, so size the fields up front */
+        for (node = head; node; node = node->list) {
+                value = &rec->values[node->index];
+                if (*value) {
+                        n = rec->lens[node->index];
+                        len += binlog_put_varint(buf, n + 1) + n;
+                } else {
+                        len++;
+                }
+        }
+
+        output_append(out, buf, binlog_record_head(buf, len, ts));
+
+        for (node = head; node; node = node->list) {
+                value = &rec->values[node->index];
+                if (*value) {
+                        n = rec->lens[node->index];
+                        output_append(out, buf, binlog_put_varint(buf, n + 1));
+                        output_append(out, *value, n);
+                        *value = NULL;
+                } else {
+                        output_append(out, "", 1);
+                }
+        }
+
+        return output_end_record(out);
+}
+
+/* Destructively write each record value to the output buffer as a
+   single line; once written, each existing value is assigned to NULL
+   to clear it for the next packet. Returns the line length. */
+size_t print_format_values(FORMAT_RECORD *rec, OUTPUT_BUF *out) {
         FORMAT_NODE *node = head;
+        const char **value;
 
 #ifdef DEBUG
         ASSERT(node);
+        ASSERT(rec);
+        ASSERT(out);
 #endif
 
         while (node) {
-                if (node->value) {
-                        printf("%s", node->value);
-                        node->value = NULL;
+                value = &rec->values[node->index];
+                if (*value) {
+                        output_append(out, *value, rec->lens[node->index]);
+                        *value = NULL;
                 } else {
-                        printf("%s", EMPTY_FIELD);
+                        output_append(out, EMPTY_FIELD, sizeof(EMPTY_FIELD) - 1);
                 }
 
                 if (node->list != NULL)
-                        printf("%s", FIELD_DELIM);
+                        output_append(out, FIELD_DELIM, sizeof(FIELD_DELIM) - 1);
 
                 node = node->list;
         }
-        printf("\n");
+        output_append(out, "\n", 1);
 
-        return;
+        return output_end_record(out);
 }
 
 /* Free all allocated memory for format structure; only called at
@@ -249,6 +540,9 @@ void print_format_values() {
 void free_format() {
         FORMAT_NODE *prev, *curr;
 
+        free(field_names);
+        field_names = NULL;
+
         if (!head) return;
 
         curr = head;
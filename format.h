@@ -12,12 +12,27 @@
 #ifndef _HAVE_FORMAT_H
 #define _HAVE_FORMAT_H
 
+#include <sys/time.h>
+#include <sys/types.h>
+#include "output.h"
+
+typedef struct format_record FORMAT_RECORD;
+
 void parse_format_string(char *str);
-void insert_value(char *name, char *value);
-char *get_value(char *name);
-void clear_values();
+FORMAT_RECORD *new_format_record();
+void free_format_record(FORMAT_RECORD *rec);
+int format_slot(char *name);
+int format_header_fields();
+void set_value(FORMAT_RECORD *rec, int slot, const char *value);
+void set_slice(FORMAT_RECORD *rec, int slot, const char *value, size_t len);
+const char *get_value(FORMAT_RECORD *rec, int slot, size_t *len);
+char *copy_value(FORMAT_RECORD *rec, int slot, char *buf, size_t size);
+int insert_header(FORMAT_RECORD *rec, const char *name, size_t len, const char *value, size_t value_len);
+void clear_values(FORMAT_RECORD *rec);
 void print_format_list();
-void print_format_values();
+const char *format_names();
+size_t print_format_values(FORMAT_RECORD *rec, OUTPUT_BUF *out);
+size_t print_format_binary(FORMAT_RECORD *rec, const struct timeval *ts, OUTPUT_BUF *out);
 void free_format();
 
 #endif /* ! _HAVE_FORMAT_H */
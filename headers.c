@@ -0,0 +1,314 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The header scanner makes a single pass over a packet payload and
+  records where each header name and value lies, without modifying
+  the buffer or keeping any state between calls.
+
+  The payload is processed in 32 byte blocks. For each block, bit
+  masks are built marking the '\n', ':' and NUL bytes; the scan then
+  only visits the line ends, taking the first ':' of each line from
+  its mask, so ordinary header text costs a few vector compares per
+  block rather than a test per byte. The masks are built with AVX2 or
+  SSE2 where the CPU supports it. Elsewhere each line end and ':' is
+  found with memchr(), which the C library already runs a word or a
+  vector at a time. All three produce the same result.
+
+  Lines are split on '\n' with a preceding '\r' dropped, the first
+  line is the request or status line, and an empty line ends the
+  header block. Lines without a ':' are skipped, and a NUL byte is
+  treated as the end of the payload.
+*/
+
+#include <string.h>
+#include <sys/types.h>
+#include "headers.h"
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+#define BLOCK_SIZE 32
+#define SCAN_INLINE static inline __attribute__((always_inline))
+
+typedef int (*SCAN_FN)(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields);
+
+int scan_headers_scalar(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields);
+#ifdef HAVE_X86_SIMD
+int scan_headers_sse2(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields);
+int scan_headers_avx2(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields);
+#endif
+
+static SCAN_FN scanner = NULL;
+static const char *scanner_name = NULL;
+
+/* Select the block mask implementation, either a specific one or the
+   best the CPU supports; returns 0 if the requested one is unavailable */
+int init_header_scanner(int impl) {
+        switch (impl) {
+                case SCAN_SCALAR:
+                        scanner = scan_headers_scalar;
+                        scanner_name = "scalar";
+                        return 1;
+#ifdef HAVE_X86_SIMD
+                case SCAN_SSE2:
+                        scanner = scan_headers_sse2;
+                        scanner_name = "sse2";
+                        return 1;
+                case SCAN_AVX2:
+                        __builtin_cpu_init();
+                        if (!__builtin_cpu_supports("avx2")) return 0;
+                        scanner = scan_headers_avx2;
+                        scanner_name = "avx2";
+                        return 1;
+                case SCAN_AUTO:
+                        if (init_header_scanner(SCAN_AVX2)) return 1;
+                        return init_header_scanner(SCAN_SSE2);
+#else
+                case SCAN_AUTO:
+                        return init_header_scanner(SCAN_SCALAR);
+#endif
+                default:
+                        return 0;
+        }
+}
+
+/* Return the name of the selected implementation */
+const char *header_scanner_name() {
+        if (!scanner) init_header_scanner(SCAN_AUTO);
+
+        return scanner_name;
+}
+
+/* Scan len bytes of buf for the start line and header fields. The
+   start line length is stored in line_len and up to max_fields header
+   locations are stored in fields. Returns the number of fields found,
+   or -1 if the start line is empty. */
+int scan_headers(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields) {
+        if (!scanner) init_header_scanner(SCAN_AUTO);
+
+        return scanner(buf, len, line_len, fields, max_fields);
+}
+
+#ifdef HAVE_X86_SIMD
+/* Each mask function sets one bit per '\n', ':' and NUL byte in a
+   block, in the respective mask */
+
+SCAN_INLINE void mask_sse2(const char *p, unsigned int *nl, unsigned int *colon, unsigned int *zero) {
+        __m128i lo, hi, c;
+
+        lo = _mm_loadu_si128((const __m128i *) p);
+        hi = _mm_loadu_si128((const __m128i *) (p + 16));
+
+        c = _mm_set1_epi8('\n');
+        *nl = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, c)) |
+              ((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, c)) << 16);
+        c = _mm_set1_epi8(':');
+        *colon = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, c)) |
+                 ((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, c)) << 16);
+        c = _mm_setzero_si128();
+        *zero = (unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(lo, c)) |
+                ((unsigned int) _mm_movemask_epi8(_mm_cmpeq_epi8(hi, c)) << 16);
+
+        return;
+}
+
+__attribute__((target("avx2")))
+SCAN_INLINE void mask_avx2(const char *p, unsigned int *nl, unsigned int *colon, unsigned int *zero) {
+        __m256i v;
+
+        v = _mm256_loadu_si256((const __m256i *) p);
+        *nl = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8('\n')));
+        *colon = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(':')));
+        *zero = (unsigned int) _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_setzero_si256()));
+
+        return;
+}
+#endif
+
+/* Same as isspace() in the C locale, without a function call */
+SCAN_INLINE int is_space(char c) {
+        return (c == ' ') || ((c >= '\t') && (c <= '\r'));
+}
+
+/* Return the first bit set in mask at or above bit from, or -1 */
+SCAN_INLINE int first_bit_from(unsigned int mask, unsigned int from) {
+        if (from >= BLOCK_SIZE) return -1;
+        mask &= ~0U << from;
+
+        return mask ? __builtin_ctz(mask) : -1;
+}
+
+/* The scan itself, shared by each implementation; the mask function
+   is a constant at every call site so it is inlined into the loop.
+   Only the line ends are visited, and the first ':' of each line is
+   found from the colon mask rather than by walking the line. */
+SCAN_INLINE int scan_blocks(const char *buf, size_t len, size_t *line_len,
+                            HEADER_FIELD *fields, int max_fields,
+                            void (*mask_block)(const char *, unsigned int *, unsigned int *, unsigned int *)) {
+        char tail[BLOCK_SIZE];
+        const char *p;
+        unsigned int nl, colons, zero, from;
+        size_t off, pos, start = 0, end, value;
+        long colon = -1;
+        int first = 1, num_fields = 0, bit;
+
+        if (len > MAX_SCAN_LEN) len = MAX_SCAN_LEN;
+
+        for (off = 0; off < len; off += BLOCK_SIZE) {
+                /* Pad a final partial block with NULs, which end the scan */
+                if (len - off >= BLOCK_SIZE) {
+                        p = buf + off;
+                } else {
+                        memset(tail, 0, BLOCK_SIZE);
+                        memcpy(tail, buf + off, len - off);
+                        p = tail;
+                }
+
+                mask_block(p, &nl, &colons, &zero);
+                if (zero) {
+                        /* Nothing past the first NUL is part of the payload */
+                        len = off + __builtin_ctz(zero);
+                        nl &= (1U << __builtin_ctz(zero)) - 1;
+                        colons &= (1U << __builtin_ctz(zero)) - 1;
+                }
+
+                while (nl) {
+                        pos = off + __builtin_ctz(nl);
+                        nl &= nl - 1;
+
+                        if (colon < 0) {
+                                from = (start > off) ? start - off : 0;
+                                bit = first_bit_from(colons & ((1U << (pos - off)) - 1), from);
+                                if (bit >= 0) colon = off + bit;
+                        }
+
+                        /* End of line; drop a trailing '\r' */
+                        end = pos;
+                        if ((end > start) && (buf[end - 1] == '\r')) end--;
+
+                        if (first) {
+                                if (end == start) return -1;
+                                *line_len = end - start;
+                                first = 0;
+                        } else if (end == start) {
+                                return num_fields; /* Reached the end of the header */
+                        } else if (colon >= 0) {
+                                value = colon + 1;
+                                while ((value < end) && is_space(buf[value])) value++;
+
+                                fields[num_fields].name_off = start;
+                                fields[num_fields].name_len = colon - start;
+                                fields[num_fields].value_off = value;
+                                fields[num_fields].value_len = end - value;
+                                if (++num_fields == max_fields) return num_fields;
+                        }
+
+                        start = pos + 1;
+                        colon = -1;
+                }
+
+                /* Carry the first ':' of a line that continues into the next block */
+                if (colon < 0) {
+                        bit = first_bit_from(colons, (start > off) ? start - off : 0);
+                        if (bit >= 0) colon = off + bit;
+                }
+
+                if (zero) break;
+        }
+
+        /* Without a line terminator the whole payload is the start line;
+           an unterminated header line is incomplete and ignored */
+        if (first) {
+                if (len == start) return -1;
+                *line_len = len - start;
+        }
+
+        return num_fields;
+}
+
+/* The same scan without vector masks, a line at a time, leaving NUL
+   bytes to the caller; the bytes the result depends on are stored in
+   used */
+SCAN_INLINE int scan_lines(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields,
+                           int max_fields, size_t *used) {
+        const char *nl, *colon;
+        size_t start = 0, end, value;
+        int first = 1, num_fields = 0;
+
+        while ((nl = memchr(buf + start, '\n', len - start)) != NULL) {
+                /* End of line; drop a trailing '\r' */
+                end = nl - buf;
+                *used = end + 1;
+                if ((end > start) && (buf[end - 1] == '\r')) end--;
+
+                if (first) {
+                        if (end == start) return -1;
+                        *line_len = end - start;
+                        first = 0;
+                } else if (end == start) {
+                        return num_fields; /* Reached the end of the header */
+                } else if ((colon = memchr(buf + start, ':', end - start)) != NULL) {
+                        value = colon - buf + 1;
+                        while ((value < end) && is_space(buf[value])) value++;
+
+                        fields[num_fields].name_off = start;
+                        fields[num_fields].name_len = colon - buf - start;
+                        fields[num_fields].value_off = value;
+                        fields[num_fields].value_len = end - value;
+                        if (++num_fields == max_fields) return num_fields;
+                }
+
+                start = nl - buf + 1;
+        }
+
+        /* Without a line terminator the whole payload is the start line;
+           an unterminated header line is incomplete and ignored */
+        *used = len;
+        if (first) {
+                if (len == start) return -1;
+                *line_len = len - start;
+        }
+
+        return num_fields;
+}
+
+int scan_headers_scalar(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields) {
+        const char *zero;
+        size_t line, used;
+        int num_fields;
+
+        if (len > MAX_SCAN_LEN) len = MAX_SCAN_LEN;
+
+        /* Nothing past the first NUL is part of the payload; they are
+           rare, so only the bytes that were used are checked for one,
+           and the scan is run again short of it if there is one */
+        num_fields = scan_lines(buf, len, &line, fields, max_fields, &used);
+        if ((zero = memchr(buf, '\0', used)) != NULL)
+                num_fields = scan_lines(buf, zero - buf, &line, fields, max_fields, &used);
+
+        if (num_fields >= 0) *line_len = line;
+
+        return num_fields;
+}
+
+#ifdef HAVE_X86_SIMD
+int scan_headers_sse2(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields) {
+        return scan_blocks(buf, len, line_len, fields, max_fields, mask_sse2);
+}
+
+__attribute__((target("avx2")))
+int scan_headers_avx2(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields) {
+        return scan_blocks(buf, len, line_len, fields, max_fields, mask_avx2);
+}
+#endif
@@ -0,0 +1,39 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_HEADERS_H
+#define _HAVE_HEADERS_H
+
+#include <sys/types.h>
+
+/* Largest payload the scanner will look at; offsets are 16 bits */
+#define MAX_SCAN_LEN 65535
+
+#define SCAN_AUTO   0
+#define SCAN_SCALAR 1
+#define SCAN_SSE2   2
+#define SCAN_AVX2   3
+
+/* Location of a header name and its value within the scanned buffer;
+   the name excludes the ':' and the value excludes leading whitespace
+   and the line terminator */
+typedef struct header_field {
+        unsigned short name_off;
+        unsigned short name_len;
+        unsigned short value_off;
+        unsigned short value_len;
+} HEADER_FIELD;
+
+int init_header_scanner(int impl);
+const char *header_scanner_name();
+int scan_headers(const char *buf, size_t len, size_t *line_len, HEADER_FIELD *fields, int max_fields);
+
+#endif /* ! _HAVE_HEADERS_H */
@@ -10,9 +10,11 @@
 */
 
 #include <ctype.h>
+#include <errno.h>
 #include <fcntl.h>
 #include <grp.h>
 #include <pcap.h>
+#include <pthread.h>
 #include <pwd.h>
 #include <signal.h>
 #include <sys/stat.h>
@@ -23,30 +25,116 @@
 #include <sys/types.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include "agg.h"
+#include "batch.h"
+#include "binlog.h"
 #include "config.h"
 #include "error.h"
+#include "flowdump.h"
 #include "format.h"
+#include "headers.h"
+#include "logfile.h"
+#include "metrics.h"
 #include "methods.h"
+#include "output.h"
+#include "packet.h"
+#include "pair.h"
+#include "prefilter.h"
 #include "tcp.h"
 #include "rate.h"
+#include "ring.h"
+#include "stats.h"
+#include "stream.h"
+#include "timestamp.h"
+#include "utility.h"
+
+#define OUTPUT_BUFSIZE 65536
+
+
+/* Per-worker capture and parse state; each worker owns its ring, its
+   batch, its stream, pair and flow dump tables, the record its fields
+   are parsed into and the buffer its output lines are assembled in */
+struct worker {
+        pthread_t thread;
+        RING *ring;
+        PACKET_BATCH *batch;
+        PACKET_INFO *info;        /* What the batch passes found per packet */
+        HEADER_FIELD *fields;     /* Header fields found by the scan pass */
+        STREAM_TABLE *streams;
+        char *stream_buf;         /* Completed stream being logged */
+        time_t last_expire;
+        PAIR_TABLE *pairs;
+        time_t last_pair_expire;
+        FLOWDUMP_TABLE *dumps;
+        time_t last_dump_expire;
+        FORMAT_RECORD *record;
+        OUTPUT_BUF *out;
+        TS_CACHE ts_cache;
+        PARSE_STATS *stats;       /* Counters only this worker writes */
+        unsigned long long stage_start;
+};
+
+/* The parts of a start line used for pairing, as slices of the line */
+struct start_line {
+        const char *method, *request_uri, *status_code;
+        size_t method_len, uri_len, status_len;
+};
 
 /* Function declarations */
 int getopt(int, char * const *, const char *);
 pcap_t *prepare_capture(char *interface, int promisc, char *filename, char *capfilter);
 void set_link_offset(int header_type);
+void parse_ring_spec(char *spec);
+void parse_latency_spec(char *spec);
+void parse_stream_spec(char *spec);
+void parse_pair_spec(char *spec);
+void parse_topk_spec(char *spec);
+void parse_flowdump_spec(char *spec);
+void init_workers();
+void start_workers();
+void stop_workers();
+void *run_worker(void *args);
+void break_capture();
 void open_outfiles();
+char *build_header(size_t *len);
+void parse_rotate_spec(char *spec);
 void runas_daemon();
 void change_user(char *name);
-void parse_http_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt);
-int process_ip6_nh(const u_char *pkt, int size_ip, unsigned int caplen, unsigned int offset);
-char *parse_header_line(char *header_line);
-int parse_client_request(char *header_line);
-int parse_server_response(char *header_line);
+void parse_http_batch(u_char *args, PACKET_BATCH *batch);
+void process_packet(struct worker *worker, const struct pcap_pkthdr *header, const u_char *pkt,
+                    const PACKET_INFO *info);
+void mark_stage(struct worker *worker, int stage);
+int replay_capture(unsigned int rounds);
+void reassemble_segment(struct worker *worker, const FLOW_KEY *key, unsigned int seq, int flags,
+                        const struct pcap_pkthdr *header, const u_char *pkt, const char *data,
+                        int size_data, int payload_len);
+void flush_stream(STREAM *stream, void *args);
+int process_payload(struct worker *worker, const FLOW_KEY *key, const struct timeval *first_ts,
+                    const struct timeval *ts, const char *data, size_t len, unsigned int next_seq,
+                    int can_buffer);
+int parse_http_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts,
+                       const char *buf, size_t len, int type);
+int log_http_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts, const char *buf,
+                     size_t line_len, const HEADER_FIELD *fields, int num_fields, int type);
+void dump_packet(struct worker *worker, const FLOW_KEY *key, const struct pcap_pkthdr *header,
+                 const u_char *pkt);
+int parse_client_request(FORMAT_RECORD *rec, const char *line, size_t len, struct start_line *start);
+int parse_server_response(FORMAT_RECORD *rec, const char *line, size_t len, struct start_line *start);
+void pair_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts, int type,
+                  const struct start_line *start, PAIR_REQUEST *req, char *elapsed);
 void handle_signal(int sig);
+void reload();
+int capture_packets();
+void remove_pid_file();
+void die();
 void cleanup();
 void print_stats();
+int get_capture_stats(struct pcap_stat *ps);
+void sum_worker_stats(struct stream_stats *streams, struct pair_stats *pairs, struct flowdump_stats *dumps);
+void read_capture_counts(struct capture_counts *counts);
 void display_banner();
 void display_usage();
+void resolve_slots();
 
 /* Program flags/options, set by arguments or config file */
 static unsigned int parse_count = 0;
@@ -57,24 +145,79 @@ static char *interface = NULL;
 static char *capfilter = NULL;
 static char *use_outfile = NULL;
 static int set_promisc = 1;
+static int http_prefilter = 0;
+static int snaplen = DEFAULT_SNAPLEN;
+static int header_snap = 0;
 static char *pid_filename = NULL;
 static char *new_user = NULL;
 static char *format_str = NULL;
 static char *methods_str = NULL;
 static char *use_dumpfile = NULL;
+static char *use_flowdump = NULL;
+static unsigned int flowdump_packets = DEFAULT_FLOWDUMP_PACKETS;
+static unsigned int flowdump_bytes = DEFAULT_FLOWDUMP_BYTES;
+static unsigned int flowdump_snaplen = DEFAULT_FLOWDUMP_SNAPLEN;
 static int rate_stats = 0;
 static int rate_interval = DEFAULT_RATE_INTERVAL;
 static int rate_threshold = DEFAULT_RATE_THRESHOLD;
+static char *rate_key = NULL;
+static unsigned int topk_size = 0;
+static int aggregate = 0;
+static int binary_log = 0;
+static int compress_output = 0;
+static unsigned int rotate_size = DEFAULT_ROTATE_SIZE;
+static unsigned int rotate_interval = DEFAULT_ROTATE_INTERVAL;
+static int use_logfile = 0;              /* Set if the output file is compressed or rotated */
 static int force_flush = 0;
+static unsigned int flush_interval = DEFAULT_FLUSH_INTERVAL;
+static unsigned int flush_records = 0;
+static int use_ring = 0;
+static unsigned int ring_block_size = DEFAULT_RING_BLOCK_SIZE;
+static unsigned int ring_block_num = DEFAULT_RING_BLOCK_NUM;
+static unsigned int ring_timeout = DEFAULT_RING_TIMEOUT;
+static int num_workers = 1;
+static int batch_size = -1;               /* Set by the capture source if not given */
+static unsigned int replay_rounds = 0;
+static unsigned int stats_interval = 0;
+static char *metrics_spec = NULL;
+static int use_streams = 0;
+static unsigned int stream_bytes = DEFAULT_STREAM_BYTES;
+static unsigned int stream_timeout = DEFAULT_STREAM_TIMEOUT;
+static unsigned int stream_flows = DEFAULT_STREAM_FLOWS;
+static int use_pairs = 0;                /* Set if a paired field is in the format string */
+static unsigned int pair_flows = DEFAULT_PAIR_FLOWS;
+static unsigned int pair_depth = DEFAULT_PAIR_DEPTH;
+static unsigned int pair_timeout = DEFAULT_PAIR_TIMEOUT;
 int quiet_mode = 0;               /* Defined as extern in error.h */
 int use_syslog = 0;               /* Defined as extern in error.h */
 
 static pcap_t *pcap_hnd = NULL;   /* Opened pcap device handle */
-static char *buf = NULL;
-static unsigned int num_parsed = 0;      /* Count of fully parsed HTTP packets */
+static struct worker *workers = NULL;
+static int workers_running = 0;
+static unsigned int num_parsed = 0;      /* Shared parse count, only kept for -n */
 static time_t start_time = 0;      /* Start tick for statistics calculations */
 static int link_offset = 0;
+static int headers_wanted = 0;           /* Header fields in the format string */
+static int time_stages = 0;              /* Set while replaying a capture or with -T */
+static volatile sig_atomic_t capture_halted = 0;
+static volatile sig_atomic_t shutdown_signal = 0;
+static volatile sig_atomic_t reload_pending = 0;
+static volatile sig_atomic_t fatal_error = 0;
+static pthread_t main_thread;
+
+/* Record slots of the fields set by the packet parser, resolved once
+   the format string has been parsed; -1 if not in the format string */
+static struct {
+        int timestamp, timestamp_utc, timestamp_ms;
+        int source_ip, dest_ip, source_port, dest_port;
+        int direction, method, request_uri, http_version;
+        int status_code, reason_phrase, host;
+        int response_time_us, paired_method, paired_uri;
+        int rate_key;
+} slot;
 static pcap_dumper_t *dumpfile = NULL;
+static pthread_mutex_t dump_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
 static char default_capfilter[] = DEFAULT_CAPFILTER;
 static char default_format[] = DEFAULT_FORMAT;
 static char rate_format[] = RATE_FORMAT;
@@ -87,6 +230,7 @@ pcap_t *prepare_capture(char *interface, int promisc, char *filename, char *capf
         char *dev = NULL;
         bpf_u_int32 net, mask;
         struct bpf_program filter;
+        int i, fanout_id = 0;
 
         if (!filename) {
                 /* Starting live capture, so find and open network device */
@@ -100,7 +244,13 @@ pcap_t *prepare_capture(char *interface, int promisc, char *filename, char *capf
 
                 if (pcap_lookupnet(dev, &net, &mask, errbuf) == -1) net = 0;
 
-                pcap_hnd = pcap_open_live(dev, BUFSIZ, promisc, 1000, errbuf);
+                if (use_ring) {
+                        /* A dead handle of the link type the ring delivers is
+                           enough to compile the filter and open dump files */
+                        pcap_hnd = pcap_open_dead(ring_datalink(dev), snaplen);
+                } else {
+                        pcap_hnd = pcap_open_live(dev, snaplen, promisc, 1000, errbuf);
+                }
 
                 if (pcap_hnd == NULL)
                         LOG_DIE("Cannot open live capture on '%s': %s", dev, errbuf);
@@ -118,12 +268,33 @@ pcap_t *prepare_capture(char *interface, int promisc, char *filename, char *capf
         if (pcap_compile(pcap_hnd, &filter, capfilter, 0, net) == -1)
                 LOG_DIE("Cannot compile capture filter '%s': %s", capfilter, pcap_geterr(pcap_hnd));
 
-        if (pcap_setfilter(pcap_hnd, &filter) == -1)
+        if (http_prefilter || header_snap)
+                add_prefilter(&filter, link_offset, eth_skip_bits, pcap_snapshot(pcap_hnd),
+                              header_snap ? PREFILTER_TRUNCATE : PREFILTER_DROP);
+
+        if (use_ring && !filename) {
+                /* With several workers, each gets its own ring joined
+                   to a fanout group unique to this process; ring_open
+                   takes an id of 0 to mean no group, so never use it */
+                if (num_workers > 1) {
+                        fanout_id = getpid() & 0xffff;
+                        if (fanout_id == 0) fanout_id = 1;
+                }
+
+                for (i = 0; i < num_workers; i++)
+                        workers[i].ring = ring_open(dev, promisc, &filter, ring_block_size,
+                                                    ring_block_num, ring_timeout, fanout_id);
+        } else if (pcap_setfilter(pcap_hnd, &filter) == -1) {
                 LOG_DIE("Cannot apply capture filter: %s", pcap_geterr(pcap_hnd));
+        }
 
         pcap_freecode(&filter);
 
+        if (use_ring && filename)
+                workers[0].ring = ring_open_offline(pcap_hnd, ring_block_size, ring_block_num);
+
         if (!filename) LOG_PRINT("Starting capture on %s interface", dev);
+        if (use_ring) PRINT("Using %d x %u x %u byte capture ring", num_workers, ring_block_num, ring_block_size);
 
         return pcap_hnd;
 }
@@ -177,20 +348,431 @@ void set_link_offset(int header_type) {
         return;
 }
 
+/* Parse a ring specification of the form 'block_kb,block_count,timeout_ms';
+   missing or zero values keep their defaults */
+void parse_ring_spec(char *spec) {
+        unsigned int vals[3] = { 0, 0, 0 };
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if (sscanf(spec, "%u,%u,%u", &vals[0], &vals[1], &vals[2]) < 1)
+                LOG_DIE("Invalid -R value, must be 'block_kb[,block_count[,timeout_ms]]'");
+
+        if (vals[0]) ring_block_size = vals[0] * 1024;
+        if (vals[1]) ring_block_num = vals[1];
+        if (vals[2]) ring_timeout = vals[2];
+        use_ring = 1;
+
+        return;
+}
+
+/* Parse the -a argument: bytes[,timeout_sec[,flows]]; zero or missing
+   values keep their defaults */
+void parse_stream_spec(char *spec) {
+        unsigned int vals[3] = { 0, 0, 0 };
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if (sscanf(spec, "%u,%u,%u", &vals[0], &vals[1], &vals[2]) < 1)
+                LOG_DIE("Invalid -a value, must be 'bytes[,timeout_sec[,flows]]'");
+
+        if (vals[0]) stream_bytes = vals[0];
+        if (vals[1]) stream_timeout = vals[1];
+        if (vals[2]) stream_flows = vals[2];
+        use_streams = 1;
+
+        return;
+}
+
+/* Parse the -c argument: flows[,depth[,timeout_sec]]; zero or missing
+   values keep their defaults */
+void parse_pair_spec(char *spec) {
+        unsigned int vals[3] = { 0, 0, 0 };
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if (sscanf(spec, "%u,%u,%u", &vals[0], &vals[1], &vals[2]) < 1)
+                LOG_DIE("Invalid -c value, must be 'flows[,depth[,timeout_sec]]'");
+
+        if (vals[0]) pair_flows = vals[0];
+        if (vals[1]) pair_depth = vals[1];
+        if (vals[2]) pair_timeout = vals[2];
+
+        return;
+}
+
+/* Parse the -k argument: field[,count]; rate statistics are kept for
+   the count heaviest values of the field */
+void parse_topk_spec(char *spec) {
+        char *count;
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        topk_size = DEFAULT_TOPK_SIZE;
+        if ((count = strchr(spec, ',')) != NULL) {
+                *count++ = '\0';
+                if (atoi(count) > 0) topk_size = atoi(count);
+        }
+
+        rate_key = str_tolower(str_strip_whitespace(spec));
+        if (*rate_key == '\0')
+                LOG_DIE("Invalid -k value, must be 'field[,count]'");
+        rate_stats = 1;
+
+        return;
+}
+
+/* Parse a flow dump spec of the form 'file[:packets[,bytes[,snaplen]]]';
+   a value of 0 means no limit */
+void parse_flowdump_spec(char *spec) {
+        char *limits;
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if ((limits = strchr(spec, ':')) != NULL) {
+                *limits++ = '\0';
+                if (sscanf(limits, "%u,%u,%u", &flowdump_packets, &flowdump_bytes, &flowdump_snaplen) < 1)
+                        LOG_DIE("Invalid -D value, must be 'file[:packets[,bytes[,snaplen]]]'");
+        }
+
+        if (*spec == '\0')
+                LOG_DIE("Invalid -D value, must be 'file[:packets[,bytes[,snaplen]]]'");
+        use_flowdump = spec;
+
+        return;
+}
+
+/* Parse an output latency bound of the form 'ms[,records]'; records
+   are written at least every ms milliseconds, or sooner once the given
+   number of records is waiting */
+void parse_latency_spec(char *spec) {
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if (sscanf(spec, "%u,%u", &flush_interval, &flush_records) < 1)
+                LOG_DIE("Invalid -L value, must be 'ms[,records]'");
+
+        return;
+}
+
+/* Parse the -O output rotation spec 'size_mb[,seconds]' */
+void parse_rotate_spec(char *spec) {
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        if (sscanf(spec, "%u,%u", &rotate_size, &rotate_interval) < 1)
+                LOG_DIE("Invalid -O value, must be 'size_mb[,seconds]'");
+
+        use_logfile = 1;
+
+        return;
+}
+
+/* Allocate the state owned by each worker */
+void init_workers() {
+        PARSE_STATS *stats;
+        int i;
+
+        if ((workers = (struct worker *) calloc(num_workers, sizeof(struct worker))) == NULL)
+                LOG_DIE("Cannot allocate memory for workers");
+
+        stats = stats_new(num_workers);
+
+        for (i = 0; i < num_workers; i++) {
+                if (use_streams) {
+                        workers[i].streams = stream_table_new(stream_flows, stream_bytes, stream_timeout,
+                                                              &flush_stream, &workers[i]);
+                        if ((workers[i].stream_buf = malloc(stream_bytes)) == NULL)
+                                LOG_DIE("Cannot allocate memory for stream data buffer");
+                }
+
+                workers[i].batch = batch_new(batch_size);
+                workers[i].info = (PACKET_INFO *) malloc(batch_size * sizeof(PACKET_INFO));
+                workers[i].fields = (HEADER_FIELD *) malloc(batch_size * MAX_HEADER_FIELDS * sizeof(HEADER_FIELD));
+                if (!workers[i].info || !workers[i].fields)
+                        LOG_DIE("Cannot allocate memory for packet batch");
+
+                if (use_pairs)
+                        workers[i].pairs = pair_table_new(pair_flows, pair_depth, pair_timeout);
+
+                if (use_flowdump)
+                        workers[i].dumps = flowdump_table_new(FLOWDUMP_FLOWS, flowdump_packets, flowdump_bytes,
+                                                              flowdump_snaplen);
+
+                workers[i].stats = &stats[i];
+                workers[i].record = new_format_record();
+                workers[i].out = output_new(OUTPUT_BUFSIZE);
+                init_ts_cache(&workers[i].ts_cache);
+        }
+
+        return;
+}
+
+/* Spawn a thread for every worker but the first, which runs on the
+   main thread so that it keeps handling signals */
+void start_workers() {
+        sigset_t set;
+        int i, s;
+
+        if (num_workers < 2) return;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Worker thread signal blocking failed with error %d", s);
+
+        for (i = 1; i < num_workers; i++) {
+                s = pthread_create(&workers[i].thread, NULL, run_worker, (void *) &workers[i]);
+                if (s != 0)
+                        LOG_DIE("Worker thread creation failed with error %d", s);
+        }
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Worker thread signal unblocking failed with error %d", s);
+
+        workers_running = 1;
+
+        return;
+}
+
+/* Halt the capture loops and wait for the worker threads to finish */
+void stop_workers() {
+        int i, s;
+
+        if (!workers_running) return;
+        workers_running = 0;
+
+        break_capture();
+
+        for (i = 1; i < num_workers; i++) {
+                s = pthread_join(workers[i].thread, NULL);
+                if (s != 0)
+                        LOG_WARN("Worker thread join failed with error %d", s);
+        }
+
+        return;
+}
+
+/* This is a worker capture thread */
+void *run_worker(void *args) {
+        struct worker *worker = (struct worker *) args;
+
+        if (ring_loop(worker->ring, worker->batch, &parse_http_batch, (u_char *) worker) == -1)
+                LOG_WARN("Problem reading packets from interface: %s", strerror(errno));
+
+        output_flush(worker->out);
+
+        return (void *) 0;
+}
+
+/* Read the whole input file into memory, then parse it rounds times
+   over without any capture I/O and report the rate and the cycles
+   spent in each parser stage; mirrors pcap_loop() return values */
+int replay_capture(unsigned int rounds) {
+        struct worker *worker = &workers[0];
+        PACKET_BATCH *batch = worker->batch;
+        struct pcap_pkthdr *header, *headers = NULL;
+        const u_char *pkt;
+        u_char *data = NULL;
+        size_t *offsets = NULL, data_len = 0, data_size = 0;
+        unsigned int count = 0, alloc = 0, i, j, n, r;
+        unsigned long long cycles = 0, stage_cycles[NUM_STAGES];
+        struct timespec start, end;
+        double ns, total = 0;
+        int s, timed = time_stages;
+
+        while ((s = pcap_next_ex(pcap_hnd, &header, &pkt)) == 1) {
+                if (count == alloc) {
+                        alloc = alloc ? alloc * 2 : 4096;
+                        headers = (struct pcap_pkthdr *) realloc(headers, alloc * sizeof(struct pcap_pkthdr));
+                        offsets = (size_t *) realloc(offsets, alloc * sizeof(size_t));
+                        if (!headers || !offsets)
+                                LOG_DIE("Cannot allocate memory for replayed packets");
+                }
+
+                if (data_len + header->caplen > data_size) {
+                        if (data_size == 0) data_size = 1024 * 1024;
+                        while (data_len + header->caplen > data_size) data_size *= 2;
+                        if ((data = (u_char *) realloc(data, data_size)) == NULL)
+                                LOG_DIE("Cannot allocate memory for replayed packets");
+                }
+
+                memcpy(data + data_len, pkt, header->caplen);
+                headers[count] = *header;
+                offsets[count] = data_len;
+                data_len += header->caplen;
+                count++;
+        }
+
+        if (s == -1) return -1;
+
+        memcpy(stage_cycles, worker->stats->stage_cycles, sizeof(stage_cycles));
+        time_stages = 1;
+
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (r = 0; (r < rounds) && !capture_halted; r++) {
+                for (i = 0; (i < count) && !capture_halted; i += n) {
+                        n = (count - i < batch->size) ? count - i : batch->size;
+                        for (j = 0; j < n; j++) {
+                                batch->headers[j] = headers[i + j];
+                                batch->pkts[j] = data + offsets[i + j];
+                        }
+                        batch->count = n;
+
+                        parse_http_batch((u_char *) worker, batch);
+                        total += n;
+
+                        if (reload_pending) reload();
+                }
+        }
+        output_flush(worker->out);
+        clock_gettime(CLOCK_MONOTONIC, &end);
+
+        time_stages = timed;
+        free(headers);
+        free(offsets);
+        free(data);
+
+        if (total == 0) return capture_halted ? -2 : 0;
+
+        ns = (end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec);
+        for (i = 0; i < NUM_STAGES; i++) {
+                stage_cycles[i] = worker->stats->stage_cycles[i] - stage_cycles[i];
+                cycles += stage_cycles[i];
+        }
+
+        PRINT("%u packets (%zu bytes) replayed %u times in %0.3f seconds", count, data_len, r, ns / 1e9);
+        PRINT("%0.0f packets/s, %0.1f ns/packet, %0.1f cycles/packet", total * 1e9 / ns, ns / total,
+              cycles / total);
+        for (i = 0; i < NUM_STAGES; i++) {
+                PRINT("  %-8s %8.1f cycles/packet %5.1f%%", stats_stage_name(i), stage_cycles[i] / total,
+                      cycles ? 100.0 * stage_cycles[i] / cycles : 0.0);
+        }
+
+        return capture_halted ? -2 : 0;
+}
+
+/* Ask every capture loop to return */
+void break_capture() {
+        int i;
+
+        capture_halted = 1;
+
+        if (use_ring && workers) {
+                for (i = 0; i < num_workers; i++)
+                        ring_breakloop(workers[i].ring);
+        } else if (pcap_hnd) {
+                pcap_breakloop(pcap_hnd);
+        }
+
+        return;
+}
+
+/* Build the header that starts each output file: the binary log
+   header, or comment lines giving the version and field list */
+char *build_header(size_t *len) {
+        const char *names = format_names();
+        size_t size = strlen(names) + BINLOG_MAGIC_LEN + 64;
+        char *buf;
+
+        if ((buf = (char *) malloc(size)) == NULL)
+                LOG_DIE("Cannot allocate memory for output header");
+
+        if (binary_log) {
+                *len = binlog_header(buf, size, names);
+        } else {
+                *len = snprintf(buf, size, "# %s version %s\n# Fields: %s\n", PROG_NAME, PROG_VER, names);
+        }
+
+        return buf;
+}
+
 /* Open any requested output files */
 void open_outfiles() {
-        /* Redirect stdout to the specified output file if requested */
-        if (use_outfile) {
-                if (daemon_mode && (use_outfile[0] != '/'))
-                        LOG_WARN("Output file path is not absolute and may be inaccessible after daemonizing");
+        static int opened = 0;
+        char *hdr;
+        size_t len;
+
+        if (use_outfile && daemon_mode && (use_outfile[0] != '/') && !opened)
+                LOG_WARN("Output file path is not absolute and may be inaccessible after daemonizing");
+
+        if (use_outfile && use_logfile) {
+                /* A compressed or rotated output file is managed by the
+                   log writer, which starts each file it opens with the
+                   header; reopening is left to its thread */
+                if (opened) {
+                        logfile_reopen();
+                } else {
+                        hdr = build_header(&len);
+                        logfile_open(use_outfile, compress_output, rotate_size * 1048576UL, rotate_interval,
+                                     hdr, len);
+                        output_set_sink(logfile_write);
+                        free(hdr);
 
-                if (freopen(use_outfile, "a", stdout) == NULL)
-                        LOG_DIE("Cannot reopen output stream to '%s'", use_outfile);
+                        PRINT("Writing %soutput to file: %s", compress_output ? "compressed " : "", use_outfile);
+                }
+        } else {
+                /* A binary log starts with its header, which is written
+                   again each time the file is reopened; stdout only gets
+                   it once */
+                hdr = NULL;
+                if (binary_log && (use_outfile || !opened))
+                        hdr = build_header(&len);
+
+                /* Workers carry on while reloading, so all output is
+                   held while the stream is swapped and the header goes
+                   out; worker 0 is this thread and writes out its own */
+                if (opened) output_flush(workers[0].out);
+                output_hold();
+
+                /* Redirect stdout to the specified output file if requested */
+                if (use_outfile) {
+                        if (freopen(use_outfile, "a", stdout) == NULL) {
+                                output_release();
+                                LOG_DIE("Cannot reopen output stream to '%s'", use_outfile);
+                        }
+
+                        PRINT("Writing output to file: %s", use_outfile);
+                }
 
-                PRINT("Writing output to file: %s", use_outfile);
+                if (hdr) {
+                        if ((fwrite(hdr, 1, len, stdout) != len) || (fflush(stdout) != 0)) {
+                                output_release();
+                                LOG_DIE("Cannot write binary log header");
+                        }
+                        free(hdr);
+                } else if (!binary_log && use_outfile) {
+                        printf("# %s version %s\n", PROG_NAME, PROG_VER);
+
+                        /* Aggregation mode prints its own field list with
+                           its first report */
+                        if (!aggregate) print_format_list();
+
+                        /* Records bypass stdio, so the header must go out
+                           first */
+                        fflush(stdout);
+                }
 
-                printf("# %s version %s\n", PROG_NAME, PROG_VER);
-                print_format_list();
+                output_release();
         }
 
         /* Open pcap binary capture file if requested */
@@ -203,6 +785,22 @@ void open_outfiles() {
                 PRINT("Writing binary dump file: %s", use_dumpfile);
         }
 
+        /* Open the flow dump file if requested; later calls leave it to
+           the writer thread to start the file over, as with -b */
+        if (use_flowdump) {
+                if (opened) {
+                        flowdump_reopen();
+                } else {
+                        if (daemon_mode && (use_flowdump[0] != '/'))
+                                LOG_WARN("Flow dump file path is not absolute and may be inaccessible after daemonizing");
+
+                        flowdump_open(use_flowdump, pcap_datalink(pcap_hnd), flowdump_snaplen);
+                        PRINT("Writing flow dump file: %s", use_flowdump);
+                }
+        }
+
+        opened = 1;
+
         return;
 }
 
@@ -239,6 +837,7 @@ void runas_daemon() {
         if ((pid_file = fopen(pid_filename, "w"))) {
                 fprintf(pid_file, "%d", getpid());
                 fclose(pid_file);
+                atexit(remove_pid_file);
         } else {
                 LOG_WARN("Cannot open PID file '%s'", pid_filename);
         }
@@ -279,6 +878,11 @@ void change_user(char *name) {
                         LOG_WARN("Cannot change ownership of dump file '%s'", use_dumpfile);
         }
 
+        if (use_flowdump) {
+                if (chown(use_flowdump, user->pw_uid, user->pw_gid) < 0)
+                        LOG_WARN("Cannot change ownership of flow dump file '%s'", use_flowdump);
+        }
+
         if (initgroups(name, user->pw_gid))
                 LOG_DIE("Cannot initialize the group access list");
 
@@ -292,308 +896,586 @@ void change_user(char *name) {
         return;
 }
 
-/* Process each packet that passes the capture filter */
-void parse_http_packet(u_char *args, const struct pcap_pkthdr *header, const u_char *pkt) {
-        struct tm *pkt_time;
-        char *header_line, *req_value;
-        char saddr[INET6_ADDRSTRLEN], daddr[INET6_ADDRSTRLEN];
-        char sport[PORTSTRLEN], dport[PORTSTRLEN];
-        char ts[MAX_TIME_LEN], fmt[MAX_TIME_LEN];
-        int is_request = 0, is_response = 0;
-        unsigned int eth_type = 0, offset;
-
-        const struct eth_header *eth;
-        const struct ip_header *ip;
-        const struct ip6_header *ip6;
-        const struct tcp_header *tcp;
-        const char *data;
-        int size_ip, size_tcp, size_data, family;
-
-        /* Check the ethernet type and insert a VLAN offset if necessary */
-        eth = (struct eth_header *) pkt;
-        eth_type = ntohs(eth->ether_type);
-        if (eth_type == ETHER_TYPE_VLAN) {
-                offset = link_offset + 4;
-        } else {
-                offset = link_offset;
+/* Process a batch of packets that passed the capture filter; args
+   points to the worker that received them. Each stage runs over the
+   whole batch before the next starts, fetching the data the stage
+   will need a few packets ahead of where it is working. */
+void parse_http_batch(u_char *args, PACKET_BATCH *batch) {
+        struct worker *worker = (struct worker *) args;
+        PACKET_INFO *info = worker->info;
+        PARSE_STATS *stats = worker->stats;
+        unsigned int i, n = batch->count;
+
+#ifdef DEBUG
+        ASSERT(n <= batch_size);
+#endif
+
+        /* A ring block is walked to its end even once capture is
+           halted; the rest of it is passed over */
+        if (capture_halted) return;
+
+        if (time_stages) worker->stage_start = read_cycles();
+
+        decode_batch(batch, link_offset, eth_skip_bits, info, stats);
+        if (time_stages) mark_stage(worker, STAGE_DECODE);
+
+        /* Reassembly looks at every segment itself; otherwise keep only
+           payloads that start a request or response, and locate their
+           header fields in place */
+        if (!worker->streams) {
+                filter_batch(n, info, stats);
+                if (time_stages) mark_stage(worker, STAGE_FILTER);
+
+                scan_batch(n, info, worker->fields, stats);
+                if (time_stages) mark_stage(worker, STAGE_SCAN);
         }
 
-        offset += eth_skip_bits;
+        /* Everything that keeps state across packets runs in packet
+           order: flow dumps, reassembly and logging */
+        for (i = 0; i < n; i++) {
+                if (!info[i].data) continue;
 
-        /* Position pointers within packet stream and do sanity checks */
-        ip = (struct ip_header *) (pkt + offset);
-        ip6 = (struct ip6_header *) (pkt + offset);
+                process_packet(worker, &batch->headers[i], batch->pkts[i], &info[i]);
 
-        switch (IP_V(ip)) {
-                case 4: family = AF_INET; break;
-                case 6: family = AF_INET6; break;
-                default: return;
+                /* Stop short of the rest of the batch once enough is logged */
+                if (parse_count && (num_parsed >= parse_count)) break;
         }
+        if (time_stages) mark_stage(worker, STAGE_EMIT);
+
+        return;
+}
 
-        if (family == AF_INET) {
-                size_ip = IP_HL(ip) * 4;
-                if (size_ip < 20) return;
-                if (ip->ip_p != IPPROTO_TCP) return;
-        } else { /* AF_INET6 */
-                size_ip = sizeof(struct ip6_header);
-                if (ip6->ip6_nh != IPPROTO_TCP)
-                        size_ip = process_ip6_nh(pkt, size_ip, header->caplen, offset);
-                if (size_ip < 40) return;
+/* Charge the cycles since the last mark to a parser stage */
+void mark_stage(struct worker *worker, int stage) {
+        unsigned long long now = read_cycles();
+
+        worker->stats->stage_cycles[stage] += now - worker->stage_start;
+        worker->stage_start = now;
+
+        return;
+}
+
+/* Log a decoded packet, or hand it to reassembly */
+void process_packet(struct worker *worker, const struct pcap_pkthdr *header, const u_char *pkt,
+                    const PACKET_INFO *info) {
+        int size_data = info->size_data, payload_len = info->payload_len;
+
+        if (worker->dumps) {
+                if (header->ts.tv_sec != worker->last_dump_expire) {
+                        flowdump_expire(worker->dumps, header->ts.tv_sec);
+                        worker->last_dump_expire = header->ts.tv_sec;
+                }
+
+                flowdump_packet(worker->dumps, &info->key, info->flags, payload_len, header, pkt);
+        }
+
+        if (worker->streams) {
+                /* Offloaded packets may not carry a usable length */
+                if (payload_len < size_data) payload_len = size_data;
+
+                reassemble_segment(worker, &info->key, info->seq, info->flags,
+                                   header, pkt, info->data, size_data, payload_len);
+                return;
         }
 
-        tcp = (struct tcp_header *) (pkt + offset + size_ip);
-        size_tcp = TH_OFF(tcp) * 4;
-        if (size_tcp < 20) return;
+        if ((info->type == 0) || (info->num_fields < 0)) return;
+
+        /* Fields are logged straight from the packet, which is never
+           copied or written to */
+        if (log_http_message(worker, &info->key, &header->ts, info->data, info->line_len,
+                             info->fields, info->num_fields, info->type))
+                dump_packet(worker, &info->key, header, pkt);
+
+        return;
+}
+
+/* Feed a TCP segment through the worker's stream table. A segment
+   that continues a buffered message is appended to it, and the
+   message is logged once its headers are complete; a segment that
+   starts a message is logged directly if it holds all the headers
+   and buffered otherwise. */
+void reassemble_segment(struct worker *worker, const FLOW_KEY *key, unsigned int seq, int flags,
+                        const struct pcap_pkthdr *header, const u_char *pkt, const char *data,
+                        int size_data, int payload_len) {
+        STREAM *stream;
+        FLOW_KEY stream_key;
+        struct timeval stream_ts;
+        size_t len;
+        int done;
+
+        /* Expire idle streams once per second of capture time */
+        if (header->ts.tv_sec != worker->last_expire) {
+                stream_expire(worker->streams, header->ts.tv_sec);
+                worker->last_expire = header->ts.tv_sec;
+        }
+
+        if ((stream = stream_find(worker->streams, key))) {
+                if ((seq == stream->next_seq) && (size_data > 0)) {
+                        stream->next_seq += payload_len;
+                        done = stream_append(worker->streams, stream, data, size_data, header->ts.tv_sec);
+
+                        /* Data missing from a short capture can't be filled in
+                           later, so log what we have */
+                        if (size_data < payload_len) done = 1;
+                        if (flags & (TH_FIN | TH_RST)) done = 1;
+
+                        if (done) {
+                                /* The stream is released before logging so any
+                                   pipelined message after it can take its place */
+                                memcpy(&stream_key, &stream->key, sizeof(FLOW_KEY));
+                                stream_ts = stream->ts;
+                                len = stream->len;
+                                memcpy(worker->stream_buf, stream->data, len);
+                                stream_release(worker->streams, stream);
+
+                                process_payload(worker, &stream_key, &stream_ts, &header->ts,
+                                                worker->stream_buf, len, seq + payload_len,
+                                                !(flags & (TH_FIN | TH_RST)) && (size_data == payload_len));
+                        }
+
+                        dump_packet(worker, key, header, pkt);
+                        return;
+                }
+
+                /* Ignore retransmitted data */
+                if ((int) (seq + payload_len - stream->next_seq) <= 0) {
+                        if (flags & (TH_FIN | TH_RST)) {
+                                flush_stream(stream, worker);
+                                stream_release(worker->streams, stream);
+                        }
+                        return;
+                }
+
+                /* A gap in the stream; log what we have and start over */
+                flush_stream(stream, worker);
+                stream_release(worker->streams, stream);
+        }
 
-        data = (char *) (pkt + offset + size_ip + size_tcp);
-        size_data = (header->caplen - (offset + size_ip + size_tcp));
         if (size_data <= 0) return;
 
-        /* Check if we appear to have a valid request or response */
-        if (is_request_method(data)) {
-                is_request = 1;
-        } else if (strncmp(data, HTTP_STRING, strlen(HTTP_STRING)) == 0) {
-                is_response = 1;
-        } else {
-                return;
+        if (process_payload(worker, key, &header->ts, &header->ts, data, size_data, seq + payload_len,
+                            !(flags & (TH_FIN | TH_RST)) && (size_data == payload_len)))
+                dump_packet(worker, key, header, pkt);
+
+        return;
+}
+
+/* Log whatever a stream holds; called when a stream is dropped before
+   its headers are complete */
+void flush_stream(STREAM *stream, void *args) {
+        struct worker *worker = (struct worker *) args;
+
+        process_payload(worker, &stream->key, &stream->ts, &stream->ts, stream->data, stream->len, 0, 0);
+
+        return;
+}
+
+/* Log each message in data, which starts on a message boundary. With
+   reassembly, messages following the first (pipelined requests) are
+   logged too, and an incomplete final message is buffered if allowed.
+   Returns nonzero if anything was logged or buffered. */
+int process_payload(struct worker *worker, const FLOW_KEY *key, const struct timeval *first_ts,
+                    const struct timeval *ts, const char *data, size_t len, unsigned int next_seq,
+                    int can_buffer) {
+        const struct timeval *msg_ts = first_ts;
+        STREAM *stream;
+        size_t end;
+        int type, used = 0;
+
+        while ((len > 0) && (type = message_type(data, len))) {
+                end = find_header_end(data, len, 0);
+                if (!end) {
+                        if (can_buffer) {
+                                stream = stream_new(worker->streams, key, msg_ts);
+                                stream->next_seq = next_seq;
+                                stream_append(worker->streams, stream, data, len, ts->tv_sec);
+                                return 1;
+                        }
+                        end = len;
+                }
+
+                used += parse_http_message(worker, key, msg_ts, data, end, type);
+
+                data += end;
+                len -= end;
+                msg_ts = ts;
         }
 
-        /* Copy packet data to editable buffer that was created in main() */
-        if (size_data > BUFSIZ) size_data = BUFSIZ;
-        memcpy(buf, data, size_data);
-        buf[size_data] = '\0';
+        return used;
+}
+
+/* Parse a single message held in the len bytes at buf and log it.
+   Returns 1 if a record was logged. */
+int parse_http_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts,
+                       const char *buf, size_t len, int type) {
+        HEADER_FIELD fields[MAX_HEADER_FIELDS];
+        int num_fields;
+        size_t line_len;
+
+        /* Locate the start line and header fields, bail if malformed */
+        num_fields = scan_headers(buf, len, &line_len, fields, MAX_HEADER_FIELDS);
+        worker->stats->scanned += len;
+        if (num_fields < 0) {
+                COUNT_REJECT(worker->stats, REJECT_MALFORMED);
+                return 0;
+        }
 
-        /* Parse header line, bail if malformed */
-        if ((header_line = parse_header_line(buf)) == NULL) return;
+        return log_http_message(worker, key, ts, buf, line_len, fields, num_fields, type);
+}
 
-        if (is_request) {
-                if (parse_client_request(header_line)) return;
-        } else if (is_response) {
-                if (parse_server_response(header_line)) return;
+/* Log a message held in buf whose start line and header fields have
+   been located; values are recorded as slices of buf, which is left
+   untouched. Returns 1 if a record was logged. */
+int log_http_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts, const char *buf,
+                     size_t line_len, const HEADER_FIELD *fields, int num_fields, int type) {
+        FORMAT_RECORD *rec = worker->record;
+        char saddr[INET6_ADDRSTRLEN], daddr[INET6_ADDRSTRLEN];
+        char sport[PORTSTRLEN], dport[PORTSTRLEN];
+        struct start_line start;
+        const char *host;
+        size_t host_len = 0;
+        PAIR_REQUEST req;
+        char elapsed[USECSTRLEN];
+        int headers_found = 0;
+        int i;
+
+        if ((type == MSG_REQUEST) ? parse_client_request(rec, buf, line_len, &start) :
+                                    parse_server_response(rec, buf, line_len, &start)) {
+                COUNT_REJECT(worker->stats, REJECT_MALFORMED);
+                return 0;
         }
 
-        /* Iterate through request/entity header fields */
-        while ((header_line = parse_header_line(NULL)) != NULL) {
-                if ((req_value = strchr(header_line, ':')) == NULL) continue;
-                *req_value++ = '\0';
-                while (isspace(*req_value)) req_value++;
+        if (worker->pairs)
+                pair_message(worker, key, ts, type, &start, &req, elapsed);
 
-                insert_value(header_line, req_value);
+        /* Store request/entity header values as slices of the message,
+           stopping once every header field named in the format string
+           has a value */
+        for (i = 0; (i < num_fields) && (headers_found < headers_wanted); i++) {
+                headers_found += insert_header(rec, buf + fields[i].name_off, fields[i].name_len,
+                                               buf + fields[i].value_off, fields[i].value_len);
         }
 
         /* Grab source/destination IP addresses */
-        if (family == AF_INET) {
-                inet_ntop(family, &ip->ip_src, saddr, sizeof(saddr));
-                inet_ntop(family, &ip->ip_dst, daddr, sizeof(daddr));
-        } else { /* AF_INET6 */
-                inet_ntop(family, &ip6->ip_src, saddr, sizeof(saddr));
-                inet_ntop(family, &ip6->ip_dst, daddr, sizeof(daddr));
+        if (slot.source_ip >= 0) {
+                inet_ntop(key->family, key->saddr, saddr, sizeof(saddr));
+                set_value(rec, slot.source_ip, saddr);
+        }
+        if (slot.dest_ip >= 0) {
+                inet_ntop(key->family, key->daddr, daddr, sizeof(daddr));
+                set_value(rec, slot.dest_ip, daddr);
         }
-        insert_value("source-ip", saddr);
-        insert_value("dest-ip", daddr);
 
         /* Grab source/destination ports */
-        snprintf(sport, PORTSTRLEN, "%d", ntohs(tcp->th_sport));
-        snprintf(dport, PORTSTRLEN, "%d", ntohs(tcp->th_dport));
-        insert_value("source-port", sport);
-        insert_value("dest-port", dport);
+        if (slot.source_port >= 0) {
+                snprintf(sport, PORTSTRLEN, "%d", ntohs(key->sport));
+                set_value(rec, slot.source_port, sport);
+        }
+        if (slot.dest_port >= 0) {
+                snprintf(dport, PORTSTRLEN, "%d", ntohs(key->dport));
+                set_value(rec, slot.dest_port, dport);
+        }
 
         /* Extract packet capture time */
-        pkt_time = localtime((time_t *) &header->ts.tv_sec);
-        strftime(fmt, sizeof(fmt), "%Y-%m-%d %H:%M:%S.%%03u", pkt_time);
-        snprintf(ts, sizeof(ts), fmt, header->ts.tv_usec / 1000);
-        insert_value("timestamp", ts);
+        if (slot.timestamp >= 0)
+                set_value(rec, slot.timestamp, format_ts_local(&worker->ts_cache, ts));
+        if (slot.timestamp_utc >= 0)
+                set_value(rec, slot.timestamp_utc, format_ts_utc(&worker->ts_cache, ts));
+        if (slot.timestamp_ms >= 0)
+                set_value(rec, slot.timestamp_ms, format_ts_epoch_ms(&worker->ts_cache, ts));
 
         if (rate_stats) {
-                update_host_stats(get_value("host"), header->ts.tv_sec);
-                clear_values();
+                host = get_value(rec, slot.rate_key, &host_len);
+                update_host_stats(worker - workers, host, host_len, ts->tv_sec);
+                clear_values(rec);
+        } else if (aggregate) {
+                update_aggregate_stats(worker - workers, rec, ts->tv_sec);
+                clear_values(rec);
+        } else if (binary_log) {
+                worker->stats->out_bytes += print_format_binary(rec, ts, worker->out);
         } else {
-                print_format_values();
+                worker->stats->out_bytes += print_format_values(rec, worker->out);
         }
 
-        if (dumpfile)
-                pcap_dump((unsigned char *) dumpfile, header, pkt);
+        worker->stats->records++;
+        if (parse_count && (__sync_add_and_fetch(&num_parsed, 1) >= parse_count))
+                break_capture();
 
-        num_parsed++;
-        if (parse_count && (num_parsed >= parse_count))
-                pcap_breakloop(pcap_hnd);
-
-        return;
+        return 1;
 }
 
-/* Iterate through IPv6 extension headers looking for a TCP header. Returns
-   the total size of the IPv6 header, including all extension headers.
-   Return 0 to abort processing of this packet. */
-int process_ip6_nh(const u_char *pkt, int size_ip, unsigned int caplen, unsigned int offset) {
-        const struct ip6_ext_header *ip6_eh;
-        unsigned int len = caplen - offset;
-        ip6_eh = (struct ip6_ext_header *) (pkt + offset + size_ip);
-
-        while (ip6_eh->ip6_eh_nh != IPPROTO_TCP) {
-                switch (ip6_eh->ip6_eh_nh) {
-                        case 0:  /* Hop-by-hop options */
-                        case 43: /* Routing */
-                        case 44: /* Fragment */
-                        case 51: /* Authentication Header */
-                        case 50: /* Encapsulating Security Payload */
-                        case 60: /* Destination Options */
-                                size_ip = size_ip + (ip6_eh->ip6_eh_len * 8) + 8;
-                                break;
-                        case 59: /* No next header */
-                        default:
-                                return 0;
-                }
-
-                if (size_ip > len) return 0;
+/* Queue a request for pairing, or pair a response with the request
+   it answers and set the paired fields; req and elapsed hold those
+   values until the record is written */
+void pair_message(struct worker *worker, const FLOW_KEY *key, const struct timeval *ts, int type,
+                  const struct start_line *start, PAIR_REQUEST *req, char *elapsed) {
+        FORMAT_RECORD *rec = worker->record;
+        long usec;
+        int final;
+
+        /* Expire unanswered requests once per second of capture time */
+        if (ts->tv_sec != worker->last_pair_expire) {
+                pair_expire(worker->pairs, ts->tv_sec);
+                worker->last_pair_expire = ts->tv_sec;
+        }
 
-                ip6_eh = (struct ip6_ext_header *) (pkt + offset + size_ip);
+        if (type == MSG_REQUEST) {
+                pair_request(worker->pairs, key, ts, start->method, start->method_len,
+                             start->request_uri, start->uri_len);
+                return;
         }
 
-        /* Next header is TCP, so increment past the final extension header */
-        size_ip = size_ip + (ip6_eh->ip6_eh_len * 8) + 8;
+        /* An interim 1xx response is followed by the final one, except
+           for 101 after which the connection no longer speaks HTTP */
+        final = (start->status_len == 0) || (start->status_code[0] != '1') ||
+                ((start->status_len >= 3) && (strncmp(start->status_code, "101", 3) == 0));
+        if (!pair_response(worker->pairs, key, final, req)) return;
 
-        return size_ip;
+        usec = (long) (ts->tv_sec - req->ts.tv_sec) * 1000000L + (ts->tv_usec - req->ts.tv_usec);
+        if (usec < 0) usec = 0;
+        snprintf(elapsed, USECSTRLEN, "%ld", usec);
+
+        set_value(rec, slot.response_time_us, elapsed);
+        set_value(rec, slot.paired_method, req->method);
+        set_value(rec, slot.paired_uri, req->uri);
+
+        return;
 }
 
-/* Tokenize a HTTP header into lines; the first call should pass the string
-   to tokenize, all subsequent calls for the same string should pass NULL */
-char *parse_header_line(char *header_line) {
-        static char *pos;
-        char *tmp;
+/* Write a packet to the binary dump file, if one is open */
+void dump_packet(struct worker *worker, const FLOW_KEY *key, const struct pcap_pkthdr *header,
+                 const u_char *pkt) {
+        if (worker->dumps) flowdump_match(worker->dumps, key, header, pkt);
 
-        if (header_line) pos = header_line;
+        if (!dumpfile) return;
 
-        /* Search for a '\n' line terminator, ignoring a leading
-           '\r' if it exists (per RFC2616 section 19.3) */
-        tmp = strchr(pos, '\n');
-        if (!tmp && header_line) {
-                return header_line;
-        } else if (!tmp) {
-                return NULL;
-        }
-        *tmp = '\0';
-        if (*(tmp - 1) == '\r') *(--tmp) = '\0';
+        if (num_workers > 1) pthread_mutex_lock(&dump_lock);
+        pcap_dump((unsigned char *) dumpfile, header, pkt);
+        if (num_workers > 1) pthread_mutex_unlock(&dump_lock);
 
-        if (tmp == pos) return NULL; /* Reached the end of the header */
+        return;
+}
 
-        header_line = pos;
-        /* Increment past the '\0' character(s) inserted above */
-        if (*tmp == '\0') {
-                tmp++;
-                if (*tmp == '\0') tmp++;
-        }
-        pos = tmp;
+/* Look up the record slot of each field the packet parser sets */
+void resolve_slots() {
+        slot.timestamp = format_slot("timestamp");
+        slot.timestamp_utc = format_slot("timestamp-utc");
+        slot.timestamp_ms = format_slot("timestamp-ms");
+        slot.source_ip = format_slot("source-ip");
+        slot.dest_ip = format_slot("dest-ip");
+        slot.source_port = format_slot("source-port");
+        slot.dest_port = format_slot("dest-port");
+        slot.direction = format_slot("direction");
+        slot.method = format_slot("method");
+        slot.request_uri = format_slot("request-uri");
+        slot.http_version = format_slot("http-version");
+        slot.status_code = format_slot("status-code");
+        slot.reason_phrase = format_slot("reason-phrase");
+        slot.host = format_slot("host");
+        slot.response_time_us = format_slot("response-time-us");
+        slot.paired_method = format_slot("paired-method");
+        slot.paired_uri = format_slot("paired-uri");
+        slot.rate_key = rate_key ? format_slot(rate_key) : -1;
+
+        use_pairs = (slot.response_time_us >= 0) || (slot.paired_method >= 0) || (slot.paired_uri >= 0);
+
+        headers_wanted = format_header_fields();
 
-        return header_line;
+        return;
 }
 
-/* Parse a HTTP client request; bail at first sign of an invalid request */
-int parse_client_request(char *header_line) {
-        char *method, *request_uri, *http_version;
+/* Parse the len bytes of a HTTP client request line; bail at first
+   sign of an invalid request */
+int parse_client_request(FORMAT_RECORD *rec, const char *line, size_t len, struct start_line *start) {
+        const char *end = line + len, *p, *http_version;
 
 #ifdef DEBUG
-        ASSERT(header_line);
-        ASSERT(strlen(header_line) > 0);
+        ASSERT(line);
+        ASSERT(len > 0);
 #endif
 
-        method = header_line;
+        start->method = line;
 
-        if ((request_uri = strchr(method, ' ')) == NULL) return 1;
-        *request_uri++ = '\0';
-        while (isspace(*request_uri)) request_uri++;
+        if ((p = memchr(line, ' ', len)) == NULL) return 1;
+        start->method_len = p - line;
+        while ((++p < end) && isspace(*p));
 
-        if ((http_version = strchr(request_uri, ' ')) != NULL) {
-                *http_version++ = '\0';
-                while (isspace(*http_version)) http_version++;
-                if (strncmp(http_version, HTTP_STRING, strlen(HTTP_STRING)) != 0) return 1;
-                insert_value("http-version", http_version);
+        start->request_uri = p;
+        if ((http_version = memchr(p, ' ', end - p)) != NULL) {
+                start->uri_len = http_version - p;
+                while ((++http_version < end) && isspace(*http_version));
+                if (((size_t) (end - http_version) < sizeof(HTTP_STRING) - 1) ||
+                    (strncmp(http_version, HTTP_STRING, sizeof(HTTP_STRING) - 1) != 0)) return 1;
+                set_slice(rec, slot.http_version, http_version, end - http_version);
+        } else {
+                start->uri_len = end - p;
         }
 
-        insert_value("method", method);
-        insert_value("request-uri", request_uri);
-        insert_value("direction", ">");
+        set_slice(rec, slot.method, start->method, start->method_len);
+        set_slice(rec, slot.request_uri, start->request_uri, start->uri_len);
+        set_value(rec, slot.direction, ">");
 
         return 0;
 }
 
-/* Parse a HTTP server response; bail at first sign of an invalid response */
-int parse_server_response(char *header_line) {
-        char *http_version, *status_code, *reason_phrase;
+/* Parse the len bytes of a HTTP server response line; bail at first
+   sign of an invalid response */
+int parse_server_response(FORMAT_RECORD *rec, const char *line, size_t len, struct start_line *start) {
+        const char *end = line + len, *p, *http_version = line, *reason_phrase;
+        size_t version_len;
 
 #ifdef DEBUG
-        ASSERT(header_line);
-        ASSERT(strlen(header_line) > 0);
+        ASSERT(line);
+        ASSERT(len > 0);
 #endif
 
-        http_version = header_line;
-
-        if ((status_code = strchr(http_version, ' ')) == NULL) return 1;
-        *status_code++ = '\0';
-        while (isspace(*status_code)) status_code++;
+        if ((p = memchr(line, ' ', len)) == NULL) return 1;
+        version_len = p - line;
+        while ((++p < end) && isspace(*p));
 
-        if ((reason_phrase = strchr(status_code, ' ')) == NULL) return 1;
-        *reason_phrase++ = '\0';
-        while (isspace(*reason_phrase)) reason_phrase++;
+        start->status_code = p;
+        if ((reason_phrase = memchr(p, ' ', end - p)) == NULL) return 1;
+        start->status_len = reason_phrase - p;
+        while ((++reason_phrase < end) && isspace(*reason_phrase));
 
-        insert_value("http-version", http_version);
-        insert_value("status-code", status_code);
-        insert_value("reason-phrase", reason_phrase);
-        insert_value("direction", "<");
+        set_slice(rec, slot.http_version, http_version, version_len);
+        set_slice(rec, slot.status_code, start->status_code, start->status_len);
+        set_slice(rec, slot.reason_phrase, reason_phrase, end - reason_phrase);
+        set_value(rec, slot.direction, "<");
 
         return 0;
 }
 
-/* Handle signals for clean reloading or shutdown */
+/* Handle signals for clean reloading or shutdown; the handler only
+   asks the capture loop on the main thread to return, since that
+   thread may have been interrupted in the middle of a stats update
+   or while holding an output lock. The work is done by main() */
 void handle_signal(int sig) {
-
-#ifdef DEBUG
-        ASSERT(sig > 0);
-#endif
-
         switch (sig) {
                 case SIGHUP:
-                        LOG_PRINT("Caught SIGHUP, reloading...");
-                        print_stats();
-                        if (rate_stats)
-                                cleanup_rate_stats();
-                        open_outfiles();
-                        if (rate_stats)
-                                init_rate_stats(rate_interval, use_infile, rate_threshold);
+                        reload_pending = 1;
+
+                        /* Replaying checks for a reload between batches */
+                        if (replay_rounds) return;
+
+                        /* Other workers carry on capturing meanwhile */
+                        if (use_ring && workers) {
+                                ring_breakloop(workers[0].ring);
+                        } else if (pcap_hnd) {
+                                pcap_breakloop(pcap_hnd);
+                        }
                         return;
                 case SIGINT:
-                        LOG_PRINT("Caught SIGINT, shutting down...");
-                        print_stats();
-                        cleanup();
-                        break;
                 case SIGTERM:
-                        LOG_PRINT("Caught SIGTERM, shutting down...");
-                        print_stats();
-                        cleanup();
-                        break;
+                        shutdown_signal = sig;
+                        break_capture();
+                        return;
                 default:
-                        LOG_WARN("Ignoring unknown signal '%d'", sig);
                         return;
         }
+}
+
+/* Report and start over the stats and output files on SIGHUP; called
+   on the main thread outside of the capture loop */
+void reload() {
+        reload_pending = 0;
+
+        LOG_PRINT("Caught SIGHUP, reloading...");
+        print_stats();
+        open_outfiles();
+        if (rate_stats)
+                reset_rate_stats();
+        if (aggregate)
+                reset_aggregate_stats();
 
-        exit(sig);
+        return;
+}
+
+/* Run the capture loop of the main thread until it ends or is broken
+   off; mirrors pcap_loop() return values */
+int capture_packets() {
+        if (shutdown_signal) return -2;
+
+        if (replay_rounds)
+                return replay_capture(replay_rounds);
+
+        if (use_ring)
+                return ring_loop(workers[0].ring, workers[0].batch, &parse_http_batch, (u_char *) &workers[0]);
+
+        return batch_loop(pcap_hnd, workers[0].batch, &parse_http_batch, (u_char *) &workers[0]);
+}
+
+/* Remove the PID file at exit, however we got there */
+void remove_pid_file() {
+        /* Note that this won't get removed if we've switched to a
+           user that doesn't have permission to delete the file */
+        remove(pid_filename);
+
+        return;
+}
+
+/* Stop on a fatal error once DIE has reported it. Any other thread
+   stops itself and has the main thread shut down through the usual
+   cleanup; the main thread cleans up straight away. Stats are not
+   reported either way, since a stats update may have been cut short */
+void die() {
+        if (!pthread_equal(pthread_self(), main_thread)) {
+                fatal_error = 1;
+                pthread_kill(main_thread, SIGINT);
+                pthread_exit(NULL);
+        }
+
+        /* Don't come back here if the cleanup itself fails */
+        if (!fatal_error) {
+                fatal_error = 1;
+                cleanup();
+        }
+
+        exit(EXIT_FAILURE);
 }
 
 /* Perform end of run tasks and prepare to exit gracefully */
 void cleanup() {
+        int i;
+
         /* This may have already been called, but might not
            have depending on how we got here */
-        if (pcap_hnd) pcap_breakloop(pcap_hnd);
+        break_capture();
+        stats_stop_reporter();
+        metrics_stop();
+        stop_workers();
+        output_stop_flusher();
         if (rate_stats) cleanup_rate_stats();
+        if (aggregate) cleanup_aggregate_stats();
+
+        if (workers) {
+                for (i = 0; i < num_workers; i++) {
+                        output_free(workers[i].out);
+                        free_format_record(workers[i].record);
+                        batch_free(workers[i].batch);
+                        free(workers[i].info);
+                        free(workers[i].fields);
+                        free(workers[i].stream_buf);
+                        stream_table_free(workers[i].streams);
+                        pair_table_free(workers[i].pairs);
+                        flowdump_table_free(workers[i].dumps);
+                        ring_close(workers[i].ring);
+                }
+
+                free(workers);
+                workers = NULL;
+        }
+        stats_free();
+
+        /* Only once every buffer has been flushed into it */
+        logfile_close();
+        flowdump_close();
 
         fflush(NULL);
 
         free_format();
         free_methods();
-        if (buf) free(buf);
 
-        /* Note that this won't get removed if we've switched to a
-           user that doesn't have permission to delete the file */
-        if (daemon_mode) remove(pid_filename);
         if (pcap_hnd) pcap_close(pcap_hnd);
 
         return;
@@ -602,16 +1484,25 @@ void cleanup() {
 /* Print packet capture statistics */
 void print_stats() {
         struct pcap_stat pkt_stats;
+        struct stream_stats stream_totals;
+        struct pair_stats pair_totals;
+        struct flowdump_stats dump_totals;
+        PARSE_STATS totals;
+        unsigned int num_parsed = 0;
         float run_time;
 
         if (rate_stats)
                 display_rate_stats(use_infile, rate_threshold);
+        if (aggregate)
+                display_aggregate_stats(use_infile);
+
+        if (workers) {
+                stats_sum(&totals);
+                num_parsed = totals.records;
+        }
 
         if (pcap_hnd && !use_infile) {
-                if (pcap_stats(pcap_hnd, &pkt_stats) != 0) {
-                        WARN("Cannot obtain packet capture statistics: %s", pcap_geterr(pcap_hnd));
-                        return;
-                }
+                if (get_capture_stats(&pkt_stats) != 0) return;
 
                 LOG_PRINT("%u packets received, %u packets dropped, %u http packets parsed", \
                      pkt_stats.ps_recv, pkt_stats.ps_drop, num_parsed);
@@ -625,6 +1516,124 @@ void print_stats() {
                 PRINT("%u http packets parsed", num_parsed);
         }
 
+        if (!workers) return;
+
+        stats_print_totals(time_stages);
+
+        sum_worker_stats(&stream_totals, &pair_totals, &dump_totals);
+
+        if (use_streams) {
+                LOG_PRINT("%u split messages buffered: %u completed, %u capped, %u expired, %u evicted", \
+                     stream_totals.started, stream_totals.completed, stream_totals.capped,
+                     stream_totals.expired, stream_totals.evicted);
+        }
+
+        if (use_pairs) {
+                LOG_PRINT("%u requests queued for pairing: %u matched, %u expired, %u dropped; %u unmatched responses", \
+                     pair_totals.queued, pair_totals.matched, pair_totals.expired,
+                     pair_totals.dropped, pair_totals.unmatched);
+        }
+
+        if (use_flowdump) {
+                LOG_PRINT("%u flows dumped: %u packets, %lu bytes; %u capped, %u evicted", \
+                     dump_totals.matched, dump_totals.packets, dump_totals.bytes,
+                     dump_totals.capped, dump_totals.evicted);
+        }
+
+        return;
+}
+
+/* Get the packets received and dropped by the live capture source,
+   over every ring if capturing through them; returns 0 on success.
+   Reading the counters updates them, so the main thread and the
+   metrics listener take turns; the capture path never takes the
+   lock. */
+int get_capture_stats(struct pcap_stat *ps) {
+        struct pcap_stat ring_stat;
+        int i, ret = 0;
+
+        pthread_mutex_lock(&stats_lock);
+
+        if (use_ring) {
+                memset(ps, 0, sizeof(struct pcap_stat));
+                for (i = 0; i < num_workers; i++) {
+                        if (ring_stats(workers[i].ring, &ring_stat) != 0) {
+                                ret = -1;
+                                break;
+                        }
+                        ps->ps_recv += ring_stat.ps_recv;
+                        ps->ps_drop += ring_stat.ps_drop;
+                }
+        } else if (pcap_stats(pcap_hnd, ps) != 0) {
+                WARN("Cannot obtain packet capture statistics: %s", pcap_geterr(pcap_hnd));
+                ret = -1;
+        }
+
+        pthread_mutex_unlock(&stats_lock);
+
+        return ret;
+}
+
+/* Add up the stream, pairing and flow dump counts of every worker */
+void sum_worker_stats(struct stream_stats *streams, struct pair_stats *pairs, struct flowdump_stats *dumps) {
+        struct stream_stats worker_streams;
+        struct pair_stats worker_pairs;
+        struct flowdump_stats worker_dumps;
+        int i;
+
+        memset(streams, 0, sizeof(struct stream_stats));
+        memset(pairs, 0, sizeof(struct pair_stats));
+        memset(dumps, 0, sizeof(struct flowdump_stats));
+
+        for (i = 0; i < num_workers; i++) {
+                if (use_streams) {
+                        stream_stats(workers[i].streams, &worker_streams);
+                        streams->started += worker_streams.started;
+                        streams->completed += worker_streams.completed;
+                        streams->capped += worker_streams.capped;
+                        streams->expired += worker_streams.expired;
+                        streams->evicted += worker_streams.evicted;
+                }
+
+                if (use_pairs) {
+                        pair_stats(workers[i].pairs, &worker_pairs);
+                        pairs->queued += worker_pairs.queued;
+                        pairs->matched += worker_pairs.matched;
+                        pairs->expired += worker_pairs.expired;
+                        pairs->dropped += worker_pairs.dropped;
+                        pairs->unmatched += worker_pairs.unmatched;
+                }
+
+                if (use_flowdump) {
+                        flowdump_stats(workers[i].dumps, &worker_dumps);
+                        dumps->matched += worker_dumps.matched;
+                        dumps->packets += worker_dumps.packets;
+                        dumps->capped += worker_dumps.capped;
+                        dumps->evicted += worker_dumps.evicted;
+                        dumps->bytes += worker_dumps.bytes;
+                }
+        }
+
+        return;
+}
+
+/* Fill in the capture and worker counts for the metrics listener,
+   which calls this from its own thread */
+void read_capture_counts(struct capture_counts *counts) {
+        struct pcap_stat pkt_stats;
+
+        if (pcap_hnd && !use_infile && (get_capture_stats(&pkt_stats) == 0)) {
+                counts->live = 1;
+                counts->received = pkt_stats.ps_recv;
+                counts->dropped = pkt_stats.ps_drop;
+        }
+
+        counts->use_streams = use_streams;
+        counts->use_pairs = use_pairs;
+        counts->use_flowdump = (use_flowdump != NULL);
+        counts->rate_stats = rate_stats;
+        sum_worker_stats(&counts->streams, &counts->pairs, &counts->dumps);
+
         return;
 }
 
@@ -641,27 +1650,48 @@ void display_banner() {
 void display_usage() {
         display_banner();
 
-        printf("Usage: %s [ -dFhpqs ] [-b file ] [ -f format ] [ -i device ] [ -l threshold ]\n"
-               "              [ -m methods ] [ -n count ] [ -o file ] [ -P file ] [ -r file ]\n"
-               "              [ -t seconds] [ -u user ] [ 'expression' ]\n\n", PROG_NAME);
-
-        printf("   -b file      write HTTP packets to a binary dump file\n"
+        printf("Usage: %s [ -BdFhHpqsYz ] [ -a stream ] [-b file ] [ -c pairs ] [ -D dump ]\n"
+               "              [ -f format ] [ -g group ] [ -i device ] [ -k key ]\n"
+               "              [ -l threshold ] [ -L latency ] [ -m methods ] [ -M metrics ]\n"
+               "              [ -n count ] [ -o file ] [ -O rotate ] [ -P file ] [ -r file ]\n"
+               "              [ -R ring ] [ -t seconds] [ -T seconds ] [ -u user ] [ -w workers ]\n"
+               "              [ -x batch ] [ -X rounds ] [ -y snaplen ] [ 'expression' ]\n\n", PROG_NAME);
+
+        printf("   -a stream    reassemble split headers (bytes,timeout_sec,flows)\n"
+               "   -b file      write HTTP packets to a binary dump file\n"
+               "   -B           write output as a compressed binary log\n"
+               "   -c pairs     size request/response pairing (flows,depth,timeout_sec)\n"
                "   -d           run as daemon\n"
+               "   -D dump      dump the start of each matched flow (file[:packets,bytes,snaplen])\n"
                "   -f format    specify output format string\n"
                "   -F           force output flush\n"
+               "   -g group     report aggregates per group of field values (fields[:aggregates])\n"
                "   -h           print this help information\n"
+               "   -H           only capture packets that start a request or response\n"
                "   -i device    listen on this interface\n"
+               "   -k key       track the heaviest values of a field in rate mode (field,count)\n"
                "   -l threshold specify a rps threshold for rate statistics\n"
+               "   -L latency   bound output latency (ms[,records])\n"
                "   -m methods   specify request methods to parse\n"
+               "   -M metrics   serve metrics on a Unix socket path or localhost port\n"
                "   -n count     set number of HTTP packets to parse\n"
                "   -o file      write output to a file\n"
+               "   -O rotate    rotate the output file (size_mb[,seconds])\n"
                "   -p           disable promiscuous mode\n"
                "   -P file      use custom PID filename when running in daemon mode \n"
                "   -q           suppress non-critical output\n"
                "   -r file      read packets from input file\n"
+               "   -R ring      capture through a mmap ring (block_kb,block_count,timeout_ms)\n"
                "   -s           run in HTTP requests per second mode\n"
-               "   -t seconds   specify the display interval for rate statistics\n"
+               "   -t seconds   specify the display interval for rate statistics and -g\n"
+               "   -T seconds   print parser counters and stage times at this interval\n"
                "   -u user      set process owner\n"
+               "   -w workers   number of capture workers when using -R\n"
+               "   -x batch     number of packets parsed together\n"
+               "   -X rounds    time parsing the input file from memory this many times\n"
+               "   -y snaplen   capture this many bytes of each packet\n"
+               "   -Y           capture only the headers of packets that cannot start a message\n"
+               "   -z           compress the output file\n"
                "   expression   specify a bpf-style capture filter\n\n");
 
         printf("Additional information can be found at:\n"
@@ -676,30 +1706,49 @@ int main(int argc, char **argv) {
         extern int optind;
         int loop_status;
 
+        main_thread = pthread_self();
         signal(SIGHUP, &handle_signal);
         signal(SIGINT, &handle_signal);
 
         /* Process command line arguments */
-        while ((opt = getopt(argc, argv, "b:df:Fhpqi:l:m:n:o:P:r:st:u:S:")) != -1) {
+        while ((opt = getopt(argc, argv, "a:b:Bc:dD:f:Fg:hHpqi:k:l:L:m:M:n:o:O:P:r:R:st:T:u:S:w:x:X:y:Yz")) != -1) {
                 switch (opt) {
+                        case 'a': parse_stream_spec(optarg); break;
                         case 'b': use_dumpfile = optarg; break;
+                        case 'D': parse_flowdump_spec(optarg); break;
+                        case 'B': binary_log = 1; break;
+                        case 'c': parse_pair_spec(optarg); break;
                         case 'd': daemon_mode = 1; use_syslog = 1; break;
                         case 'f': format_str = optarg; break;
                         case 'F': force_flush = 1; break;
+                        case 'g': parse_aggregate_spec(optarg); aggregate = 1; break;
                         case 'h': display_usage(); break;
+                        case 'H': http_prefilter = 1; break;
                         case 'i': interface = optarg; break;
+                        case 'k': parse_topk_spec(optarg); break;
                         case 'l': rate_threshold = atoi(optarg); break;
+                        case 'L': parse_latency_spec(optarg); break;
                         case 'm': methods_str = optarg; break;
+                        case 'M': metrics_spec = optarg; break;
                         case 'n': parse_count = atoi(optarg); break;
                         case 'o': use_outfile = optarg; break;
+                        case 'O': parse_rotate_spec(optarg); break;
                         case 'p': set_promisc = 0; break;
                         case 'P': pid_filename = optarg; break;
                         case 'q': quiet_mode = 1; break;
                         case 'r': use_infile = optarg; break;
+                        case 'R': parse_ring_spec(optarg); break;
                         case 's': rate_stats = 1; break;
                         case 't': rate_interval = atoi(optarg); break;
+                        case 'T': stats_interval = atoi(optarg); time_stages = 1; break;
                         case 'u': new_user = optarg; break;
                         case 'S': eth_skip_bits = atoi(optarg); break;
+                        case 'w': num_workers = atoi(optarg); break;
+                        case 'x': batch_size = atoi(optarg); break;
+                        case 'X': replay_rounds = atoi(optarg); break;
+                        case 'y': snaplen = atoi(optarg); break;
+                        case 'Y': header_snap = 1; break;
+                        case 'z': compress_output = 1; use_logfile = 1; break;
                         default: display_usage();
                 }
         }
@@ -718,6 +1767,46 @@ int main(int argc, char **argv) {
         if (rate_threshold < 1)
                 LOG_DIE("Invalid -l value, must be 1 or greater");
 
+        if (num_workers < 1)
+                LOG_DIE("Invalid -w value, must be 1 or greater");
+
+        if (batch_size == -1)
+                batch_size = (use_ring || replay_rounds) ? DEFAULT_BATCH_SIZE : DEFAULT_PCAP_BATCH_SIZE;
+        if ((batch_size < 1) || (batch_size > MAX_BATCH_SIZE))
+                LOG_DIE("Invalid -x value, must be between 1 and %d", MAX_BATCH_SIZE);
+
+        if ((snaplen < MIN_SNAPLEN) || (snaplen > MAX_SNAPLEN))
+                LOG_DIE("Invalid -y value, must be between %d and %d", MIN_SNAPLEN, MAX_SNAPLEN);
+
+        if (rate_stats && aggregate)
+                LOG_DIE("Rate statistics (-s) and aggregation (-g) cannot be combined");
+
+        if (binary_log && (rate_stats || aggregate))
+                LOG_DIE("Binary log output (-B) cannot be combined with -s or -g");
+
+        if (use_logfile && !use_outfile)
+                LOG_DIE("Compressed (-z) and rotated (-O) output require an output file");
+
+        if (use_logfile && (rate_stats || aggregate))
+                LOG_DIE("Compressed (-z) and rotated (-O) output cannot be combined with -s or -g");
+
+        if (http_prefilter && (use_streams || use_flowdump))
+                LOG_DIE("The HTTP prefilter (-H) cannot be combined with -a or -D");
+
+        if (header_snap && (use_streams || http_prefilter))
+                LOG_DIE("Header-only capture (-Y) cannot be combined with -a or -H");
+
+        if (replay_rounds && (!use_infile || use_ring))
+                LOG_DIE("Replay (-X) requires an input file (-r) and cannot be combined with -R");
+
+        if ((num_workers > 1) && !use_ring)
+                LOG_DIE("Multiple workers require ring capture (-R)");
+
+        if ((num_workers > 1) && use_infile) {
+                WARN("Multiple workers are not supported when reading from a file");
+                num_workers = 1;
+        }
+
         if (argv[optind] && *(argv[optind])) {
                 capfilter = argv[optind];
         } else {
@@ -725,42 +1814,86 @@ int main(int argc, char **argv) {
         }
 
         if (!format_str) format_str = default_format;
-        if (rate_stats) format_str = rate_format;
+        if (rate_stats) {
+                if (!rate_key) rate_key = rate_format;
+                format_str = rate_key;
+        }
+        if (aggregate) format_str = aggregate_format();
         parse_format_string(format_str);
+        resolve_slots();
 
         if (!methods_str) methods_str = default_methods;
         parse_methods_string(methods_str);
+        init_header_scanner(SCAN_AUTO);
 
+        /* Forcing a flush writes every record as soon as it is complete */
         if (force_flush) {
+                flush_records = 1;
                 if (setvbuf(stdout, NULL, _IONBF, 0) != 0)
                         LOG_WARN("Cannot disable buffering on stdout");
         }
 
+        /* Someone watching a terminal sees each record as it comes */
+        if (!flush_records && !use_outfile && !daemon_mode && isatty(fileno(stdout)))
+                flush_records = 1;
+        output_init(flush_interval, flush_records);
+        if (binary_log) output_set_encoder(binlog_encode_block, binlog_block_bound);
+
         if (!pid_filename) pid_filename = PID_FILENAME;
 
+        init_workers();
+
         pcap_hnd = prepare_capture(interface, set_promisc, use_infile, capfilter);
 
         open_outfiles();
 
+        if (metrics_spec) {
+                if (daemon_mode && !isdigit(metrics_spec[0]) && (metrics_spec[0] != '/'))
+                        LOG_WARN("Metrics socket path is not absolute and may be inaccessible after daemonizing");
+                metrics_open(metrics_spec);
+        }
+
         if (daemon_mode) runas_daemon();
         if (new_user) change_user(new_user);
 
-        if ((buf = malloc(BUFSIZ + 1)) == NULL)
-                LOG_DIE("Cannot allocate memory for packet data buffer");
-
         if (rate_stats)
-                init_rate_stats(rate_interval, use_infile, rate_threshold);
+                init_rate_stats(rate_interval, use_infile, rate_threshold, num_workers, topk_size);
+        if (aggregate)
+                init_aggregate_stats(rate_interval, use_infile, num_workers);
 
         start_time = time(0);
-        loop_status = pcap_loop(pcap_hnd, -1, &parse_http_packet, NULL);
-        if (loop_status == -1) {
-                LOG_DIE("Problem reading packets from interface: %s", pcap_geterr(pcap_hnd));
+        output_start_flusher();
+        logfile_start();
+        flowdump_start();
+        start_workers();
+        if (stats_interval) stats_start_reporter(stats_interval, time_stages);
+        metrics_start(&read_capture_counts, use_infile, time_stages);
+        /* A SIGHUP only breaks off the loop long enough to reload */
+        loop_status = capture_packets();
+        while ((loop_status == -2) && reload_pending && !shutdown_signal) {
+                reload();
+                loop_status = capture_packets();
+        }
+        stop_workers();
+
+        /* Log any messages still being reassembled at the end of a file */
+        if (loop_status == 0) stream_flush_all(workers[0].streams);
+
+        if (fatal_error) {
+                /* Already reported by the thread that failed */
+        } else if (loop_status == -1) {
+                LOG_WARN("Problem reading packets from interface: %s", use_ring ? strerror(errno) : pcap_geterr(pcap_hnd));
+        } else if (shutdown_signal) {
+                LOG_PRINT("Caught %s, shutting down...", (shutdown_signal == SIGTERM) ? "SIGTERM" : "SIGINT");
         } else if (loop_status == -2) {
                 PRINT("Loop halted, shutting down...");
         }
 
-        print_stats();
+        if (!fatal_error) print_stats();
         cleanup();
 
+        if (fatal_error) return EXIT_FAILURE;
+        if (shutdown_signal) return shutdown_signal;
+
         return loop_status == -1 ? EXIT_FAILURE : EXIT_SUCCESS;
 }
@@ -0,0 +1,411 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The log writer owns the output file when it is compressed or
+  rotated. Output batches are copied into a queue of large chunks,
+  and a writer thread takes the filled chunks, compresses them with
+  zlib and writes them out, so the capture path only ever pays for a
+  memcpy(). A chunk that is only partly filled is handed over after a
+  second without new output, so quiet periods still reach the disk.
+  Writing only waits on the thread when every chunk is queued.
+
+  Rotation closes the file being written, which always lives at the
+  configured path, and renames it to a name carrying the time it was
+  opened, so a rotated file appears under its final name complete.
+  A file is rotated once it reaches the size limit, once it has been
+  open for the time limit with output in it, or on SIGHUP; without rotation, SIGHUP
+  simply reopens the path to cooperate with external log rotation.
+  Every file opened starts with the output header.
+*/
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <zlib.h>
+#include "config.h"
+#include "error.h"
+#include "logfile.h"
+
+#define QUEUE_CHUNKS 32
+#define CHUNK_SIZE 262144
+#define GZ_BUFSIZE 131072
+#define IDLE_FLUSH 1               /* Seconds before a partial chunk is written */
+
+struct chunk {
+        char *data;
+        size_t len;
+        int split;                /* Output continues in the next chunk */
+};
+
+void hand_over();
+void *run_writer(void *args);
+void write_chunks(unsigned int first, unsigned int count);
+void check_rotation();
+void open_file();
+void close_file();
+void rotate_file();
+void rotated_name(char *dst, size_t size);
+
+static struct chunk queue[QUEUE_CHUNKS];
+static unsigned int queue_head = 0;      /* Oldest chunk handed to the writer */
+static unsigned int queue_count = 0;     /* Chunks handed to the writer */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_ready = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t queue_free = PTHREAD_COND_INITIALIZER;
+
+static pthread_t thread;
+static int thread_created = 0;
+static int stopping = 0;
+static volatile sig_atomic_t reopen_requested = 0;
+
+static char *path = NULL;
+static char mode[8];
+static unsigned long rotate_bytes = 0;
+static unsigned int rotate_secs = 0;
+static char *header = NULL;
+static size_t header_len = 0;
+static gzFile file = NULL;
+static time_t file_opened = 0;
+static int mid_batch = 0;                /* Last chunk written was split */
+static int file_written = 0;             /* Output written since the file was opened */
+
+/* Open the output file at out_path; each file opened is started with
+   the given header. A nonzero rotate_size (bytes) or rotate_interval
+   (seconds) rotates the file when reached. */
+void logfile_open(char *out_path, int compress, unsigned long rotate_size, unsigned int rotate_interval,
+                  const char *hdr, size_t hdr_len) {
+        int i;
+
+#ifdef DEBUG
+        ASSERT(out_path);
+#endif
+
+        path = out_path;
+        rotate_bytes = rotate_size;
+        rotate_secs = rotate_interval;
+
+        /* Without compression the file is written through as is */
+        if (compress)
+                snprintf(mode, sizeof(mode), "ab%d", LOG_COMPRESS_LEVEL);
+        else
+                snprintf(mode, sizeof(mode), "abT");
+
+        if ((header = (char *) malloc(hdr_len + 1)) == NULL)
+                LOG_DIE("Cannot allocate memory for output file header");
+        memcpy(header, hdr, hdr_len);
+        header_len = hdr_len;
+
+        for (i = 0; i < QUEUE_CHUNKS; i++) {
+                if ((queue[i].data = (char *) malloc(CHUNK_SIZE)) == NULL)
+                        LOG_DIE("Cannot allocate memory for output queue");
+                queue[i].len = 0;
+                queue[i].split = 0;
+        }
+
+        open_file();
+        if (!file)
+                LOG_DIE("Cannot open output file '%s'", path);
+
+        return;
+}
+
+/* Queue output for the writer thread; before the thread is started,
+   and after it is stopped, output is written straight through */
+void logfile_write(const struct iovec *iov, int iovcnt) {
+        struct chunk *c;
+        const char *data;
+        size_t len, n;
+        int i;
+
+        if (!thread_created) {
+                for (i = 0; (i < iovcnt) && file; i++)
+                        gzwrite(file, iov[i].iov_base, iov[i].iov_len);
+                return;
+        }
+
+        pthread_mutex_lock(&queue_lock);
+
+        for (i = 0; i < iovcnt; i++) {
+                data = (const char *) iov[i].iov_base;
+                len = iov[i].iov_len;
+
+                while (len > 0) {
+                        c = &queue[(queue_head + queue_count) % QUEUE_CHUNKS];
+
+                        /* Batches are only split when larger than a
+                           chunk, so files rotate between whole records */
+                        if ((c->len > 0) && (c->len + len > CHUNK_SIZE)) {
+                                hand_over();
+                                continue;
+                        }
+
+                        n = CHUNK_SIZE - c->len;
+                        if (n > len) n = len;
+                        memcpy(c->data + c->len, data, n);
+                        c->len += n;
+                        data += n;
+                        len -= n;
+
+                        if (c->len < CHUNK_SIZE) break;
+
+                        c->split = (len > 0);
+                        hand_over();
+                }
+        }
+
+        pthread_mutex_unlock(&queue_lock);
+
+        return;
+}
+
+/* Hand the chunk being filled to the writer thread; one chunk is
+   always kept back as the chunk being filled. The caller must hold
+   the queue lock. */
+void hand_over() {
+        while (queue_count == QUEUE_CHUNKS - 1)
+                pthread_cond_wait(&queue_free, &queue_lock);
+
+        queue_count++;
+        pthread_cond_signal(&queue_ready);
+
+        return;
+}
+
+/* Ask the writer thread to rotate the file, or reopen it if rotation
+   is not enabled; safe to call from a signal handler */
+void logfile_reopen() {
+        reopen_requested = 1;
+
+        return;
+}
+
+/* Spawn the writer thread */
+void logfile_start() {
+        sigset_t set;
+        int s;
+
+        if (thread_created || !file) return;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Log writer thread signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_writer, NULL);
+        if (s != 0)
+                LOG_DIE("Log writer thread creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Log writer thread signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Write out everything queued, stop the writer thread and close the
+   file; the file being written is left at its path */
+void logfile_close() {
+        int s, i;
+
+        if (thread_created) {
+                pthread_mutex_lock(&queue_lock);
+                stopping = 1;
+                pthread_cond_signal(&queue_ready);
+                pthread_mutex_unlock(&queue_lock);
+
+                s = pthread_join(thread, NULL);
+                if (s != 0)
+                        LOG_WARN("Log writer thread join failed with error %d", s);
+
+                thread_created = 0;
+        }
+
+        close_file();
+
+        for (i = 0; i < QUEUE_CHUNKS; i++) {
+                free(queue[i].data);
+                queue[i].data = NULL;
+        }
+        free(header);
+        header = NULL;
+
+        return;
+}
+
+/* This is our writer thread; it writes each chunk as it is handed
+   over, and any partial chunk once output has been idle a while */
+void *run_writer(void *args) {
+        struct timespec ts;
+        unsigned int first, count;
+        struct chunk *fill;
+        int done;
+
+        pthread_mutex_lock(&queue_lock);
+
+        while (1) {
+                clock_gettime(CLOCK_REALTIME, &ts);
+                ts.tv_sec += IDLE_FLUSH;
+
+                while ((queue_count == 0) && !stopping && !reopen_requested) {
+                        if (pthread_cond_timedwait(&queue_ready, &queue_lock, &ts) == ETIMEDOUT)
+                                break;
+                }
+
+                /* Take the partial chunk if nothing else is waiting */
+                fill = &queue[(queue_head + queue_count) % QUEUE_CHUNKS];
+                if ((fill->len > 0) && (queue_count == 0)) queue_count++;
+
+                first = queue_head;
+                count = queue_count;
+                done = stopping;
+                pthread_mutex_unlock(&queue_lock);
+
+                write_chunks(first, count);
+                check_rotation();
+
+                pthread_mutex_lock(&queue_lock);
+                queue_head = (queue_head + count) % QUEUE_CHUNKS;
+                queue_count -= count;
+                pthread_cond_broadcast(&queue_free);
+
+                /* Stop once a final pass finds nothing left */
+                if (done && (count == 0)) break;
+        }
+
+        pthread_mutex_unlock(&queue_lock);
+
+        return (void *) 0;
+}
+
+/* Write a run of queued chunks; the chunks are not touched by the
+   capture side until they are handed back */
+void write_chunks(unsigned int first, unsigned int count) {
+        struct chunk *c;
+        int err;
+
+        while (count--) {
+                c = &queue[first];
+                first = (first + 1) % QUEUE_CHUNKS;
+
+                if (file && (gzwrite(file, c->data, c->len) != (int) c->len))
+                        LOG_WARN("Cannot write output records: %s", gzerror(file, &err));
+
+                if (c->len) file_written = 1;
+                mid_batch = c->split;
+                c->len = 0;
+                c->split = 0;
+
+                check_rotation();
+        }
+
+        return;
+}
+
+/* Reopen or rotate the file if asked to or a limit has been reached;
+   waits while the last chunk written ends partway through a batch */
+void check_rotation() {
+        if (mid_batch) return;
+
+        if (reopen_requested) {
+                reopen_requested = 0;
+                if (rotate_bytes || rotate_secs) {
+                        rotate_file();
+                } else {
+                        close_file();
+                        open_file();
+                }
+        } else if (file && ((rotate_bytes && ((unsigned long) gzoffset(file) >= rotate_bytes)) ||
+                            (rotate_secs && file_written && (time(0) - file_opened >= rotate_secs)))) {
+                rotate_file();
+        }
+
+        return;
+}
+
+/* Open the file at the output path and write the header; on failure
+   output is dropped until the next reopen or rotation */
+void open_file() {
+        if ((file = gzopen(path, mode)) == NULL) {
+                LOG_WARN("Cannot open output file '%s': %s", path, strerror(errno));
+                return;
+        }
+
+        gzbuffer(file, GZ_BUFSIZE);
+        file_opened = time(0);
+        file_written = 0;
+
+        if (header_len && (gzwrite(file, header, header_len) != (int) header_len))
+                LOG_WARN("Cannot write output file header to '%s'", path);
+
+        return;
+}
+
+void close_file() {
+        if (!file) return;
+
+        if (gzclose(file) != Z_OK)
+                LOG_WARN("Cannot close output file '%s'", path);
+        file = NULL;
+
+        return;
+}
+
+/* Close the current file, move it to its rotated name and start a
+   new one at the output path */
+void rotate_file() {
+        char name[PATH_MAX];
+
+        if (file) {
+                rotated_name(name, sizeof(name));
+                close_file();
+
+                if (rename(path, name) == -1)
+                        LOG_WARN("Cannot rename output file '%s' to '%s': %s", path, name, strerror(errno));
+        }
+
+        open_file();
+
+        return;
+}
+
+/* Build the rotated file name: the output path with the time the file
+   was opened added, ahead of any .gz suffix, and a sequence number if
+   that name is already taken */
+void rotated_name(char *dst, size_t size) {
+        char stamp[MAX_TIME_LEN];
+        struct stat st;
+        size_t len = strlen(path);
+        int gz, n;
+
+        strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&file_opened));
+        gz = (len > 3) && (strcmp(path + len - 3, ".gz") == 0);
+
+        snprintf(dst, size, "%.*s.%s%s", (int) (gz ? len - 3 : len), path, stamp, gz ? ".gz" : "");
+        for (n = 1; stat(dst, &st) == 0; n++)
+                snprintf(dst, size, "%.*s.%s.%d%s", (int) (gz ? len - 3 : len), path, stamp, n, gz ? ".gz" : "");
+
+        return;
+}
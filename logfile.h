@@ -0,0 +1,25 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_LOGFILE_H
+#define _HAVE_LOGFILE_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+void logfile_open(char *out_path, int compress, unsigned long rotate_size, unsigned int rotate_interval,
+                  const char *hdr, size_t hdr_len);
+void logfile_write(const struct iovec *iov, int iovcnt);
+void logfile_reopen();
+void logfile_start();
+void logfile_close();
+
+#endif /* ! _HAVE_LOGFILE_H */
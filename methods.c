@@ -10,19 +10,22 @@
 */
 
 /*
-  The methods data structure is an unbalanced binary tree. All
-  packets are checked to see if they have a method contained
-  here; any packets that do not will be ignored.
-
-  This doesn't use a hash because the length of the potential
-  method is not known. At this point in the main processing
-  loop the packet data is still in a static buffer, so this
-  gives us a simpler solution. Perhaps at some point the flow
-  of the packet processing will be changed and we can switch
-  to a more traditional lookup table approach.
+  Methods are kept in an array grouped by their first character,
+  with a 256 entry table giving the group for each possible first
+  byte of a payload in either case. Most payloads that are not HTTP
+  requests are rejected by that single lookup.
+
+  Within a group, each method is stored as a lowercased 8 byte word
+  and a mask covering its length. The first 8 bytes of the payload
+  are loaded as a word, lowercased a byte at a time in parallel, and
+  compared against each candidate with one AND and one compare. The
+  rare method longer than 8 bytes has its remainder compared byte by
+  byte. A payload matches if it starts with any of the methods,
+  ignoring case.
 */
 
 #include <ctype.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdio.h>
@@ -30,21 +33,30 @@
 #include "methods.h"
 #include "utility.h"
 
+#define ONES  0x0101010101010101ULL
+#define HIGHS 0x8080808080808080ULL
+
 typedef struct method_node METHOD_NODE;
 struct method_node {
         char *method;
-        METHOD_NODE *left, *right;
+        size_t len;
+        uint64_t word;            /* First 8 bytes, lowercased */
+        uint64_t mask;            /* Covers the first len bytes of word */
 };
 
 static METHOD_NODE *methods = NULL;
+static int num_methods = 0;
+static unsigned short group_start[256];
+static unsigned short group_count[256];
 
 int insert_method(char *str, size_t len);
-void free_node(METHOD_NODE *node);
+void build_groups();
+int compare_methods(const void *a, const void *b);
+uint64_t load_word(const char *str, size_t len);
 
 /* Parse and insert methods from methods string */
 void parse_methods_string(char *str) {
         char *method, *tmp, *i;
-        int num_methods = 0;
         size_t len;
 
 #ifdef DEBUG
@@ -64,7 +76,7 @@ void parse_methods_string(char *str) {
                 len = strlen(method);
 
                 if (len == 0) continue;
-                if (insert_method(method, len)) num_methods++;
+                insert_method(method, len);
         }
 
         free(tmp);
@@ -72,88 +84,151 @@ void parse_methods_string(char *str) {
         if (num_methods == 0)
                 LOG_DIE("No valid methods found in string");
 
+        build_groups();
+
         return;
 }
 
 /* Insert a new method into the structure */
 int insert_method(char *method, size_t len) {
-        METHOD_NODE **node = &methods;
-        int cmp;
+        METHOD_NODE *node;
+        unsigned char mask[8];
+        int i;
 
 #ifdef DEBUG
         ASSERT(method);
         ASSERT(strlen(method) > 0);
 #endif
 
-        while (*node) {
-                cmp = str_compare(method, (*node)->method);
-                if (cmp > 0) {
-                        node = &(*node)->right;
-                } else if (cmp < 0) {
-                        node = &(*node)->left;
-                } else {
+        for (i = 0; i < num_methods; i++) {
+                if (strcmp(method, methods[i].method) == 0) {
                         WARN("Method '%s' already provided", method);
 
                         return 0;
                 }
         }
 
-        if ((*node = (METHOD_NODE *) malloc(sizeof(METHOD_NODE))) == NULL) {
+        if ((node = (METHOD_NODE *) realloc(methods, (num_methods + 1) * sizeof(METHOD_NODE))) == NULL)
                 LOG_DIE("Cannot allocate memory for method node");
-        }
+        methods = node;
+        node = &methods[num_methods];
 
-        if (((*node)->method = (char *) malloc(len + 1)) == NULL) {
+        if ((node->method = (char *) malloc(len + 1)) == NULL)
                 LOG_DIE("Cannot allocate memory for method string");
-        }
-        str_copy((*node)->method, method, len + 1);
+        str_copy(node->method, method, len + 1);
+
+        memset(mask, 0, sizeof(mask));
+        memset(mask, 0xff, (len < 8) ? len : 8);
 
-        (*node)->left = (*node)->right = NULL;
+        node->len = len;
+        node->word = load_word(method, len);
+        memcpy(&node->mask, mask, sizeof(mask));
+
+        num_methods++;
 
         return 1;
 }
 
-/* Search data structure for a matching method */
-int is_request_method(const char *str) {
-        METHOD_NODE *node = methods;
-        int cmp;
+/* Sort the methods by first character and index each group by both
+   cases of that character */
+void build_groups() {
+        int i, c;
+
+        qsort(methods, num_methods, sizeof(METHOD_NODE), compare_methods);
+
+        memset(group_start, 0, sizeof(group_start));
+        memset(group_count, 0, sizeof(group_count));
+
+        for (i = num_methods - 1; i >= 0; i--) {
+                c = (unsigned char) methods[i].method[0];
+
+                group_start[c] = i;
+                group_count[c]++;
+        }
+
+        for (c = 'a'; c <= 'z'; c++) {
+                group_start[toupper(c)] = group_start[c];
+                group_count[toupper(c)] = group_count[c];
+        }
+
+        return;
+}
+
+int compare_methods(const void *a, const void *b) {
+        return (unsigned char) ((METHOD_NODE *) a)->method[0] -
+               (unsigned char) ((METHOD_NODE *) b)->method[0];
+}
+
+/* Load up to the first 8 bytes of a string into a word, zero padded,
+   converting any uppercase ASCII letters to lowercase */
+uint64_t load_word(const char *str, size_t len) {
+        uint64_t word = 0, low, ge_a, gt_z;
+
+        memcpy(&word, str, (len < 8) ? len : 8);
+
+        /* The high bit of each byte in ge_a/gt_z is set if the byte is
+           at least 'A'/greater than 'Z'; only ASCII bytes are changed */
+        low = word & ~HIGHS;
+        ge_a = low + ONES * (0x80 - 'A');
+        gt_z = low + ONES * (0x7f - 'Z');
+
+        return word | (((ge_a ^ gt_z) & ~word & HIGHS) >> 2);
+}
+
+/* Check if the first len bytes of str start with a known method */
+int is_request_method(const char *str, size_t len) {
+        METHOD_NODE *node, *end;
+        uint64_t word;
+        size_t i;
+        unsigned char c;
 
 #ifdef DEBUG
-        ASSERT(node);
+        ASSERT(methods);
         ASSERT(str);
 #endif
 
-        if (strlen(str) == 0) return 0;
+        if (len == 0) return 0;
+
+        c = (unsigned char) *str;
+        if (group_count[c] == 0) return 0;
+
+        word = load_word(str, len);
+        node = &methods[group_start[c]];
+        end = node + group_count[c];
+
+        for (; node < end; node++) {
+                if ((len < node->len) || ((word & node->mask) != node->word))
+                        continue;
 
-        while (node) {
-                cmp = str_compare(str, node->method);
-                if (cmp > 0) {
-                        node = node->right;
-                } else if (cmp < 0) {
-                        node = node->left;
-                } else {
-                        return 1;
+                for (i = 8; i < node->len; i++) {
+                        if (tolower((unsigned char) str[i]) != node->method[i]) break;
                 }
+                if (i >= node->len) return 1;
         }
 
         return 0;
 }
 
-/* Wrapper function to free allocated memory at program termination */
-void free_methods() {
-        free_node(methods);
+/* Return the ith method, lowercased, and its length; NULL once past
+   the last one */
+const char *method_name(int i, size_t *len) {
+        if ((i < 0) || (i >= num_methods)) return NULL;
 
-        return;
+        if (len) *len = methods[i].len;
+
+        return methods[i].method;
 }
 
-/* Recursively free all children of the parameter node */
-void free_node(METHOD_NODE *node) {
-        if (!node) return;
+/* Free allocated memory at program termination */
+void free_methods() {
+        int i;
 
-        free_node(node->left);
-        free_node(node->right);
+        for (i = 0; i < num_methods; i++)
+                free(methods[i].method);
+        free(methods);
 
-        free(node->method);
-        free(node);
+        methods = NULL;
+        num_methods = 0;
 
         return;
 }
@@ -12,8 +12,11 @@
 #ifndef _HAVE_METHODS_H
 #define _HAVE_METHODS_H
 
+#include <sys/types.h>
+
 void parse_methods_string(char *str);
-int is_request_method(const char *str);
+int is_request_method(const char *str, size_t len);
+const char *method_name(int i, size_t *len);
 void free_methods();
 
 #endif /* ! _HAVE_METHODS_H */
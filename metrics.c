@@ -0,0 +1,486 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The metrics listener serves the running counts in the Prometheus
+  text exposition format, on a Unix domain socket or a TCP port bound
+  to the loopback address. It runs in a thread of its own, taking one
+  client at a time, and only reads counters the capture path already
+  keeps: the parser counters are summed with relaxed loads, worker
+  table counts are copied as print_stats() does, and the host rates
+  are taken under the report lock, which capture threads never touch.
+
+  A client that sends an HTTP GET or HEAD request gets an HTTP reply,
+  so the socket can be scraped directly; anything else, including a
+  client that sends nothing, gets the bare exposition text. Clients
+  are given METRICS_TIMEOUT ms to send a request and to read the
+  reply, so a stalled one cannot hold up the next scrape for long.
+*/
+
+#include <ctype.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include "config.h"
+#include "error.h"
+#include "metrics.h"
+#include "rate.h"
+#include "stats.h"
+
+#define REQUEST_SIZE 1024
+#define CONTENT_TYPE "text/plain; version=0.0.4"
+
+struct metrics_buf {
+        char *data;
+        size_t len;
+        size_t size;
+};
+
+void create_metrics_thread();
+void *run_metrics(void *args);
+void serve_client(int fd);
+int read_request(int fd, char *req, size_t size);
+int send_all(int fd, const char *data, size_t len);
+void format_metrics(struct metrics_buf *buf);
+void format_rate_metrics(struct metrics_buf *buf);
+void metric_header(struct metrics_buf *buf, const char *name, const char *type, const char *help);
+void append_label(struct metrics_buf *buf, const char *value);
+void append(struct metrics_buf *buf, const char *fmt, ...);
+
+static int listen_fd = -1;
+static char *socket_path = NULL;
+static pthread_t thread;
+static int thread_created = 0;
+static capture_reader read_counts = NULL;
+static char *infile = NULL;
+static int stages_timed = 0;
+static time_t start_time = 0;
+
+/* Open the listening socket given by spec: a bare port number is
+   bound on the loopback address, anything else is taken as the path
+   of a Unix domain socket */
+void metrics_open(char *spec) {
+        struct sockaddr_un sun;
+        struct sockaddr_in sin;
+        struct stat st;
+        char *p;
+        int port, on = 1;
+
+#ifdef DEBUG
+        ASSERT(spec);
+#endif
+
+        for (p = spec; isdigit(*p); p++);
+
+        if ((*spec != '\0') && (*p == '\0')) {
+                port = atoi(spec);
+                if ((port < 1) || (port > 65535))
+                        LOG_DIE("Invalid -M port, must be between 1 and 65535");
+
+                if ((listen_fd = socket(AF_INET, SOCK_STREAM, 0)) == -1)
+                        LOG_DIE("Cannot create metrics socket: %s", strerror(errno));
+                setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+                memset(&sin, 0, sizeof(sin));
+                sin.sin_family = AF_INET;
+                sin.sin_port = htons(port);
+                sin.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+                if (bind(listen_fd, (struct sockaddr *) &sin, sizeof(sin)) == -1)
+                        LOG_DIE("Cannot bind metrics socket to port %d: %s", port, strerror(errno));
+        } else {
+                if (strlen(spec) >= sizeof(sun.sun_path))
+                        LOG_DIE("Metrics socket path '%s' is too long", spec);
+
+                /* Clear out a socket left behind by an earlier run, but
+                   nothing else */
+                if ((lstat(spec, &st) == 0) && S_ISSOCK(st.st_mode))
+                        unlink(spec);
+
+                if ((listen_fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1)
+                        LOG_DIE("Cannot create metrics socket: %s", strerror(errno));
+
+                memset(&sun, 0, sizeof(sun));
+                sun.sun_family = AF_UNIX;
+                strcpy(sun.sun_path, spec);
+
+                if (bind(listen_fd, (struct sockaddr *) &sun, sizeof(sun)) == -1)
+                        LOG_DIE("Cannot bind metrics socket '%s': %s", spec, strerror(errno));
+                socket_path = spec;
+        }
+
+        if (listen(listen_fd, 8) == -1)
+                LOG_DIE("Cannot listen on metrics socket: %s", strerror(errno));
+
+        PRINT("Serving metrics on %s%s", socket_path ? "" : "127.0.0.1:", spec);
+
+        return;
+}
+
+/* Start answering clients on the socket opened by metrics_open(),
+   reading the capture counts through reader; stage times are only
+   reported if timed is set */
+void metrics_start(capture_reader reader, char *use_infile, int timed) {
+        if ((listen_fd == -1) || thread_created) return;
+
+        read_counts = reader;
+        infile = use_infile;
+        stages_timed = timed;
+        start_time = time(NULL);
+        create_metrics_thread();
+
+        return;
+}
+
+/* Spawn the listener thread, keeping signals for the main thread */
+void create_metrics_thread() {
+        sigset_t set;
+        int s;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Metrics thread signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_metrics, NULL);
+        if (s != 0)
+                LOG_DIE("Metrics thread creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Metrics thread signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Cancel the listener thread, if running, and close the socket */
+void metrics_stop() {
+        int s;
+
+        if (thread_created) {
+                s = pthread_cancel(thread);
+                if (s != 0)
+                        LOG_WARN("Metrics thread cancellation failed with error %d", s);
+
+                s = pthread_join(thread, NULL);
+                if (s != 0)
+                        LOG_WARN("Metrics thread join failed with error %d", s);
+
+                thread_created = 0;
+        }
+
+        if (listen_fd != -1) {
+                close(listen_fd);
+                listen_fd = -1;
+        }
+
+        /* Note that this won't get removed if we've switched to a
+           user that doesn't have permission to delete the file */
+        if (socket_path) {
+                unlink(socket_path);
+                socket_path = NULL;
+        }
+
+        return;
+}
+
+/* This is the listener thread */
+void *run_metrics(void *args) {
+        int fd, state, failing = 0;
+
+        while (1) {
+                if ((fd = accept(listen_fd, NULL, NULL)) == -1) {
+                        if ((errno == EINTR) || (errno == ECONNABORTED)) continue;
+
+                        /* The client stays queued, so retrying at once
+                           would only spin; warn once and wait for the
+                           process to free some descriptors or memory */
+                        if (!failing)
+                                LOG_WARN("Cannot accept metrics client: %s", strerror(errno));
+                        failing = 1;
+                        sleep(1);
+                        continue;
+                }
+
+                if (failing)
+                        LOG_PRINT("Accepting metrics clients again");
+                failing = 0;
+
+                /* Don't get cancelled while holding the report lock */
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+                serve_client(fd);
+                close(fd);
+                pthread_setcancelstate(state, NULL);
+        }
+
+        return (void *) 0;
+}
+
+/* Answer a single client with the current metrics */
+void serve_client(int fd) {
+        struct metrics_buf buf;
+        struct timeval tv;
+        char req[REQUEST_SIZE], header[128];
+        int http = 0, head = 0, len;
+
+        tv.tv_sec = METRICS_TIMEOUT / 1000;
+        tv.tv_usec = (METRICS_TIMEOUT % 1000) * 1000;
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+
+        if (read_request(fd, req, sizeof(req)) > 0) {
+                if (strncmp(req, "GET ", 4) == 0) {
+                        http = 1;
+                } else if (strncmp(req, "HEAD ", 5) == 0) {
+                        http = 1;
+                        head = 1;
+                }
+        }
+
+        memset(&buf, 0, sizeof(buf));
+        format_metrics(&buf);
+        if (!buf.data) return;
+
+        if (http) {
+                len = snprintf(header, sizeof(header), "HTTP/1.0 200 OK\r\nContent-Type: %s\r\n"
+                               "Content-Length: %zu\r\nConnection: close\r\n\r\n", CONTENT_TYPE, buf.len);
+                if (send_all(fd, header, len) != 0) head = 1;
+        }
+
+        if (!head) send_all(fd, buf.data, buf.len);
+
+        free(buf.data);
+
+        return;
+}
+
+/* Read a request into req until the end of its headers, the buffer
+   fills, the client stops sending or the timeout passes; returns the
+   number of bytes read */
+int read_request(int fd, char *req, size_t size) {
+        struct pollfd pfd;
+        ssize_t n;
+        size_t len = 0;
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+
+        while (len < size - 1) {
+                if (poll(&pfd, 1, METRICS_TIMEOUT) <= 0) break;
+
+                if ((n = recv(fd, req + len, size - 1 - len, 0)) <= 0) break;
+                len += n;
+                req[len] = '\0';
+
+                if (strstr(req, "\r\n\r\n") || strstr(req, "\n\n")) break;
+        }
+        req[len] = '\0';
+
+        return len;
+}
+
+/* Write all of data to the client; returns 0 on success */
+int send_all(int fd, const char *data, size_t len) {
+        ssize_t n;
+
+        while (len > 0) {
+                if ((n = send(fd, data, len, MSG_NOSIGNAL)) == -1) {
+                        if (errno == EINTR) continue;
+                        return -1;
+                }
+
+                data += n;
+                len -= n;
+        }
+
+        return 0;
+}
+
+/* Format every metric into buf */
+void format_metrics(struct metrics_buf *buf) {
+        struct capture_counts counts;
+        PARSE_STATS total;
+        double ns_per_cycle;
+        int i;
+
+        memset(&counts, 0, sizeof(counts));
+        if (read_counts) read_counts(&counts);
+        stats_sum(&total);
+
+        metric_header(buf, "httpry_start_time_seconds", "gauge", "Time capture started, in seconds since the epoch");
+        append(buf, "httpry_start_time_seconds %lu\n", (unsigned long) start_time);
+
+        if (counts.live) {
+                metric_header(buf, "httpry_capture_packets_received_total", "counter", "Packets received by the capture source");
+                append(buf, "httpry_capture_packets_received_total %u\n", counts.received);
+                metric_header(buf, "httpry_capture_packets_dropped_total", "counter", "Packets dropped by the capture source");
+                append(buf, "httpry_capture_packets_dropped_total %u\n", counts.dropped);
+        }
+
+        metric_header(buf, "httpry_packets_total", "counter", "Packets handed to the parser");
+        append(buf, "httpry_packets_total %llu\n", total.packets);
+        metric_header(buf, "httpry_packet_bytes_total", "counter", "Captured bytes of the packets handed to the parser");
+        append(buf, "httpry_packet_bytes_total %llu\n", total.bytes);
+        metric_header(buf, "httpry_scanned_bytes_total", "counter", "Payload bytes scanned for headers");
+        append(buf, "httpry_scanned_bytes_total %llu\n", total.scanned);
+        metric_header(buf, "httpry_records_total", "counter", "Messages logged");
+        append(buf, "httpry_records_total %llu\n", total.records);
+        metric_header(buf, "httpry_output_bytes_total", "counter", "Output bytes written for the messages logged");
+        append(buf, "httpry_output_bytes_total %llu\n", total.out_bytes);
+
+        metric_header(buf, "httpry_packets_rejected_total", "counter", "Packets rejected by the parser, by reason");
+        for (i = 0; i < NUM_REJECTS; i++)
+                append(buf, "httpry_packets_rejected_total{reason=\"%s\"} %llu\n",
+                       stats_reject_name(i + 1), total.rejected[i]);
+
+        if (stages_timed) {
+                ns_per_cycle = stats_ns_per_cycle();
+                metric_header(buf, "httpry_stage_seconds_total", "counter", "Time spent in each parser stage");
+                for (i = 0; i < NUM_STAGES; i++)
+                        append(buf, "httpry_stage_seconds_total{stage=\"%s\"} %0.6f\n",
+                               stats_stage_name(i), total.stage_cycles[i] * ns_per_cycle / 1e9);
+        }
+
+        if (counts.use_streams) {
+                metric_header(buf, "httpry_streams_buffered_total", "counter", "Split messages buffered for reassembly");
+                append(buf, "httpry_streams_buffered_total %u\n", counts.streams.started);
+                metric_header(buf, "httpry_streams_ended_total", "counter", "Split messages no longer buffered, by reason");
+                append(buf, "httpry_streams_ended_total{reason=\"completed\"} %u\n", counts.streams.completed);
+                append(buf, "httpry_streams_ended_total{reason=\"capped\"} %u\n", counts.streams.capped);
+                append(buf, "httpry_streams_ended_total{reason=\"expired\"} %u\n", counts.streams.expired);
+                append(buf, "httpry_streams_ended_total{reason=\"evicted\"} %u\n", counts.streams.evicted);
+        }
+
+        if (counts.use_pairs) {
+                metric_header(buf, "httpry_pair_requests_total", "counter", "Requests queued for pairing");
+                append(buf, "httpry_pair_requests_total %u\n", counts.pairs.queued);
+                metric_header(buf, "httpry_pair_requests_ended_total", "counter", "Queued requests no longer waiting, by reason");
+                append(buf, "httpry_pair_requests_ended_total{reason=\"matched\"} %u\n", counts.pairs.matched);
+                append(buf, "httpry_pair_requests_ended_total{reason=\"expired\"} %u\n", counts.pairs.expired);
+                metric_header(buf, "httpry_pair_requests_dropped_total", "counter", "Requests not queued for lack of room");
+                append(buf, "httpry_pair_requests_dropped_total %u\n", counts.pairs.dropped);
+                metric_header(buf, "httpry_pair_unmatched_responses_total", "counter", "Responses without a queued request");
+                append(buf, "httpry_pair_unmatched_responses_total %u\n", counts.pairs.unmatched);
+        }
+
+        if (counts.use_flowdump) {
+                metric_header(buf, "httpry_flowdump_flows_total", "counter", "Flows written to the flow dump");
+                append(buf, "httpry_flowdump_flows_total %u\n", counts.dumps.matched);
+                metric_header(buf, "httpry_flowdump_packets_total", "counter", "Packets written to the flow dump");
+                append(buf, "httpry_flowdump_packets_total %u\n", counts.dumps.packets);
+                metric_header(buf, "httpry_flowdump_bytes_total", "counter", "Packet bytes written to the flow dump");
+                append(buf, "httpry_flowdump_bytes_total %lu\n", counts.dumps.bytes);
+                metric_header(buf, "httpry_flowdump_flows_ended_total", "counter", "Dumped flows no longer written, by reason");
+                append(buf, "httpry_flowdump_flows_ended_total{reason=\"capped\"} %u\n", counts.dumps.capped);
+                append(buf, "httpry_flowdump_flows_ended_total{reason=\"evicted\"} %u\n", counts.dumps.evicted);
+        }
+
+        if (counts.rate_stats) format_rate_metrics(buf);
+
+        return;
+}
+
+/* Format the host hash usage and the heaviest hosts of rate mode */
+void format_rate_metrics(struct metrics_buf *buf) {
+        struct rate_pool_stats pool;
+        TOPK_ENTRY top[METRICS_TOP_HOSTS];
+        unsigned int num, i;
+
+        rate_pool_stats(&pool);
+
+        metric_header(buf, "httpry_rate_hosts", "gauge", "Hosts in the rate statistics hash");
+        append(buf, "httpry_rate_hosts %u\n", pool.hosts);
+        metric_header(buf, "httpry_rate_host_nodes", "gauge", "Host nodes allocated for the rate statistics hash");
+        append(buf, "httpry_rate_host_nodes %u\n", pool.nodes);
+        metric_header(buf, "httpry_rate_hash_slots", "gauge", "Slots in the rate statistics hash");
+        append(buf, "httpry_rate_hash_slots %u\n", pool.slots);
+        metric_header(buf, "httpry_rate_name_chunks", "gauge", "Chunks allocated for host names");
+        append(buf, "httpry_rate_name_chunks %u\n", pool.arena_chunks);
+        metric_header(buf, "httpry_rate_hosts_missed_total", "counter", "Requests not counted against a host for lack of room");
+        append(buf, "httpry_rate_hosts_missed_total %u\n", pool.missed);
+
+        num = rate_top_hosts(infile, top, METRICS_TOP_HOSTS);
+
+        metric_header(buf, "httpry_rate_top_host_requests", "gauge",
+                      "Requests from the heaviest hosts over the last minute, or since the last reset with -k");
+        for (i = 0; i < num; i++) {
+                append(buf, "httpry_rate_top_host_requests{host=\"");
+                append_label(buf, top[i].key);
+                append(buf, "\"} %u\n", top[i].count);
+        }
+
+        return;
+}
+
+/* Write the help and type lines of a metric */
+void metric_header(struct metrics_buf *buf, const char *name, const char *type, const char *help) {
+        append(buf, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+
+        return;
+}
+
+/* Write a label value, escaping the characters the format reserves */
+void append_label(struct metrics_buf *buf, const char *value) {
+        const char *p;
+
+        for (p = value; *p; p++) {
+                switch (*p) {
+                        case '\\': append(buf, "\\\\"); break;
+                        case '"':  append(buf, "\\\""); break;
+                        case '\n': append(buf, "\\n"); break;
+                        default:   append(buf, "%c", *p); break;
+                }
+        }
+
+        return;
+}
+
+/* Append formatted text to buf, growing it as necessary */
+void append(struct metrics_buf *buf, const char *fmt, ...) {
+        va_list ap;
+        char *tmp;
+        int n;
+
+        while (1) {
+                va_start(ap, fmt);
+                n = vsnprintf(buf->data + buf->len, buf->size - buf->len, fmt, ap);
+                va_end(ap);
+
+                if (n < 0) return;
+                if (buf->len + n < buf->size) break;
+
+                if ((tmp = realloc(buf->data, buf->size + n + BUFSIZ)) == NULL)
+                        LOG_DIE("Cannot allocate memory for metrics");
+                buf->data = tmp;
+                buf->size += n + BUFSIZ;
+        }
+
+        buf->len += n;
+
+        return;
+}
@@ -0,0 +1,39 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_METRICS_H
+#define _HAVE_METRICS_H
+
+#include "flowdump.h"
+#include "pair.h"
+#include "stream.h"
+
+/* Capture and worker table counts, filled in by the main program */
+struct capture_counts {
+        int live;                 /* Set if received/dropped are valid */
+        unsigned int received;
+        unsigned int dropped;
+        int use_streams;
+        int use_pairs;
+        int use_flowdump;
+        int rate_stats;           /* Set if host rates are kept */
+        struct stream_stats streams;
+        struct pair_stats pairs;
+        struct flowdump_stats dumps;
+};
+
+typedef void (*capture_reader)(struct capture_counts *counts);
+
+void metrics_open(char *spec);
+void metrics_start(capture_reader reader, char *use_infile, int timed);
+void metrics_stop();
+
+#endif /* ! _HAVE_METRICS_H */
@@ -0,0 +1,494 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Each capture worker owns an output buffer. A record is assembled
+  field by field in a preallocated line buffer and, once complete,
+  copied into a larger batch buffer. Batches are written straight to
+  the stdout descriptor with writev(), bypassing stdio, so a line
+  costs a couple of memcpy() calls rather than a syscall per field.
+
+  A batch is written when it fills up or holds the configured number
+  of records. If a latency bound is set, a flusher thread also wakes
+  up at that interval, swaps out every worker's pending batch and
+  writes them all with a single writev() call. Only whole records are
+  ever written and all writes are serialized, so lines from different
+  workers never interleave.
+
+  An encoder may be set to turn each batch into some other form
+  before it is written, such as a compressed block of the binary log.
+  Batches written by a worker are encoded under its buffer lock, while
+  those taken by the flusher are encoded after the buffer locks are
+  released, each side into its own preallocated buffer.
+
+  The flusher takes the write lock before it lets go of the buffers
+  it swapped out, and keeps it until they are written, so a worker
+  cannot write newer records of its own ahead of them. The lock order
+  is always a buffer lock before the write lock; the flusher may hold
+  several buffer locks at once, but whoever holds the write lock never
+  waits for a buffer.
+
+  Output normally goes to the stdout descriptor, but may instead be
+  handed to a sink, such as the compressing log writer; the sink is
+  called with the same serialization as a direct write.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include "error.h"
+#include "output.h"
+
+#define LINE_BUFSIZE 4096
+#define MAX_BUFFERS 64
+
+struct output_buf {
+        char *line;               /* Record being assembled */
+        size_t line_len;
+        size_t line_size;
+        char *data;               /* Batch of complete records */
+        char *spare;              /* Swapped in by the flusher thread */
+        size_t len;
+        size_t size;
+        char *enc;                /* Batch encoded by the worker */
+        char *spare_enc;          /* Batch encoded by the flusher thread */
+        size_t enc_size;
+        unsigned int records;
+        pthread_mutex_t lock;
+};
+
+void write_batch(OUTPUT_BUF *out);
+void write_iov(struct iovec *iov, int iovcnt);
+void write_iov_locked(struct iovec *iov, int iovcnt);
+void write_data(char *data, size_t len, char *enc, size_t enc_size);
+void *run_flusher(void *args);
+
+static unsigned int flush_interval = 0;  /* Max milliseconds a record may wait */
+static unsigned int flush_records = 0;   /* Max records held in a batch */
+static OUTPUT_BUF *buffers[MAX_BUFFERS];
+static int num_buffers = 0;
+static pthread_t thread;
+static int thread_created = 0;
+static pthread_mutex_t write_lock = PTHREAD_MUTEX_INITIALIZER;
+static OUTPUT_ENCODER encoder = NULL;
+static OUTPUT_BOUND encoder_bound = NULL;
+static OUTPUT_SINK sink = NULL;
+
+/* Set the output latency bounds; a batch is written once it holds
+   max_records records, and no record waits longer than interval ms.
+   Zero disables the respective bound. */
+void output_init(unsigned int interval, unsigned int max_records) {
+        flush_interval = interval;
+        flush_records = max_records;
+
+        return;
+}
+
+/* Encode every batch with encode before it is written; bound gives
+   the most bytes encoding a batch of a given size can produce. Must
+   be called before any buffer is allocated. */
+void output_set_encoder(OUTPUT_ENCODER encode, OUTPUT_BOUND bound) {
+
+#ifdef DEBUG
+        ASSERT(num_buffers == 0);
+#endif
+
+        encoder = encode;
+        encoder_bound = bound;
+
+        return;
+}
+
+/* Hand every batch to fn rather than writing it to stdout */
+void output_set_sink(OUTPUT_SINK fn) {
+        sink = fn;
+
+        return;
+}
+
+/* Allocate a new output buffer with a batch of the given size */
+OUTPUT_BUF *output_new(size_t size) {
+        OUTPUT_BUF *out;
+        int s;
+
+#ifdef DEBUG
+        ASSERT(size > 0);
+#endif
+
+        if (num_buffers == MAX_BUFFERS)
+                LOG_DIE("Cannot create more than %d output buffers", MAX_BUFFERS);
+
+        if ((out = (OUTPUT_BUF *) malloc(sizeof(OUTPUT_BUF))) == NULL)
+                LOG_DIE("Cannot allocate memory for output buffer");
+
+        if ((out->line = (char *) malloc(LINE_BUFSIZE)) == NULL)
+                LOG_DIE("Cannot allocate memory for output line buffer");
+
+        if ((out->data = (char *) malloc(size)) == NULL)
+                LOG_DIE("Cannot allocate memory for output buffer data");
+
+        if ((out->spare = (char *) malloc(size)) == NULL)
+                LOG_DIE("Cannot allocate memory for output buffer data");
+
+        out->enc = NULL;
+        out->spare_enc = NULL;
+        out->enc_size = 0;
+
+        if (encoder) {
+                out->enc_size = encoder_bound(size);
+                if (((out->enc = (char *) malloc(out->enc_size)) == NULL) ||
+                    ((out->spare_enc = (char *) malloc(out->enc_size)) == NULL))
+                        LOG_DIE("Cannot allocate memory for output buffer encoding");
+        }
+
+        s = pthread_mutex_init(&out->lock, NULL);
+        if (s != 0)
+                LOG_DIE("Output buffer mutex initialization failed with error %d", s);
+
+        out->line_len = 0;
+        out->line_size = LINE_BUFSIZE;
+        out->len = 0;
+        out->size = size;
+        out->records = 0;
+
+        buffers[num_buffers++] = out;
+
+        return out;
+}
+
+/* Append data to the record currently being assembled */
+void output_append(OUTPUT_BUF *out, const char *str, size_t len) {
+        char *tmp;
+
+#ifdef DEBUG
+        ASSERT(out);
+        ASSERT(str);
+#endif
+
+        if (out->line_len + len > out->line_size) {
+                if ((tmp = realloc(out->line, (out->line_len + len) * 2)) == NULL)
+                        LOG_DIE("Cannot re-allocate memory for output line buffer");
+                out->line = tmp;
+                out->line_size = (out->line_len + len) * 2;
+        }
+
+        memcpy(out->line + out->line_len, str, len);
+        out->line_len += len;
+
+        return;
+}
+
+/* Move the completed record into the batch, writing the batch out
+   first if the record will not fit; returns the record length */
+size_t output_end_record(OUTPUT_BUF *out) {
+        size_t len;
+
+#ifdef DEBUG
+        ASSERT(out);
+#endif
+
+        len = out->line_len;
+
+        if (thread_created) pthread_mutex_lock(&out->lock);
+
+        if (out->len + out->line_len > out->size)
+                write_batch(out);
+
+        if (out->line_len > out->size) {
+                /* Oversized record, so write it on its own */
+                write_data(out->line, out->line_len, NULL, 0);
+        } else {
+                memcpy(out->data + out->len, out->line, out->line_len);
+                out->len += out->line_len;
+                out->records++;
+
+                if (flush_records && (out->records >= flush_records))
+                        write_batch(out);
+        }
+
+        if (thread_created) pthread_mutex_unlock(&out->lock);
+
+        out->line_len = 0;
+
+        return len;
+}
+
+/* Write all complete records held by the buffer */
+void output_flush(OUTPUT_BUF *out) {
+        if (!out) return;
+
+        if (thread_created) pthread_mutex_lock(&out->lock);
+        write_batch(out);
+        if (thread_created) pthread_mutex_unlock(&out->lock);
+
+        return;
+}
+
+/* Write out every buffer and hold all output until output_release(),
+   so the output stream can be swapped without a batch landing in the
+   wrong file or ahead of the new file's header. Without the flusher
+   thread each buffer belongs to its worker, so only the write lock is
+   taken and the workers' buffers are left to them */
+void output_hold() {
+        int i;
+
+        /* Buffer locks are taken before the write lock */
+        if (thread_created) {
+                for (i = 0; i < num_buffers; i++)
+                        pthread_mutex_lock(&buffers[i]->lock);
+                for (i = 0; i < num_buffers; i++)
+                        write_batch(buffers[i]);
+        }
+
+        pthread_mutex_lock(&write_lock);
+
+        return;
+}
+
+/* Let output be written again after output_hold() */
+void output_release() {
+        int i;
+
+        pthread_mutex_unlock(&write_lock);
+
+        if (thread_created) {
+                for (i = 0; i < num_buffers; i++)
+                        pthread_mutex_unlock(&buffers[i]->lock);
+        }
+
+        return;
+}
+
+/* Write the batch held by the buffer; the caller must hold the
+   buffer lock if the flusher thread is running */
+void write_batch(OUTPUT_BUF *out) {
+        if (out->len == 0) return;
+
+        write_data(out->data, out->len, out->enc, out->enc_size);
+
+        out->len = 0;
+        out->records = 0;
+
+        return;
+}
+
+/* Write a single batch, encoding it into enc first if an encoder is
+   set; a batch too large for enc is encoded into a temporary buffer */
+void write_data(char *data, size_t len, char *enc, size_t enc_size) {
+        struct iovec iov;
+        char *tmp = NULL;
+
+        iov.iov_base = data;
+        iov.iov_len = len;
+
+        if (encoder) {
+                if (encoder_bound(len) > enc_size) {
+                        enc_size = encoder_bound(len);
+                        if ((tmp = enc = (char *) malloc(enc_size)) == NULL)
+                                LOG_DIE("Cannot allocate memory for output record encoding");
+                }
+
+                iov.iov_base = enc;
+                iov.iov_len = encoder(data, len, enc, enc_size);
+        }
+
+        write_iov(&iov, 1);
+        free(tmp);
+
+        return;
+}
+
+/* Write a set of buffers to stdout in order */
+void write_iov(struct iovec *iov, int iovcnt) {
+        pthread_mutex_lock(&write_lock);
+        write_iov_locked(iov, iovcnt);
+        pthread_mutex_unlock(&write_lock);
+
+        return;
+}
+
+/* Write a set of buffers to stdout in order, retrying on short
+   writes; the caller must hold the write lock */
+void write_iov_locked(struct iovec *iov, int iovcnt) {
+        ssize_t n;
+
+        if (sink) {
+                sink(iov, iovcnt);
+                iovcnt = 0;
+        }
+
+        while (iovcnt > 0) {
+                n = writev(fileno(stdout), iov, iovcnt);
+                if (n == -1) {
+                        if (errno == EINTR) continue;
+                        LOG_WARN("Cannot write output records: %s", strerror(errno));
+                        break;
+                }
+
+                while ((iovcnt > 0) && ((size_t) n >= iov->iov_len)) {
+                        n -= iov->iov_len;
+                        iov++;
+                        iovcnt--;
+                }
+
+                if (iovcnt > 0) {
+                        iov->iov_base = (char *) iov->iov_base + n;
+                        iov->iov_len -= n;
+                }
+        }
+
+        return;
+}
+
+/* Spawn the flusher thread if a latency bound has been set */
+void output_start_flusher() {
+        sigset_t set;
+        int s;
+
+        if (thread_created || (flush_interval == 0)) return;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Output thread signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_flusher, NULL);
+        if (s != 0)
+                LOG_DIE("Output thread creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Output thread signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Cancel the flusher thread */
+void output_stop_flusher() {
+        int s;
+
+        if (!thread_created) return;
+
+        s = pthread_cancel(thread);
+        if (s != 0)
+                LOG_WARN("Output thread cancellation failed with error %d", s);
+
+        s = pthread_join(thread, NULL);
+        if (s != 0)
+                LOG_WARN("Output thread join failed with error %d", s);
+
+        thread_created = 0;
+
+        return;
+}
+
+/* This is our flusher thread; every interval it takes the pending
+   batch from each buffer and writes them all in one go */
+void *run_flusher(void *args) {
+        struct iovec iov[MAX_BUFFERS];
+        char *enc[MAX_BUFFERS];
+        OUTPUT_BUF *held[MAX_BUFFERS];
+        struct timespec ts;
+        char *tmp;
+        int i, n;
+
+        ts.tv_sec = flush_interval / 1000;
+        ts.tv_nsec = (flush_interval % 1000) * 1000000;
+
+        while (1) {
+                nanosleep(&ts, NULL);
+
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+
+                /* Buffers with a pending batch stay locked until the
+                   write lock is held */
+                for (i = 0, n = 0; i < num_buffers; i++) {
+                        pthread_mutex_lock(&buffers[i]->lock);
+                        if (buffers[i]->len == 0) {
+                                pthread_mutex_unlock(&buffers[i]->lock);
+                                continue;
+                        }
+
+                        iov[n].iov_base = buffers[i]->data;
+                        iov[n].iov_len = buffers[i]->len;
+                        enc[n] = buffers[i]->spare_enc;
+                        held[n++] = buffers[i];
+
+                        tmp = buffers[i]->data;
+                        buffers[i]->data = buffers[i]->spare;
+                        buffers[i]->spare = tmp;
+                        buffers[i]->len = 0;
+                        buffers[i]->records = 0;
+                }
+
+                if (n > 0) {
+                        pthread_mutex_lock(&write_lock);
+                        for (i = 0; i < n; i++)
+                                pthread_mutex_unlock(&held[i]->lock);
+
+                        /* The swapped out batches are not touched again
+                           until the next pass, so they can be encoded
+                           without the buffer locks */
+                        if (encoder) {
+                                for (i = 0; i < n; i++) {
+                                        iov[i].iov_len = encoder(iov[i].iov_base, iov[i].iov_len, enc[i],
+                                                                 encoder_bound(iov[i].iov_len));
+                                        iov[i].iov_base = enc[i];
+                                }
+                        }
+
+                        write_iov_locked(iov, n);
+                        pthread_mutex_unlock(&write_lock);
+                }
+
+                pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+        }
+
+        return (void *) 0;
+}
+
+/* Flush and free an output buffer */
+void output_free(OUTPUT_BUF *out) {
+        int i;
+
+        if (!out) return;
+
+        output_flush(out);
+
+        for (i = 0; i < num_buffers; i++) {
+                if (buffers[i] == out) {
+                        buffers[i] = buffers[--num_buffers];
+                        break;
+                }
+        }
+
+        pthread_mutex_destroy(&out->lock);
+        free(out->line);
+        free(out->data);
+        free(out->spare);
+        free(out->enc);
+        free(out->spare_enc);
+        free(out);
+
+        return;
+}
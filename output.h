@@ -0,0 +1,36 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_OUTPUT_H
+#define _HAVE_OUTPUT_H
+
+#include <sys/types.h>
+#include <sys/uio.h>
+
+typedef struct output_buf OUTPUT_BUF;
+typedef size_t (*OUTPUT_ENCODER)(const char *data, size_t len, char *dst, size_t size);
+typedef size_t (*OUTPUT_BOUND)(size_t len);
+typedef void (*OUTPUT_SINK)(const struct iovec *iov, int iovcnt);
+
+void output_init(unsigned int interval, unsigned int max_records);
+void output_set_encoder(OUTPUT_ENCODER encode, OUTPUT_BOUND bound);
+void output_set_sink(OUTPUT_SINK fn);
+OUTPUT_BUF *output_new(size_t size);
+void output_append(OUTPUT_BUF *out, const char *str, size_t len);
+size_t output_end_record(OUTPUT_BUF *out);
+void output_flush(OUTPUT_BUF *out);
+void output_hold();
+void output_release();
+void output_start_flusher();
+void output_stop_flusher();
+void output_free(OUTPUT_BUF *out);
+
+#endif /* ! _HAVE_OUTPUT_H */
@@ -0,0 +1,222 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Stateless packet decoding: the link, IP and TCP layers of a captured
+  packet are walked to find the flow it belongs to and where its TCP
+  payload starts, and the first payload bytes are checked for an HTTP
+  request method or response. Nothing here touches per-worker state
+  other than the counters handed in, so a whole batch of packets can
+  be decoded in one pass before any of them is logged.
+*/
+
+#include <string.h>
+#include <sys/socket.h>
+#include "config.h"
+#include "methods.h"
+#include "packet.h"
+#include "stats.h"
+#include "tcp.h"
+
+#define PREFETCH_AHEAD 4             /* Packets ahead of a batch pass to prefetch */
+
+/* Decode the link, IP and TCP headers of every packet in the batch
+   into info, clearing the payload of those we cannot use */
+void decode_batch(const PACKET_BATCH *batch, unsigned int link_offset, unsigned int skip, PACKET_INFO *info,
+                  struct parse_stats *stats) {
+        unsigned int i, n = batch->count;
+        int reason;
+
+        for (i = 0; i < n; i++) {
+                if (i + PREFETCH_AHEAD < n) {
+                        __builtin_prefetch(batch->pkts[i + PREFETCH_AHEAD]);
+                        __builtin_prefetch(batch->pkts[i + PREFETCH_AHEAD] + 64);
+                }
+
+                stats->packets++;
+                stats->bytes += batch->headers[i].caplen;
+
+                reason = decode_packet(&batch->headers[i], batch->pkts[i], link_offset, skip, &info[i]);
+                if (reason) {
+                        COUNT_REJECT(stats, reason);
+                        info[i].data = NULL;
+                }
+        }
+
+        return;
+}
+
+/* Set the message type of the n decoded packets, leaving it 0 for
+   those whose payload does not start a request or response */
+void filter_batch(unsigned int n, PACKET_INFO *info, struct parse_stats *stats) {
+        unsigned int i;
+
+        for (i = 0; i < n; i++) {
+                if ((i + PREFETCH_AHEAD < n) && info[i + PREFETCH_AHEAD].data)
+                        __builtin_prefetch(info[i + PREFETCH_AHEAD].data);
+
+                if (!info[i].data) continue;
+
+                if (info[i].size_data <= 0) {
+                        COUNT_REJECT(stats, REJECT_NO_PAYLOAD);
+                } else if (!(info[i].type = message_type(info[i].data, info[i].size_data))) {
+                        COUNT_REJECT(stats, REJECT_NOT_METHOD);
+                }
+        }
+
+        return;
+}
+
+/* Locate the header fields of every message start in place, handing
+   out entries of fields, which must hold MAX_HEADER_FIELDS for each
+   of the n packets */
+void scan_batch(unsigned int n, PACKET_INFO *info, HEADER_FIELD *fields, struct parse_stats *stats) {
+        unsigned int i, used = 0;
+
+        for (i = 0; i < n; i++) {
+                if (!info[i].data || !info[i].type) continue;
+
+                info[i].fields = fields + used;
+                info[i].num_fields = scan_headers(info[i].data, info[i].size_data, &info[i].line_len,
+                                                  info[i].fields, MAX_HEADER_FIELDS);
+                stats->scanned += info[i].size_data;
+                if (info[i].num_fields > 0) used += info[i].num_fields;
+                if (info[i].num_fields < 0) COUNT_REJECT(stats, REJECT_MALFORMED);
+        }
+
+        return;
+}
+
+/* Decode the IP and TCP headers of a packet, whose network header
+   starts link_offset bytes in (plus a VLAN tag) and then skip more
+   bytes; returns 0 if it is a TCP packet we can use, or the REJECT_*
+   reason it is not. Packets may be packed back to back in memory, so
+   nothing past caplen is ever read */
+int decode_packet(const struct pcap_pkthdr *header, const u_char *pkt, unsigned int link_offset,
+                  unsigned int skip, PACKET_INFO *info) {
+        unsigned int eth_type = 0, offset, caplen = header->caplen;
+        const struct eth_header *eth;
+        const struct ip_header *ip;
+        const struct ip6_header *ip6;
+        const struct tcp_header *tcp;
+        int size_ip, size_tcp, payload_len, family;
+
+        if (caplen < sizeof(struct eth_header)) return REJECT_SHORT_HEADER;
+
+        /* Check the ethernet type and insert a VLAN offset if necessary */
+        eth = (struct eth_header *) pkt;
+        eth_type = ntohs(eth->ether_type);
+        if (eth_type == ETHER_TYPE_VLAN) {
+                offset = link_offset + 4;
+        } else {
+                offset = link_offset;
+        }
+
+        offset += skip;
+        if (offset + 20 > caplen) return REJECT_SHORT_HEADER;
+
+        /* Position pointers within packet stream and do sanity checks */
+        ip = (struct ip_header *) (pkt + offset);
+        ip6 = (struct ip6_header *) (pkt + offset);
+
+        switch (IP_V(ip)) {
+                case 4: family = AF_INET; break;
+                case 6: family = AF_INET6; break;
+                default: return REJECT_NON_IP;
+        }
+
+        if (family == AF_INET) {
+                size_ip = IP_HL(ip) * 4;
+                if (size_ip < 20) return REJECT_SHORT_HEADER;
+                if (ip->ip_p != IPPROTO_TCP) return REJECT_NON_TCP;
+                payload_len = ntohs(ip->ip_len) - size_ip;
+        } else { /* AF_INET6 */
+                size_ip = sizeof(struct ip6_header);
+                if (offset + size_ip > caplen) return REJECT_SHORT_HEADER;
+                if (ip6->ip6_nh != IPPROTO_TCP)
+                        size_ip = process_ip6_nh(pkt, size_ip, caplen, offset);
+                if (size_ip < 40) return REJECT_NON_TCP;
+                payload_len = ntohs(ip6->ip6_plen) + sizeof(struct ip6_header) - size_ip;
+        }
+
+        if (offset + size_ip + 20 > caplen) return REJECT_SHORT_HEADER;
+        tcp = (struct tcp_header *) (pkt + offset + size_ip);
+        size_tcp = TH_OFF(tcp) * 4;
+        if (size_tcp < 20) return REJECT_SHORT_HEADER;
+        if (offset + size_ip + size_tcp > caplen) return REJECT_SHORT_HEADER;
+
+        info->data = (char *) (pkt + offset + size_ip + size_tcp);
+        info->size_data = (caplen - (offset + size_ip + size_tcp));
+        info->payload_len = payload_len - size_tcp;
+        info->seq = ntohl(tcp->th_seq);
+        info->flags = tcp->th_flags;
+        info->type = 0;
+
+        memset(&info->key, 0, sizeof(info->key));
+        info->key.family = family;
+        if (family == AF_INET) {
+                memcpy(info->key.saddr, &ip->ip_src, sizeof(ip->ip_src));
+                memcpy(info->key.daddr, &ip->ip_dst, sizeof(ip->ip_dst));
+        } else { /* AF_INET6 */
+                memcpy(info->key.saddr, &ip6->ip_src, sizeof(ip6->ip_src));
+                memcpy(info->key.daddr, &ip6->ip_dst, sizeof(ip6->ip_dst));
+        }
+        info->key.sport = tcp->th_sport;
+        info->key.dport = tcp->th_dport;
+
+        return 0;
+}
+
+/* Iterate through IPv6 extension headers looking for a TCP header. Returns
+   the total size of the IPv6 header, including all extension headers.
+   Return 0 to abort processing of this packet. */
+int process_ip6_nh(const u_char *pkt, int size_ip, unsigned int caplen, unsigned int offset) {
+        const struct ip6_ext_header *ip6_eh;
+        unsigned int len = caplen - offset;
+
+        if (size_ip + sizeof(struct ip6_ext_header) > len) return 0;
+        ip6_eh = (struct ip6_ext_header *) (pkt + offset + size_ip);
+
+        while (ip6_eh->ip6_eh_nh != IPPROTO_TCP) {
+                switch (ip6_eh->ip6_eh_nh) {
+                        case 0:  /* Hop-by-hop options */
+                        case 43: /* Routing */
+                        case 44: /* Fragment */
+                        case 51: /* Authentication Header */
+                        case 50: /* Encapsulating Security Payload */
+                        case 60: /* Destination Options */
+                                size_ip = size_ip + (ip6_eh->ip6_eh_len * 8) + 8;
+                                break;
+                        case 59: /* No next header */
+                        default:
+                                return 0;
+                }
+
+                if (size_ip + sizeof(struct ip6_ext_header) > len) return 0;
+
+                ip6_eh = (struct ip6_ext_header *) (pkt + offset + size_ip);
+        }
+
+        /* Next header is TCP, so increment past the final extension header */
+        size_ip = size_ip + (ip6_eh->ip6_eh_len * 8) + 8;
+
+        return size_ip;
+}
+
+/* Check if data looks like the start of a request or response */
+int message_type(const char *data, size_t len) {
+        if (is_request_method(data, len)) return MSG_REQUEST;
+
+        if ((len >= sizeof(HTTP_STRING) - 1) && (strncmp(data, HTTP_STRING, sizeof(HTTP_STRING) - 1) == 0))
+                return MSG_RESPONSE;
+
+        return 0;
+}
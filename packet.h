@@ -0,0 +1,58 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_PACKET_H
+#define _HAVE_PACKET_H
+
+#include <pcap.h>
+#include "batch.h"
+#include "flow.h"
+#include "headers.h"
+
+#define MSG_REQUEST 1
+#define MSG_RESPONSE 2
+
+/* Why a packet was not logged; decode_packet() returns the first three */
+#define REJECT_NON_IP       1
+#define REJECT_NON_TCP      2
+#define REJECT_SHORT_HEADER 3
+#define REJECT_NO_PAYLOAD   4
+#define REJECT_NOT_METHOD   5
+#define REJECT_MALFORMED    6
+#define NUM_REJECTS         6
+
+/* What the batch passes learn about a packet; each pass fills in its
+   own fields and later passes only read them */
+typedef struct packet_info {
+        FLOW_KEY key;
+        const char *data;         /* TCP payload within the packet */
+        int size_data;            /* Payload bytes captured */
+        int payload_len;          /* Payload bytes on the wire */
+        unsigned int seq;
+        int flags;
+        int type;                 /* MSG_REQUEST, MSG_RESPONSE or 0 */
+        int num_fields;           /* Header fields found, -1 if malformed */
+        size_t line_len;          /* Start line length */
+        HEADER_FIELD *fields;
+} PACKET_INFO;
+
+struct parse_stats;
+
+int decode_packet(const struct pcap_pkthdr *header, const u_char *pkt, unsigned int link_offset,
+                  unsigned int skip, PACKET_INFO *info);
+void decode_batch(const PACKET_BATCH *batch, unsigned int link_offset, unsigned int skip, PACKET_INFO *info,
+                  struct parse_stats *stats);
+void filter_batch(unsigned int n, PACKET_INFO *info, struct parse_stats *stats);
+void scan_batch(unsigned int n, PACKET_INFO *info, HEADER_FIELD *fields, struct parse_stats *stats);
+int process_ip6_nh(const u_char *pkt, int size_ip, unsigned int caplen, unsigned int offset);
+int message_type(const char *data, size_t len);
+
+#endif /* ! _HAVE_PACKET_H */
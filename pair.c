@@ -0,0 +1,305 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  A pair table matches each response to the request it answers. The
+  requests outstanding on a connection are queued in the order they
+  were seen, keyed on the client to server direction of the flow, and
+  each response takes the oldest one, so pipelined requests pair up
+  the way HTTP/1.1 requires. Each capture worker owns its own table;
+  packet fanout sends both directions of a connection to the same
+  worker, so no locking is done here.
+
+  Memory is fixed when the table is created: a pool of flows, each
+  with room for a set number of queued requests. A request arriving
+  when either is full is dropped and counted rather than displacing
+  an older one, which would throw off the order of every later pair.
+
+  A flow is only held while it has requests outstanding. Each flow
+  sits on a timer wheel with one slot per second, in the slot for the
+  second its oldest request times out, so expiry only visits the flows
+  that are due rather than the whole table.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "pair.h"
+
+#define WHEEL_SIZE 256
+
+typedef struct pair_flow PAIR_FLOW;
+struct pair_flow {
+        FLOW_KEY key;             /* Client to server direction */
+        PAIR_REQUEST *queue;      /* Ring of queued requests */
+        unsigned int head, count;
+        time_t deadline;          /* When the oldest request times out */
+        unsigned int slot;        /* Timer wheel slot */
+        PAIR_FLOW *next;          /* Hash chain or free list */
+        PAIR_FLOW *prev_timer, *next_timer;
+};
+
+struct pair_table {
+        PAIR_FLOW *pool;
+        PAIR_REQUEST *requests;
+        PAIR_FLOW **buckets;
+        unsigned int hash_mask;
+        PAIR_FLOW *free_list;
+        PAIR_FLOW *wheel[WHEEL_SIZE];
+        time_t wheel_time;        /* Next second to be processed */
+        unsigned int depth;
+        unsigned int timeout;
+        struct pair_stats stats;
+};
+
+PAIR_FLOW *pair_find(PAIR_TABLE *table, const FLOW_KEY *key);
+void pair_release(PAIR_TABLE *table, PAIR_FLOW *flow);
+void timer_insert(PAIR_TABLE *table, PAIR_FLOW *flow);
+void timer_unlink(PAIR_TABLE *table, PAIR_FLOW *flow);
+
+/* Create a table of up to max_flows connections with up to depth
+   requests outstanding on each; requests unanswered for timeout
+   seconds are dropped by pair_expire() */
+PAIR_TABLE *pair_table_new(unsigned int max_flows, unsigned int depth, unsigned int timeout) {
+        PAIR_TABLE *table;
+        unsigned int size, i;
+
+#ifdef DEBUG
+        ASSERT(max_flows > 0);
+        ASSERT(depth > 0);
+#endif
+
+        if ((table = (PAIR_TABLE *) calloc(1, sizeof(PAIR_TABLE))) == NULL)
+                LOG_DIE("Cannot allocate memory for pair table");
+
+        if ((table->pool = (PAIR_FLOW *) calloc(max_flows, sizeof(PAIR_FLOW))) == NULL)
+                LOG_DIE("Cannot allocate memory for pair pool");
+
+        if ((table->requests = (PAIR_REQUEST *) calloc((size_t) max_flows * depth, sizeof(PAIR_REQUEST))) == NULL)
+                LOG_DIE("Cannot allocate memory for pair queues");
+
+        for (size = 1; size < max_flows * 2; size <<= 1);
+        if ((table->buckets = (PAIR_FLOW **) calloc(size, sizeof(PAIR_FLOW *))) == NULL)
+                LOG_DIE("Cannot allocate memory for pair hash");
+
+        for (i = 0; i < max_flows; i++) {
+                table->pool[i].queue = &table->requests[(size_t) i * depth];
+                table->pool[i].next = table->free_list;
+                table->free_list = &table->pool[i];
+        }
+
+        table->hash_mask = size - 1;
+        table->depth = depth;
+        table->timeout = timeout;
+
+        return table;
+}
+
+/* Queue a request seen on the given flow, given its method and URI
+   and their lengths */
+void pair_request(PAIR_TABLE *table, const FLOW_KEY *key, const struct timeval *ts,
+                  const char *method, size_t method_len, const char *uri, size_t uri_len) {
+        PAIR_FLOW *flow, **bucket;
+        PAIR_REQUEST *req;
+
+        if (!table->wheel_time) table->wheel_time = ts->tv_sec;
+
+        if (!(flow = pair_find(table, key))) {
+                if (!table->free_list) {
+                        table->stats.dropped++;
+                        return;
+                }
+
+                flow = table->free_list;
+                table->free_list = flow->next;
+
+                memcpy(&flow->key, key, sizeof(FLOW_KEY));
+                flow->head = flow->count = 0;
+                flow->deadline = ts->tv_sec + table->timeout;
+
+                bucket = &table->buckets[hash_flow(key) & table->hash_mask];
+                flow->next = *bucket;
+                *bucket = flow;
+                timer_insert(table, flow);
+        } else if (flow->count == table->depth) {
+                table->stats.dropped++;
+                return;
+        }
+
+        req = &flow->queue[(flow->head + flow->count) % table->depth];
+        req->ts = *ts;
+        snprintf(req->method, PAIR_METHOD_LEN, "%.*s", (int) method_len, method);
+        snprintf(req->uri, PAIR_URI_LEN, "%.*s", (int) uri_len, uri);
+        flow->count++;
+
+        table->stats.queued++;
+
+        return;
+}
+
+/* Copy the oldest request outstanding on the reverse of the given
+   response flow into req. A final response dequeues the request; an
+   interim (1xx) response leaves it for the final one. Returns 1 if a
+   request was found, 0 otherwise. */
+int pair_response(PAIR_TABLE *table, const FLOW_KEY *key, int final, PAIR_REQUEST *req) {
+        PAIR_FLOW *flow;
+        FLOW_KEY client;
+
+        reverse_flow(&client, key);
+        if (!(flow = pair_find(table, &client))) {
+                table->stats.unmatched++;
+                return 0;
+        }
+
+        memcpy(req, &flow->queue[flow->head], sizeof(PAIR_REQUEST));
+        if (!final) return 1;
+
+        table->stats.matched++;
+        flow->head = (flow->head + 1) % table->depth;
+        if (--flow->count == 0) {
+                pair_release(table, flow);
+                return 1;
+        }
+
+        timer_unlink(table, flow);
+        flow->deadline = flow->queue[flow->head].ts.tv_sec + table->timeout;
+        timer_insert(table, flow);
+
+        return 1;
+}
+
+/* Drop every request that has been outstanding for the timeout,
+   advancing the timer wheel through each second up to now */
+void pair_expire(PAIR_TABLE *table, time_t now) {
+        PAIR_FLOW *flow, *next;
+        unsigned int slot;
+
+        if (!table->wheel_time) return;
+
+        /* After a long gap every slot is visited once */
+        if (now - table->wheel_time >= WHEEL_SIZE)
+                table->wheel_time = now - WHEEL_SIZE + 1;
+
+        for (; table->wheel_time <= now; table->wheel_time++) {
+                slot = table->wheel_time & (WHEEL_SIZE - 1);
+                flow = table->wheel[slot];
+                table->wheel[slot] = NULL;
+
+                for (; flow; flow = next) {
+                        next = flow->next_timer;
+                        flow->prev_timer = flow->next_timer = NULL;
+
+                        /* Slots are shared by deadlines a wheel apart */
+                        while (flow->count &&
+                               (flow->queue[flow->head].ts.tv_sec + table->timeout <= now)) {
+                                flow->head = (flow->head + 1) % table->depth;
+                                flow->count--;
+                                table->stats.expired++;
+                        }
+
+                        if (flow->count == 0) {
+                                flow->slot = WHEEL_SIZE;
+                                pair_release(table, flow);
+                                continue;
+                        }
+
+                        flow->deadline = flow->queue[flow->head].ts.tv_sec + table->timeout;
+                        timer_insert(table, flow);
+                }
+        }
+
+        return;
+}
+
+void pair_stats(PAIR_TABLE *table, struct pair_stats *stats) {
+        memcpy(stats, &table->stats, sizeof(struct pair_stats));
+
+        return;
+}
+
+void pair_table_free(PAIR_TABLE *table) {
+        if (!table) return;
+
+        free(table->pool);
+        free(table->requests);
+        free(table->buckets);
+        free(table);
+
+        return;
+}
+
+/* Return the flow with requests outstanding on the given key, or NULL */
+PAIR_FLOW *pair_find(PAIR_TABLE *table, const FLOW_KEY *key) {
+        PAIR_FLOW *flow;
+
+        for (flow = table->buckets[hash_flow(key) & table->hash_mask]; flow; flow = flow->next) {
+                if (flow_equal(&flow->key, key))
+                        return flow;
+        }
+
+        return NULL;
+}
+
+/* Return the flow to the pool */
+void pair_release(PAIR_TABLE *table, PAIR_FLOW *flow) {
+        PAIR_FLOW **node;
+
+        for (node = &table->buckets[hash_flow(&flow->key) & table->hash_mask]; *node; node = &(*node)->next) {
+                if (*node == flow) {
+                        *node = flow->next;
+                        break;
+                }
+        }
+
+        timer_unlink(table, flow);
+
+        flow->next = table->free_list;
+        table->free_list = flow;
+
+        return;
+}
+
+/* Add the flow to the slot for its deadline; a deadline that has
+   already passed goes in the next slot to be processed */
+void timer_insert(PAIR_TABLE *table, PAIR_FLOW *flow) {
+        time_t when = flow->deadline;
+
+        if (when < table->wheel_time) when = table->wheel_time;
+
+        flow->slot = when & (WHEEL_SIZE - 1);
+        flow->prev_timer = NULL;
+        flow->next_timer = table->wheel[flow->slot];
+        if (flow->next_timer) flow->next_timer->prev_timer = flow;
+        table->wheel[flow->slot] = flow;
+
+        return;
+}
+
+/* Remove the flow from its slot, if it is on the wheel */
+void timer_unlink(PAIR_TABLE *table, PAIR_FLOW *flow) {
+        if (flow->slot >= WHEEL_SIZE) return;
+
+        if (flow->prev_timer) {
+                flow->prev_timer->next_timer = flow->next_timer;
+        } else {
+                table->wheel[flow->slot] = flow->next_timer;
+        }
+
+        if (flow->next_timer)
+                flow->next_timer->prev_timer = flow->prev_timer;
+
+        flow->prev_timer = flow->next_timer = NULL;
+        flow->slot = WHEEL_SIZE;
+
+        return;
+}
@@ -0,0 +1,47 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_PAIR_H
+#define _HAVE_PAIR_H
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include "flow.h"
+
+#define PAIR_METHOD_LEN 32
+#define PAIR_URI_LEN 256
+
+/* An outstanding request; longer method and URI strings are truncated */
+typedef struct pair_request {
+        struct timeval ts;
+        char method[PAIR_METHOD_LEN];
+        char uri[PAIR_URI_LEN];
+} PAIR_REQUEST;
+
+typedef struct pair_table PAIR_TABLE;
+
+struct pair_stats {
+        unsigned int queued;      /* Requests queued for pairing */
+        unsigned int matched;     /* Requests paired with a response */
+        unsigned int expired;     /* Requests unanswered for the timeout */
+        unsigned int dropped;     /* Requests not queued for lack of room */
+        unsigned int unmatched;   /* Responses without a queued request */
+};
+
+PAIR_TABLE *pair_table_new(unsigned int max_flows, unsigned int depth, unsigned int timeout);
+void pair_request(PAIR_TABLE *table, const FLOW_KEY *key, const struct timeval *ts,
+                  const char *method, size_t method_len, const char *uri, size_t uri_len);
+int pair_response(PAIR_TABLE *table, const FLOW_KEY *key, int final, PAIR_REQUEST *req);
+void pair_expire(PAIR_TABLE *table, time_t now);
+void pair_stats(PAIR_TABLE *table, struct pair_stats *stats);
+void pair_table_free(PAIR_TABLE *table);
+
+#endif /* ! _HAVE_PAIR_H */
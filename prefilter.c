@@ -0,0 +1,242 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The HTTP prefilter extends the compiled capture filter so that only
+  packets whose TCP payload could start a request or a response are
+  accepted. Wherever the capture filter would accept a packet, the
+  program instead jumps to a check that finds the payload the same
+  way decode_packet() does, and compares its first four bytes against
+  the first four of each configured method, ignoring case, and against
+  "HTTP". Body segments and bare ACKs are dropped before they are ever
+  copied out of the kernel, or in truncating mode are cut to their
+  link, IP and TCP headers so only packets that start a message are
+  captured in full.
+
+  Being plain classic BPF, the same program runs in the kernel for
+  live capture, through libpcap or the ring, and in libpcap when
+  reading a file. Packets the check cannot follow, such as TCP behind
+  IPv6 extension headers, are accepted and left to the parser, and so
+  are packets whose payload starts too close to the snapshot length
+  for it to be checked where the filter runs on captured bytes only,
+  as libpcap does when reading a file.
+*/
+
+#include <ctype.h>
+#include <stdlib.h>
+#include <string.h>
+#include <netinet/in.h>
+#include "error.h"
+#include "methods.h"
+#include "prefilter.h"
+
+#define CHECK_LEN 43              /* Instructions before the payload tests */
+#define TEST_LEN 4                /* Instructions per payload test */
+
+void add_test(struct bpf_insn *insn, const char *str, size_t len, int fold, unsigned int accept);
+void add_reject(struct bpf_insn *insn, int mode);
+
+/* Find the payload, leaving its first four bytes in scratch memory 0
+   and its offset in scratch memory 1; offsets, the snapshot length,
+   the accept value and the short payload return are filled in when it
+   is added */
+static const struct bpf_insn check[CHECK_LEN] = {
+        /* X = network header offset, past a VLAN tag */
+        BPF_STMT(BPF_LD | BPF_H | BPF_ABS, 12),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0x8100, 0, 2),
+        BPF_STMT(BPF_LDX | BPF_IMM, 4),
+        BPF_STMT(BPF_JMP | BPF_JA, 1),
+        BPF_STMT(BPF_LDX | BPF_IMM, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 4),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 4, 0, 9),
+
+        /* IPv4: X += header length, TCP only */
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 9),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 0),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x0f),
+        BPF_STMT(BPF_ALU | BPF_LSH | BPF_K, 2),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_JMP | BPF_JA, 7),
+
+        /* IPv6: X += 40 if TCP follows directly, anything
+           else is passed on to the parser */
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 6, 0, 2),
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 6),
+        BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, IPPROTO_TCP, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+        BPF_STMT(BPF_MISC | BPF_TXA, 0),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 40),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+
+        /* X += TCP header length */
+        BPF_STMT(BPF_LD | BPF_B | BPF_IND, 12),
+        BPF_STMT(BPF_ALU | BPF_RSH | BPF_K, 2),
+        BPF_STMT(BPF_ALU | BPF_AND | BPF_K, 0x3c),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_X, 0),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+
+        /* Keep the payload offset, and reject a payload
+           shorter than four bytes */
+        BPF_STMT(BPF_MISC | BPF_TXA, 0),
+        BPF_STMT(BPF_ST, 1),
+        BPF_STMT(BPF_ALU | BPF_ADD | BPF_K, 4),
+        BPF_STMT(BPF_MISC | BPF_TAX, 0),
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_X, 0, 2, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+
+        /* The length is that of the whole packet, but where the
+           filter runs on captured bytes the four bytes may lie
+           past the snapshot length; pass those on to the parser */
+        BPF_STMT(BPF_MISC | BPF_TXA, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, 0, 0, 1),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+
+        /* Keep the first four payload bytes */
+        BPF_STMT(BPF_LDX | BPF_MEM, 1),
+        BPF_STMT(BPF_LD | BPF_W | BPF_IND, 0),
+        BPF_STMT(BPF_ST, 0)
+};
+
+/* Chain the payload check onto the end of the filter program; the
+   network header is found link_offset bytes in, after any VLAN tag,
+   and then skip more bytes, and packets are captured up to snaplen
+   bytes. Packets that fail the check are dropped (PREFILTER_DROP) or
+   cut to their headers (PREFILTER_TRUNCATE). */
+void add_prefilter(struct bpf_program *filter, unsigned int link_offset, unsigned int skip, unsigned int snaplen,
+                   int mode) {
+        struct bpf_insn *prog, *insn;
+        unsigned int accept = 0, start, i, j, k;
+        const char *method;
+        size_t len;
+        int num_methods;
+
+#ifdef DEBUG
+        ASSERT(filter);
+#endif
+
+        for (num_methods = 0; method_name(num_methods, NULL); num_methods++);
+
+        /* Use the snapshot length the filter accepts packets with */
+        for (i = 0; i < filter->bf_len; i++) {
+                insn = &filter->bf_insns[i];
+                if ((insn->code == (BPF_RET | BPF_K)) && insn->k) {
+                        accept = insn->k;
+                        break;
+                }
+        }
+        if (accept == 0) return;
+
+        start = filter->bf_len;
+        prog = (struct bpf_insn *) calloc(start + CHECK_LEN + TEST_LEN * (num_methods + 1) + 2,
+                                          sizeof(struct bpf_insn));
+        if (!prog)
+                LOG_DIE("Cannot allocate memory for HTTP prefilter");
+
+        /* Send every packet the filter accepts on to the check */
+        memcpy(prog, filter->bf_insns, start * sizeof(struct bpf_insn));
+        for (i = 0; i < start; i++) {
+                if ((prog[i].code == (BPF_RET | BPF_K)) && prog[i].k) {
+                        prog[i].code = BPF_JMP | BPF_JA;
+                        prog[i].k = start - (i + 1);
+                        prog[i].jt = prog[i].jf = 0;
+                }
+        }
+
+        /* Fill in the link offsets, the snapshot lengths and the
+           return for a short payload */
+        memcpy(prog + start, check, sizeof(check));
+        prog[start + 2].k = link_offset + 4 + skip;
+        prog[start + 4].k = link_offset + skip;
+        prog[start + 20].k = accept;
+        add_reject(prog + start + 35, mode);
+        prog[start + 38].k = snaplen;
+        prog[start + 39].k = accept;
+
+        /* One test per distinct start of a method, then the response;
+           a test repeating an earlier one is overwritten by the next */
+        k = start + CHECK_LEN;
+        for (i = 0; (method = method_name(i, &len)); i++) {
+                add_test(prog + k, method, len, 1, accept);
+                for (j = start + CHECK_LEN; j < k; j += TEST_LEN) {
+                        if ((prog[j + 1].k == prog[k + 1].k) && (prog[j + 2].k == prog[k + 2].k)) break;
+                }
+                if (j == k) k += TEST_LEN;
+        }
+        add_test(prog + k, "HTTP", 4, 0, accept);
+        k += TEST_LEN;
+
+        add_reject(prog + k, mode);
+        k += 2;
+
+        free(filter->bf_insns);
+        filter->bf_insns = prog;
+        filter->bf_len = k;
+
+        return;
+}
+
+/* Write a test that accepts the packet if the payload starts with the
+   first len bytes of str, optionally ignoring the case of letters;
+   the first four payload bytes are held in scratch memory 0 */
+void add_test(struct bpf_insn *insn, const char *str, size_t len, int fold, unsigned int accept) {
+        unsigned int mask = 0, value = 0, m, c;
+        size_t i;
+
+        for (i = 0; i < 4; i++) {
+                c = (i < len) ? (unsigned char) str[i] : 0;
+                m = (i < len) ? 0xff : 0;
+                if (fold && isalpha(c)) {
+                        m = 0xdf;
+                        c = toupper(c);
+                }
+
+                mask = (mask << 8) | m;
+                value = (value << 8) | c;
+        }
+
+        insn[0].code = BPF_LD | BPF_MEM;
+        insn[0].k = 0;
+        insn[1].code = BPF_ALU | BPF_AND | BPF_K;
+        insn[1].k = mask;
+        insn[2].code = BPF_JMP | BPF_JEQ | BPF_K;
+        insn[2].k = value;
+        insn[2].jt = 0;
+        insn[2].jf = 1;
+        insn[3].code = BPF_RET | BPF_K;
+        insn[3].k = accept;
+
+        return;
+}
+
+/* Write the return for a packet that fails the check: either drop
+   it, or capture only the headers before the payload offset held in
+   scratch memory 1. Takes two instructions. */
+void add_reject(struct bpf_insn *insn, int mode) {
+        if (mode == PREFILTER_TRUNCATE) {
+                insn[0].code = BPF_LD | BPF_MEM;
+                insn[0].k = 1;
+                insn[1].code = BPF_RET | BPF_A;
+                insn[1].k = 0;
+        } else {
+                insn[0].code = BPF_RET | BPF_K;
+                insn[0].k = 0;
+                insn[1].code = BPF_RET | BPF_K;
+                insn[1].k = 0;
+        }
+
+        return;
+}
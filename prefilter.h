@@ -0,0 +1,23 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_PREFILTER_H
+#define _HAVE_PREFILTER_H
+
+#include <pcap.h>
+
+#define PREFILTER_DROP     1      /* Drop packets that cannot start a message */
+#define PREFILTER_TRUNCATE 2      /* Capture only their headers */
+
+void add_prefilter(struct bpf_program *filter, unsigned int link_offset, unsigned int skip, unsigned int snaplen,
+                   int mode);
+
+#endif /* ! _HAVE_PREFILTER_H */
@@ -9,6 +9,32 @@
 
 */
 
+/*
+  Each capture thread counts hosts in tables of its own, so the packet
+  path takes no lock (see writers.c). To take a snapshot the reporter
+  swaps every writer over to its other table, folds the old ones into
+  its long-running host hash, clears them and formats the output,
+  while the capture threads carry on writing.
+
+  Every host keeps a ring of one second slots covering the last minute,
+  each stamped with the second it counts so a stale slot is recognized
+  and reset rather than cleared on a timer. The reported rates are all
+  taken from the ring over the whole seconds before the report: the
+  last second, the busiest second, the minute average, and moving
+  averages weighted with 1, 10 and 60 second time constants. A host is
+  dropped once a full minute passes without a request from it.
+
+  In top-K mode the host tables are replaced with fixed size top-K
+  summaries, one per writer and epoch plus a running one owned by the
+  reporter, so memory stays bounded however many distinct keys arrive.
+  Only the totals keep their one second slots.
+
+  The reporter's host hash is a string table (see strtab.c) holding
+  each host name once; the writer tables keep their names in a buffer
+  of their own that is emptied at every snapshot.
+*/
+
+#include <ctype.h>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -19,19 +45,62 @@
 #include "config.h"
 #include "error.h"
 #include "rate.h"
-#include "utility.h"
+#include "strtab.h"
+#include "topk.h"
+#include "writers.h"
 
 #define MAX_HOST_LEN 255
 #define HASHSIZE 2048
 #define NODE_BLOCKSIZE 100
 #define NODE_ALLOC_BLOCKSIZE 10
+#define WRITER_NAMES_SIZE 65536
+#define RATE_SLOTS 60
+#define NUM_EWMA 3
+
+struct rate_slot {
+        unsigned int sec;         /* Low bits of the second counted */
+        unsigned int count;
+};
 
 struct host_stats {
-        char host[MAX_HOST_LEN + 1];
+        const char *host;
         unsigned int count;
         time_t first_packet;
         time_t last_packet;
-        struct host_stats *next;
+        struct rate_slot slots[RATE_SLOTS];
+        struct host_stats *next;  /* Free stack */
+};
+
+struct host_rates {
+        unsigned int current;     /* Requests in the last second */
+        unsigned int peak;        /* Most requests in any one second */
+        unsigned int window;      /* Requests in the whole window */
+        float ewma[NUM_EWMA];
+};
+
+/* Hosts seen by one writer during one interval; hosts the table has
+   no room for only count towards the totals */
+struct host_counts {
+        WRITER_TABLE *hosts;
+        struct host_stats totals;
+};
+
+struct writer {
+        struct host_counts counts[2];
+        TOPK *topk[2];            /* Used instead of the host tables in top-K mode */
+} __attribute__((aligned(64)));
+
+struct report_args {
+        char *st_time;
+        time_t end;
+        int rate_threshold;
+};
+
+struct top_args {
+        TOPK_ENTRY *entries;
+        unsigned int max;
+        unsigned int num;
+        time_t end;
 };
 
 struct thread_args {
@@ -43,30 +112,78 @@ struct thread_args {
 void create_rate_stats_thread(int rate_interval, char *use_infile, int rate_threshold);
 void exit_rate_stats_thread();
 void *run_stats(void *args);
-struct host_stats *remove_node(struct host_stats *node, struct host_stats *prev);
-struct host_stats *get_host(char *str);
+void swap_host_counts();
+void merge_host_counts(struct host_counts *counts);
+void merge_host(void *entry, void *arg);
+void merge_slots(struct host_stats *dst, struct host_stats *src);
+void count_packet(struct host_stats *node, time_t t);
+void get_host_rates(struct host_stats *node, time_t end, struct host_rates *rates);
+void print_host_rates(char *st_time, char *host, struct host_rates *rates);
+void init_ewma_weights();
+void display_top_keys(char *st_time, int rate_threshold);
+int report_host(const char *host, void *value, void *arg);
+int remove_host(const char *host, void *value, void *arg);
+int collect_host(const char *host, void *value, void *arg);
+struct host_stats *get_writer_host(struct host_counts *counts, const char *host, size_t host_len, time_t t);
 struct host_stats *get_node();
 
 static pthread_t thread;
 static int thread_created = 0;
-static pthread_mutex_t stats_lock;
-static struct host_stats **stats = NULL;
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static WRITERS *writer_set = NULL;
+static struct writer *writers = NULL;
+static int num_writers = 0;
+static unsigned int hosts_missed = 0;
+static unsigned int missed_reported = 0;
+static TOPK *topk = NULL;
+static TOPK_ENTRY *top_entries = NULL;
+static unsigned int topk_size = 0;
+static STRTAB *stats = NULL;
 static struct host_stats *free_stack = NULL;
 static struct host_stats **block_alloc = NULL;
+static unsigned int num_nodes = 0;
 static struct host_stats totals;
 static struct thread_args thread_args;
+static const int ewma_periods[NUM_EWMA] = { 1, 10, 60 };
+static float ewma_weights[NUM_EWMA][RATE_SLOTS];
+
+/* Initialize rate stats counters and structures for the given number
+   of capture threads, and start up the stats thread if necessary; a
+   nonzero top_size tracks only that many of the heaviest keys */
+void init_rate_stats(int rate_interval, char *use_infile, int rate_threshold, int writer_count,
+                     unsigned int top_size) {
+        int i, j;
 
-/* Initialize rate stats counters and structures, and
-   start up the stats thread if necessary */
-void init_rate_stats(int rate_interval, char *use_infile, int rate_threshold) {
         /* Initialize host totals */
-        totals.count = 0;
-        totals.first_packet = 0;
-        totals.last_packet = 0;
+        memset(&totals, 0, sizeof(totals));
+        init_ewma_weights();
+
+        /* Allocate host stats hash */
+        stats = strtab_new(HASHSIZE);
+
+        writer_set = writers_new(writer_count);
+        if (posix_memalign((void **) &writers, 64, writer_count * sizeof(struct writer)) != 0)
+                LOG_DIE("Cannot allocate memory for writer stats");
+        memset(writers, 0, writer_count * sizeof(struct writer));
+
+        topk_size = top_size;
+        if (topk_size) {
+                topk = topk_new(topk_size);
+                if ((top_entries = (TOPK_ENTRY *) calloc(topk_size, sizeof(TOPK_ENTRY))) == NULL)
+                        LOG_DIE("Cannot allocate memory for top-K report");
+        }
 
-        /* Allocate host stats hash array */
-        if ((stats = (struct host_stats **) calloc(HASHSIZE, sizeof(struct host_stats *))) == NULL)
-                LOG_DIE("Cannot allocate memory for host stats");
+        for (i = 0; i < writer_count; i++) {
+                for (j = 0; j < 2; j++) {
+                        if (topk_size) {
+                                writers[i].topk[j] = topk_new(topk_size);
+                                continue;
+                        }
+
+                        writers[i].counts[j].hosts = writer_table_new(sizeof(struct host_stats), WRITER_NAMES_SIZE);
+                }
+        }
+        num_writers = writer_count;
 
         if (!use_infile)
                 create_rate_stats_thread(rate_interval, use_infile, rate_threshold);
@@ -88,10 +205,7 @@ void create_rate_stats_thread(int rate_interval, char *use_infile, int rate_thre
         sigemptyset(&set);
         sigaddset(&set, SIGINT);
         sigaddset(&set, SIGHUP);
-
-        s = pthread_mutex_init(&stats_lock, NULL);
-        if (s != 0)
-                LOG_DIE("Statistics thread mutex initialization failed with error %d", s);
+        sigaddset(&set, SIGTERM);
 
         s = pthread_sigmask(SIG_BLOCK, &set, NULL);
         if (s != 0)
@@ -114,9 +228,30 @@ void create_rate_stats_thread(int rate_interval, char *use_infile, int rate_thre
    memory and clear necessary counters and structures */
 void cleanup_rate_stats() {
         struct host_stats **i;
+        int j;
 
         exit_rate_stats_thread();
 
+        if (writers != NULL) {
+                for (j = 0; j < num_writers; j++) {
+                        writer_table_free(writers[j].counts[0].hosts);
+                        writer_table_free(writers[j].counts[1].hosts);
+                        topk_free(writers[j].topk[0]);
+                        topk_free(writers[j].topk[1]);
+                }
+
+                free(writers);
+                writers = NULL;
+                num_writers = 0;
+                writers_free(writer_set);
+                writer_set = NULL;
+        }
+
+        topk_free(topk);
+        topk = NULL;
+        free(top_entries);
+        top_entries = NULL;
+
         if (block_alloc != NULL) {
                 for (i = block_alloc; *i; i++) {
                         free(*i);
@@ -124,18 +259,36 @@ void cleanup_rate_stats() {
 
                 free(block_alloc);
                 block_alloc = NULL;
+                num_nodes = 0;
         }
 
-        if (stats != NULL) {
-                free(stats);
-                stats = NULL;
-        }
+        strtab_free(stats);
+        stats = NULL;
 
         free_stack = NULL;
 
         return;
 }
 
+/* Drop all counts gathered so far, leaving the stats thread and the
+   writer tables in place so capture can continue */
+void reset_rate_stats() {
+        if (stats == NULL) return;
+
+        pthread_mutex_lock(&report_lock);
+
+        swap_host_counts();
+
+        strtab_clear(stats, remove_host, NULL);
+
+        memset(&totals, 0, sizeof(totals));
+        if (topk) topk_clear(topk);
+
+        pthread_mutex_unlock(&report_lock);
+
+        return;
+}
+
 /* Explicitly exit rate statistics thread */
 void exit_rate_stats_thread() {
         int s;
@@ -156,10 +309,6 @@ void exit_rate_stats_thread() {
 
         thread_created = 0;
 
-        s = pthread_mutex_destroy(&stats_lock);
-        if (s != 0)
-                LOG_WARN("Statistcs thread mutex destroy failed with error %d", s);
-
         return;
 }
 
@@ -167,9 +316,15 @@ void exit_rate_stats_thread() {
 void *run_stats (void *args) {
         struct thread_args *thread_args = (struct thread_args *) args;
 
+        int state;
+
         while (1) {
                 sleep(thread_args->rate_interval);
+
+                /* Don't get cancelled while holding the report lock */
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
                 display_rate_stats(thread_args->use_infile, thread_args->rate_threshold);
+                pthread_setcancelstate(state, NULL);
         }
 
         return (void *) 0;
@@ -177,173 +332,421 @@ void *run_stats (void *args) {
 
 /* Display the running average within each valid stats node */
 void display_rate_stats(char *use_infile, int rate_threshold) {
-        time_t now;
+        time_t now, end;
         char st_time[MAX_TIME_LEN];
-        unsigned int delta, rps = 0;
-        int i;
-        struct host_stats *node, *prev;
+        struct host_rates rates;
+        struct report_args report_args;
 
         if (stats == NULL) return;
 
-        if (thread_created)
-                pthread_mutex_lock(&stats_lock);
+        /* Only one snapshot is taken at a time; the capture threads
+           never touch this lock */
+        pthread_mutex_lock(&report_lock);
 
+        swap_host_counts();
+
+        /* Rates cover the whole seconds before end; from a file the
+           last second seen is taken to be complete */
         if (use_infile) {
                 now = totals.last_packet;
+                end = now + 1;
         } else {
                 now = time(NULL);
+                end = now;
         }
 
         strftime(st_time, MAX_TIME_LEN, "%Y-%m-%d %H:%M:%S", localtime(&now));
 
 #ifdef DEBUG
-        int j, num_buckets = 0, num_chain, max_chain = 0, num_nodes = 0;
-
-        for (j = 0; j < HASHSIZE; j++) {
-                if (stats[j]) num_buckets++;
+        struct strtab_stats tab_stats;
 
-                num_chain = 0;
-                for (node = stats[j]; node != NULL; node = node->next) num_chain++;
-                if (num_chain > max_chain) max_chain = num_chain;
-                num_nodes += num_chain;
-        }
+        strtab_stats(stats, &tab_stats);
 
         PRINT("----------------------------");
-        PRINT("Hash buckets:       %d", HASHSIZE);
-        PRINT("Nodes inserted:     %d", num_nodes);
-        PRINT("Buckets in use:     %d", num_buckets);
-        PRINT("Hash collisions:    %d", num_nodes - num_buckets);
-        PRINT("Longest hash chain: %d", max_chain);
+        PRINT("Hash slots:         %u", tab_stats.size);
+        PRINT("Hosts inserted:     %u", tab_stats.count);
+        PRINT("Hosts migrating:    %u", tab_stats.migrating);
+        PRINT("Longest probe:      %u", tab_stats.max_probe);
+        PRINT("Name arena chunks:  %u", tab_stats.arena_chunks);
+        PRINT("Hosts not counted:  %u", hosts_missed);
         PRINT("----------------------------");
 #endif
 
+        if (topk) {
+                display_top_keys(st_time, rate_threshold);
+                pthread_mutex_unlock(&report_lock);
+                return;
+        }
+
         /* Display rate stats for each valid host */
-        for (i = 0; i < HASHSIZE; i++) {
-                node = stats[i];
-                prev = NULL;
-
-                while (node != NULL) {
-                        delta = now - node->first_packet;
-                        if (delta > 0) {
-                                rps = (unsigned int) ceil(node->count / (float) delta);
-                        } else {
-                                rps = 0;
-                        }
+        report_args.st_time = st_time;
+        report_args.end = end;
+        report_args.rate_threshold = rate_threshold;
+        strtab_walk(stats, report_host, &report_args);
 
-                        if (rps >= rate_threshold) {
-                                printf("%s%s%s%s%u rps\n", st_time, FIELD_DELIM, node->host, FIELD_DELIM, rps);
-                                prev = node;
-                                node = node->next;
-                        } else {
-                                node = remove_node(node, prev);
-                        }
-                }
+        /* Display rate totals */
+        if (totals.first_packet) {
+                get_host_rates(&totals, end, &rates);
+                print_host_rates(st_time, "totals", &rates);
         }
 
-        /* Display rate totals */
-        delta = (unsigned int) (now - totals.first_packet);
-        if (delta > 0)
-                printf("%s%stotals%s%3.2f rps\n", st_time, FIELD_DELIM, FIELD_DELIM, (float) totals.count / delta);
+        /* Requests the writer tables had no room for are only in the
+           totals, so say how many there were */
+        if (hosts_missed != missed_reported) {
+                printf("# %u requests since the last report not counted by host\n", hosts_missed - missed_reported);
+                missed_reported = hosts_missed;
+        }
 
-        if (thread_created)
-                pthread_mutex_unlock(&stats_lock);
+        pthread_mutex_unlock(&report_lock);
 
         return;
 }
 
-/* Remove the given node from the hash and return it to the free stack;
-   returns the correct node for continuing to traverse the hash */
-struct host_stats *remove_node(struct host_stats *node, struct host_stats *prev) {
-        struct host_stats *next;
-        unsigned int hashval;
+/* Display the rates of one host; hosts idle for the whole window are
+   dropped from the hash */
+int report_host(const char *host, void *value, void *arg) {
+        struct report_args *args = (struct report_args *) arg;
+        struct host_stats *node = (struct host_stats *) value;
+        struct host_rates rates;
 
-        /* Unlink the node from the hash */
-        if (prev == NULL) {
-                hashval = hash_str(node->host, HASHSIZE);
+        get_host_rates(node, args->end, &rates);
 
-                if (node->next) {
-                        stats[hashval] = node->next;
-                } else {
-                        stats[hashval] = NULL;
+        if (rates.window == 0)
+                return remove_host(host, value, arg);
+
+        if (rates.peak >= args->rate_threshold)
+                print_host_rates(args->st_time, (char *) host, &rates);
+
+        return 0;
+}
+
+/* Display the heaviest keys, then the total with the error bound of
+   the counts; every count is within twice the total over the number
+   of counters of the true count, once from the writer summaries and
+   once from the running one */
+void display_top_keys(char *st_time, int rate_threshold) {
+        unsigned int num, total, i;
+
+        num = topk_sorted(topk, top_entries);
+        for (i = 0; (i < num) && (top_entries[i].count >= rate_threshold); i++)
+                printf("%s%s%s%s%u requests\n", st_time, FIELD_DELIM, top_entries[i].key, FIELD_DELIM, top_entries[i].count);
+
+        total = topk_total(topk);
+        printf("%s%stotals%s%u requests%s+/-%u\n", st_time, FIELD_DELIM, FIELD_DELIM, total, FIELD_DELIM,
+               (unsigned int) ((2ULL * total) / topk_size));
+
+        return;
+}
+
+/* Copy up to max of the heaviest hosts as of the last snapshot into
+   entries, most requests first, and return how many were copied; the
+   counts are over the last minute, or since the last reset in top-K
+   mode */
+unsigned int rate_top_hosts(char *use_infile, TOPK_ENTRY *entries, unsigned int max) {
+        struct top_args top_args;
+        unsigned int num;
+
+        if (stats == NULL) return 0;
+
+        pthread_mutex_lock(&report_lock);
+
+        if (topk) {
+                num = topk_sorted(topk, top_entries);
+                if (num > max) num = max;
+                memcpy(entries, top_entries, num * sizeof(TOPK_ENTRY));
+                pthread_mutex_unlock(&report_lock);
+                return num;
+        }
+
+        top_args.entries = entries;
+        top_args.max = max;
+        top_args.num = 0;
+        top_args.end = use_infile ? totals.last_packet + 1 : time(NULL);
+        strtab_walk(stats, collect_host, &top_args);
+
+        pthread_mutex_unlock(&report_lock);
+
+        return top_args.num;
+}
+
+/* Insert a host into the sorted list of the heaviest ones, if it is
+   heavy enough; the host is always kept in the hash */
+int collect_host(const char *host, void *value, void *arg) {
+        struct top_args *args = (struct top_args *) arg;
+        struct host_stats *node = (struct host_stats *) value;
+        struct host_rates rates;
+        unsigned int i;
+
+        get_host_rates(node, args->end, &rates);
+        if (rates.window == 0) return 0;
+
+        if (args->num == args->max) {
+                if (rates.window <= args->entries[args->num - 1].count) return 0;
+                args->num--;
+        }
+
+        for (i = args->num; (i > 0) && (args->entries[i - 1].count < rates.window); i--)
+                args->entries[i] = args->entries[i - 1];
+
+        snprintf(args->entries[i].key, TOPK_KEY_LEN, "%s", host);
+        args->entries[i].count = rates.window;
+        args->num++;
+
+        return 0;
+}
+
+/* Report the size of the reporter's host hash and the nodes behind it */
+void rate_pool_stats(struct rate_pool_stats *pool) {
+        struct strtab_stats tab_stats;
+
+        memset(pool, 0, sizeof(struct rate_pool_stats));
+        if (stats == NULL) return;
+
+        pthread_mutex_lock(&report_lock);
+
+        strtab_stats(stats, &tab_stats);
+        pool->hosts = tab_stats.count;
+        pool->nodes = num_nodes;
+        pool->slots = tab_stats.size;
+        pool->arena_chunks = tab_stats.arena_chunks;
+        pool->missed = hosts_missed;
+
+        pthread_mutex_unlock(&report_lock);
+
+        return;
+}
+
+/* Work out the rates of a host from its slots for the window of
+   whole seconds ending before end */
+void get_host_rates(struct host_stats *node, time_t end, struct host_rates *rates) {
+        struct rate_slot *slot;
+        unsigned int count;
+        time_t sec;
+        int age, i;
+
+        memset(rates, 0, sizeof(struct host_rates));
+
+        for (age = 0; age < RATE_SLOTS; age++) {
+                sec = end - 1 - age;
+                slot = &node->slots[sec % RATE_SLOTS];
+                count = (slot->sec == (unsigned int) sec) ? slot->count : 0;
+                if (count == 0) continue;
+
+                if (age == 0) rates->current = count;
+                if (count > rates->peak) rates->peak = count;
+                rates->window += count;
+
+                for (i = 0; i < NUM_EWMA; i++)
+                        rates->ewma[i] += ewma_weights[i][age] * count;
+        }
+
+        return;
+}
+
+void print_host_rates(char *st_time, char *host, struct host_rates *rates) {
+        printf("%s%s%s%s%u rps%s%u peak%s%0.2f avg%s%0.2f/%0.2f/%0.2f ewma\n",
+               st_time, FIELD_DELIM, host, FIELD_DELIM, rates->current, FIELD_DELIM,
+               rates->peak, FIELD_DELIM, (float) rates->window / RATE_SLOTS, FIELD_DELIM,
+               rates->ewma[0], rates->ewma[1], rates->ewma[2]);
+
+        return;
+}
+
+/* Weight each second of the window for the moving averages; the
+   weights decay with the given time constant and are scaled to sum
+   to one, since anything older than the window is not kept */
+void init_ewma_weights() {
+        float alpha, sum;
+        int i, age;
+
+        for (i = 0; i < NUM_EWMA; i++) {
+                alpha = exp(-1.0 / ewma_periods[i]);
+                sum = 0;
+                for (age = 0; age < RATE_SLOTS; age++) {
+                        ewma_weights[i][age] = (1 - alpha) * pow(alpha, age);
+                        sum += ewma_weights[i][age];
                 }
-                next = stats[hashval];
-        } else {
-                if (node->next) {
-                        prev->next = node->next;
-                } else {
-                        prev->next = NULL;
+
+                for (age = 0; age < RATE_SLOTS; age++)
+                        ewma_weights[i][age] /= sum;
+        }
+
+        return;
+}
+
+/* Point the writers at their other table, then fold the old tables
+   into the host hash */
+void swap_host_counts() {
+        unsigned int old;
+        int i;
+
+        if (writers == NULL) return;
+
+        old = writers_swap(writer_set);
+
+        for (i = 0; i < num_writers; i++) {
+                merge_host_counts(&writers[i].counts[old]);
+
+                if (topk) {
+                        topk_merge(topk, writers[i].topk[old]);
+                        topk_clear(writers[i].topk[old]);
                 }
-                next = prev->next;
         }
 
+        return;
+}
+
+/* Add a writer's counts for the last interval to the host hash and
+   clear them for reuse */
+void merge_host_counts(struct host_counts *counts) {
+        /* Top-K mode keeps no host tables */
+        if (counts->hosts)
+                hosts_missed += writer_table_clear(counts->hosts, merge_host, NULL);
+
+        if (counts->totals.count) {
+                if ((totals.first_packet == 0) || (counts->totals.first_packet < totals.first_packet))
+                        totals.first_packet = counts->totals.first_packet;
+                merge_slots(&totals, &counts->totals);
+        }
+        memset(&counts->totals, 0, sizeof(struct host_stats));
+
+        return;
+}
+
+/* Add a host's counts from a writer table to the host hash */
+void merge_host(void *entry, void *arg) {
+        struct host_stats *node, *slot = (struct host_stats *) entry;
+
+        if ((node = (struct host_stats *) strtab_get(stats, slot->host)) == NULL) {
+                node = get_node();
+
+                node->count = 0;
+                node->first_packet = slot->first_packet;
+                node->last_packet = 0;
+                memset(node->slots, 0, sizeof(node->slots));
+
+                /* The hash holds the one copy of the name */
+                node->host = strtab_insert(stats, slot->host, node);
+        }
+
+        if (node->first_packet == 0)
+                node->first_packet = slot->first_packet;
+        merge_slots(node, slot);
+
+        return;
+}
+
+/* Return a host's node to the free stack; called as the hash drops
+   the host, so the name goes with it */
+int remove_host(const char *host, void *value, void *arg) {
+        struct host_stats *node = (struct host_stats *) value;
+
+        node->host = NULL;
+
         /* Add the node to the head of the free stack */
         node->next = free_stack;
         free_stack = node;
 
-        return next;
+        return 1;
 }
 
-/* Update the stats for a given host; if the host is not
-   found in the hash, add it */
-void update_host_stats(char *host, time_t t) {
-        struct host_stats *node;
-        unsigned int hashval;
+/* Add the counts of src to dst, slot by slot; a slot of dst holding
+   an older second is replaced, and one holding a newer second wins */
+void merge_slots(struct host_stats *dst, struct host_stats *src) {
+        struct rate_slot *from, *to;
+        int i;
 
-        if ((host == NULL) || (stats == NULL)) return;
+        for (i = 0; i < RATE_SLOTS; i++) {
+                from = &src->slots[i];
+                to = &dst->slots[i];
+                if (from->count == 0) continue;
 
-        if (thread_created)
-                pthread_mutex_lock(&stats_lock);
+                if (to->sec == from->sec) {
+                        to->count += from->count;
+                } else if ((to->count == 0) || (from->sec > to->sec)) {
+                        *to = *from;
+                }
+        }
 
-        if ((node = get_host(host)) == NULL) {
-                node = get_node();
+        if (src->last_packet > dst->last_packet)
+                dst->last_packet = src->last_packet;
+        dst->count += src->count;
 
-                hashval = hash_str(host, HASHSIZE);
+        return;
+}
 
-#ifdef DEBUG
-        ASSERT((hashval >= 0) && (hashval < HASHSIZE));
-#endif
+/* Count a packet at time t in the node's slot for that second */
+void count_packet(struct host_stats *node, time_t t) {
+        struct rate_slot *slot = &node->slots[t % RATE_SLOTS];
 
-                str_copy(node->host, host, MAX_HOST_LEN);
-                node->count = 0;
-                node->first_packet = t;
+        node->last_packet = t;
+        node->count++;
+
+        if (slot->sec != (unsigned int) t) {
+                /* A packet from before the window is not counted */
+                if (slot->count && (slot->sec > (unsigned int) t)) return;
 
-                /* Link node into hash */
-                node->next = stats[hashval];
-                stats[hashval] = node;
+                slot->sec = t;
+                slot->count = 0;
         }
+        slot->count++;
 
-        if (node->first_packet == 0)
-                node->first_packet = t;
-        node->last_packet = t;
-        node->count++;
+        return;
+}
+
+/* Count a packet for the host named by len bytes at host in the
+   calling writer's table for the current epoch; if the host is not
+   found in the table, add it. Each writer must only be updated from a
+   single thread. */
+void update_host_stats(int writer, const char *host, size_t len, time_t t) {
+        struct writer *w;
+        struct host_counts *counts;
+        struct host_stats *node;
+        char key[TOPK_KEY_LEN];
+        unsigned int e;
+
+        if ((host == NULL) || (writers == NULL)) return;
+
+        w = &writers[writer];
+        e = writers_begin(writer_set, writer);
+        counts = &w->counts[e];
+
+        if (topk_size) {
+                if (len > TOPK_KEY_LEN - 1) len = TOPK_KEY_LEN - 1;
+                memcpy(key, host, len);
+                key[len] = '\0';
+                topk_add(w->topk[e], key, 1);
+        } else if ((node = get_writer_host(counts, host, len, t))) {
+                count_packet(node, t);
+        }
 
-        if (totals.first_packet == 0)
-                totals.first_packet = t;
-        totals.last_packet = t;
-        totals.count++;
+        if (counts->totals.first_packet == 0)
+                counts->totals.first_packet = t;
+        count_packet(&counts->totals, t);
 
-        if (thread_created)
-                pthread_mutex_unlock(&stats_lock);
+        writers_end(writer_set, writer);
 
         return;
 }
 
-/* Lookup a particular node in hash; return pointer to node
-   if found, NULL otherwise */
-struct host_stats *get_host(char *str) {
+/* Find the host in a writer's table, adding it if there is room;
+   returns NULL if the table is full */
+struct host_stats *get_writer_host(struct host_counts *counts, const char *host, size_t host_len, time_t t) {
         struct host_stats *node;
+        char name[MAX_HOST_LEN + 1];
+        size_t len;
+        int added;
 
-#ifdef DEBUG
-        ASSERT(str);
-        ASSERT(strlen(str) > 0);
-        ASSERT((hash_str(str, HASHSIZE) >= 0) && (hash_str(str, HASHSIZE) < HASHSIZE));
-#endif
+        /* Host names are kept in lowercase, so both tables can compare
+           them exactly */
+        for (len = 0; (len < host_len) && (len < MAX_HOST_LEN); len++)
+                name[len] = tolower(host[len]);
+        name[len] = '\0';
 
-        for (node = stats[hash_str(str, HASHSIZE)]; node != NULL; node = node->next)
-                if (str_compare(str, node->host) == 0)
-                        return node;
+        if ((node = (struct host_stats *) writer_table_get(counts->hosts, name, len, &added)) && added)
+                node->first_packet = t;
 
-        return NULL;
+        return node;
 }
 
 /* Get a new node from either the free stack or an allocated block;
@@ -398,6 +801,7 @@ struct host_stats *get_node() {
                 mv++;
                 *mv = NULL;
 
+                num_nodes += NODE_BLOCKSIZE;
                 tail = block + NODE_BLOCKSIZE - 1;
                 head = block;
                 block++;
@@ -12,9 +12,24 @@
 #ifndef _HAVE_RATE_H
 #define _HAVE_RATE_H
 
-void init_rate_stats(int display_interval, char *use_infile, int rate_threshold);
+#include "topk.h"
+
+/* Memory held by the reporter's host hash */
+struct rate_pool_stats {
+        unsigned int hosts;       /* Hosts in the hash */
+        unsigned int nodes;       /* Host nodes allocated */
+        unsigned int slots;       /* Slots in the hash */
+        unsigned int arena_chunks;
+        unsigned int missed;      /* Requests not counted by host for lack of room */
+};
+
+void init_rate_stats(int display_interval, char *use_infile, int rate_threshold, int writer_count,
+                     unsigned int top_size);
 void cleanup_rate_stats();
+void reset_rate_stats();
 void display_rate_stats(char *use_infile, int rate_threshold);
-void update_host_stats(char *host, time_t t);
+void update_host_stats(int writer, const char *host, size_t len, time_t t);
+unsigned int rate_top_hosts(char *use_infile, TOPK_ENTRY *entries, unsigned int max);
+void rate_pool_stats(struct rate_pool_stats *pool);
 
 #endif /* ! _HAVE_RATE_H */
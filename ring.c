@@ -0,0 +1,603 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  The ring capture backend maps a Linux AF_PACKET TPACKET_V3 receive
+  ring into our address space. The kernel fills fixed size blocks with
+  a variable number of packets and hands a block over to us once it is
+  full or its retire timeout expires. Packets are walked in place and
+  handed on in batches of pointers straight into the ring, so no
+  packet data is copied on its way to the parser; a block is only
+  returned to the kernel once its last batch has been parsed.
+
+  Several rings can be opened on the same device and joined to a
+  PACKET_FANOUT group. The kernel then spreads packets across them by
+  flow hash, so each capture worker sees both directions of a given
+  connection on its own socket.
+
+  Devices that strip VLAN tags in hardware hand the tag over beside the
+  frame instead of in it. The kernel filter lets such frames through
+  untested; the tag is put back into headroom reserved in front of the
+  frame and the capture filter is then run on the rebuilt frame, so
+  both the filter and the parser see what was on the wire.
+
+  For testing without a live interface, the same block layout can be
+  built in ordinary memory from a saved capture file. The offline ring
+  is filled from the file and then walked by exactly the same code that
+  handles the kernel ring.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "error.h"
+#include "ring.h"
+
+#ifdef __linux__
+
+#include <net/if.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <net/if_arp.h>
+#include <linux/filter.h>
+#include <linux/if_ether.h>
+#include <linux/if_packet.h>
+
+#define RING_FRAME_SIZE (TPACKET_ALIGNMENT << 7)
+#define BLOCK_DESC_LEN TPACKET_ALIGN(sizeof(struct tpacket_block_desc))
+#define FRAME_HDR_LEN TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+#define VLAN_TAG_LEN 4
+
+#ifndef ARPHRD_RAWIP
+#define ARPHRD_RAWIP 519
+#endif
+
+struct ring {
+        int fd;
+        pcap_t *pcap_hnd;            /* Packet source for an offline ring */
+        u_char *map;
+        size_t map_len;
+        unsigned int block_size;
+        unsigned int block_num;
+        unsigned int cur_block;
+        unsigned int timeout;
+        unsigned int max_frame;
+        int skip_outgoing;           /* Loopback devices see each packet twice */
+        int datalink;
+        struct bpf_program filter;   /* Run on frames with a restored VLAN tag */
+        volatile int break_loop;
+        struct pcap_stat totals;
+};
+
+RING *ring_alloc(unsigned int block_size, unsigned int block_num);
+int map_datalink(int fd, char *dev);
+void attach_filter(RING *ring, struct bpf_program *filter);
+unsigned int restore_vlan_tag(RING *ring, struct tpacket3_hdr *ppd, struct pcap_pkthdr *header);
+void walk_block(RING *ring, struct tpacket_block_desc *bd, PACKET_BATCH *batch,
+                batch_handler handler, u_char *args);
+int fill_block(RING *ring, struct tpacket_block_desc *bd);
+int ring_loop_offline(RING *ring, PACKET_BATCH *batch, batch_handler handler, u_char *args);
+
+/* Allocate and initialize the common parts of a ring handle */
+RING *ring_alloc(unsigned int block_size, unsigned int block_num) {
+        RING *ring;
+
+        if ((block_size == 0) || (block_size % getpagesize() != 0))
+                LOG_DIE("Ring block size must be a multiple of the page size (%d)", getpagesize());
+
+        if (block_num == 0)
+                LOG_DIE("Ring must contain at least one block");
+
+        if ((ring = (RING *) calloc(1, sizeof(RING))) == NULL)
+                LOG_DIE("Cannot allocate memory for ring handle");
+
+        ring->fd = -1;
+        ring->block_size = block_size;
+        ring->block_num = block_num;
+        ring->map_len = (size_t) block_size * block_num;
+
+        return ring;
+}
+
+/* Return the link type of the frames a ring on the given device
+   delivers; the filter must be compiled for it before the ring is
+   opened */
+int ring_datalink(char *dev) {
+        int fd, datalink;
+
+#ifdef DEBUG
+        ASSERT(dev);
+#endif
+
+        if ((fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1)
+                LOG_DIE("Cannot open packet socket: %s", strerror(errno));
+
+        datalink = map_datalink(fd, dev);
+        close(fd);
+
+        return datalink;
+}
+
+/* Map the hardware type of a device to a DLT_* value the way libpcap
+   does for a raw packet socket; devices that would need a cooked
+   header, such as PPP, are refused */
+int map_datalink(int fd, char *dev) {
+        struct ifreq ifr;
+
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+        if (ioctl(fd, SIOCGIFHWADDR, &ifr) == -1)
+                LOG_DIE("Cannot find hardware type of '%s': %s", dev, strerror(errno));
+
+        switch (ifr.ifr_hwaddr.sa_family) {
+                case ARPHRD_ETHER:
+                case ARPHRD_LOOPBACK:
+                        return DLT_EN10MB;
+                case ARPHRD_NONE:
+                case ARPHRD_RAWIP:
+                        /* Tunnels hand over bare IP packets */
+                        return DLT_RAW;
+                default:
+                        LOG_DIE("Ring capture is not supported on '%s' (hardware type %d), capture without -R",
+                                dev, ifr.ifr_hwaddr.sa_family);
+        }
+
+        return -1;
+}
+
+/* Open an AF_PACKET socket on the given device and map a TPACKET_V3
+   receive ring of block_num blocks, each block_size bytes long; a
+   non-zero fanout_id joins the socket to that fanout group */
+RING *ring_open(char *dev, int promisc, struct bpf_program *filter,
+                unsigned int block_size, unsigned int block_num, unsigned int timeout,
+                int fanout_id) {
+        RING *ring;
+        struct tpacket_req3 req;
+        struct sockaddr_ll ll;
+        struct packet_mreq mreq;
+        struct ifreq ifr;
+        int version = TPACKET_V3;
+        int reserve = VLAN_TAG_LEN;
+        int fanout;
+        unsigned int ifindex;
+
+#ifdef DEBUG
+        ASSERT(dev);
+        ASSERT(filter);
+#endif
+
+        ring = ring_alloc(block_size, block_num);
+        ring->timeout = timeout;
+
+        if ((ifindex = if_nametoindex(dev)) == 0)
+                LOG_DIE("Cannot find interface index for '%s'", dev);
+
+        if ((ring->fd = socket(AF_PACKET, SOCK_RAW, htons(ETH_P_ALL))) == -1)
+                LOG_DIE("Cannot open packet socket: %s", strerror(errno));
+
+        memset(&ifr, 0, sizeof(ifr));
+        strncpy(ifr.ifr_name, dev, IFNAMSIZ - 1);
+        if ((ioctl(ring->fd, SIOCGIFFLAGS, &ifr) == 0) && (ifr.ifr_flags & IFF_LOOPBACK))
+                ring->skip_outgoing = 1;
+        ring->datalink = map_datalink(ring->fd, dev);
+
+        if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) == -1)
+                LOG_DIE("Cannot select TPACKET_V3 ring version: %s", strerror(errno));
+
+        /* Leave room in front of each frame to put a stripped VLAN
+           tag back */
+        if ((ring->datalink == DLT_EN10MB) &&
+            (setsockopt(ring->fd, SOL_PACKET, PACKET_RESERVE, &reserve, sizeof(reserve)) == -1))
+                LOG_DIE("Cannot reserve VLAN tag room in ring frames: %s", strerror(errno));
+
+        attach_filter(ring, filter);
+
+        memset(&req, 0, sizeof(req));
+        req.tp_block_size = block_size;
+        req.tp_block_nr = block_num;
+        req.tp_frame_size = RING_FRAME_SIZE;
+        req.tp_frame_nr = (block_size / RING_FRAME_SIZE) * block_num;
+        req.tp_retire_blk_tov = timeout;
+        req.tp_feature_req_word = TP_FT_REQ_FILL_RXHASH;
+
+        if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &req, sizeof(req)) == -1)
+                LOG_DIE("Cannot create %u x %u byte capture ring: %s", block_num, block_size, strerror(errno));
+
+        ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_LOCKED, ring->fd, 0);
+        if (ring->map == MAP_FAILED)
+                LOG_DIE("Cannot map capture ring: %s", strerror(errno));
+
+        memset(&ll, 0, sizeof(ll));
+        ll.sll_family = AF_PACKET;
+        ll.sll_protocol = htons(ETH_P_ALL);
+        ll.sll_ifindex = ifindex;
+
+        if (bind(ring->fd, (struct sockaddr *) &ll, sizeof(ll)) == -1)
+                LOG_DIE("Cannot bind ring to '%s': %s", dev, strerror(errno));
+
+        if (promisc) {
+                memset(&mreq, 0, sizeof(mreq));
+                mreq.mr_ifindex = ifindex;
+                mreq.mr_type = PACKET_MR_PROMISC;
+
+                if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) == -1)
+                        LOG_WARN("Cannot enable promiscuous mode on '%s'", dev);
+        }
+
+        if (fanout_id) {
+                /* Hash on the flow so both directions of a connection
+                   land on the same socket, and reassemble fragments
+                   first so they hash like the rest of their flow */
+                fanout = (fanout_id & 0xffff) | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+                if (setsockopt(ring->fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) == -1)
+                        LOG_DIE("Cannot join fanout group %d: %s", fanout_id, strerror(errno));
+        }
+
+        return ring;
+}
+
+/* Attach the filter to the socket before it is bound, so nothing
+   unfiltered ever lands in the ring. On ethernet, frames whose VLAN
+   tag was stripped are let through and a copy of the filter is kept
+   to run on them once the tag is back. */
+void attach_filter(RING *ring, struct bpf_program *filter) {
+        struct sock_fprog fprog;
+        struct bpf_insn *prog;
+        unsigned int accept = 0, i;
+
+        if (ring->datalink != DLT_EN10MB) {
+                fprog.len = filter->bf_len;
+                fprog.filter = (struct sock_filter *) filter->bf_insns;
+                if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1)
+                        LOG_DIE("Cannot attach capture filter to ring: %s", strerror(errno));
+
+                return;
+        }
+
+        /* Use the snapshot length the filter accepts packets with */
+        for (i = 0; i < filter->bf_len; i++) {
+                if ((filter->bf_insns[i].code == (BPF_RET | BPF_K)) && filter->bf_insns[i].k) {
+                        accept = filter->bf_insns[i].k;
+                        break;
+                }
+        }
+
+        ring->filter.bf_len = filter->bf_len;
+        ring->filter.bf_insns = (struct bpf_insn *) malloc(filter->bf_len * sizeof(struct bpf_insn));
+        prog = (struct bpf_insn *) malloc((filter->bf_len + 3) * sizeof(struct bpf_insn));
+        if (!ring->filter.bf_insns || !prog)
+                LOG_DIE("Cannot allocate memory for ring capture filter");
+        memcpy(ring->filter.bf_insns, filter->bf_insns, filter->bf_len * sizeof(struct bpf_insn));
+
+        /* A jump's target is relative, so the filter still works
+           unchanged after the test in front of it */
+        prog[0] = (struct bpf_insn) BPF_STMT(BPF_LD | BPF_W | BPF_ABS, SKF_AD_OFF + SKF_AD_VLAN_TAG_PRESENT);
+        prog[1] = (struct bpf_insn) BPF_JUMP(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+        prog[2] = (struct bpf_insn) BPF_STMT(BPF_RET | BPF_K, accept);
+        memcpy(prog + 3, filter->bf_insns, filter->bf_len * sizeof(struct bpf_insn));
+
+        fprog.len = filter->bf_len + 3;
+        fprog.filter = (struct sock_filter *) prog;
+        if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &fprog, sizeof(fprog)) == -1)
+                LOG_DIE("Cannot attach capture filter to ring: %s", strerror(errno));
+
+        free(prog);
+
+        return;
+}
+
+/* Build an in-memory ring that is filled from an already opened
+   (and filtered) capture file; used as an offline stand-in */
+RING *ring_open_offline(pcap_t *pcap_hnd, unsigned int block_size, unsigned int block_num) {
+        RING *ring;
+
+#ifdef DEBUG
+        ASSERT(pcap_hnd);
+#endif
+
+        ring = ring_alloc(block_size, block_num);
+        ring->pcap_hnd = pcap_hnd;
+
+        /* Only add a packet to a block when the largest possible
+           frame is guaranteed to fit in the remaining space */
+        ring->max_frame = TPACKET_ALIGN(FRAME_HDR_LEN + pcap_snapshot(pcap_hnd));
+        if (BLOCK_DESC_LEN + ring->max_frame > block_size)
+                LOG_DIE("Ring block size is too small for a %d byte snaplen", pcap_snapshot(pcap_hnd));
+
+        if ((ring->map = (u_char *) malloc(ring->map_len)) == NULL)
+                LOG_DIE("Cannot allocate memory for offline capture ring");
+
+        return ring;
+}
+
+/* Hand the packets in a block to the handler in batches, pointing
+   directly into the block memory */
+void walk_block(RING *ring, struct tpacket_block_desc *bd, PACKET_BATCH *batch,
+                batch_handler handler, u_char *args) {
+        struct tpacket3_hdr *ppd;
+        struct sockaddr_ll *ll;
+        struct pcap_pkthdr *header;
+        unsigned int i;
+
+        ppd = (struct tpacket3_hdr *) ((u_char *) bd + bd->hdr.bh1.offset_to_first_pkt);
+        batch->count = 0;
+
+        for (i = 0; i < bd->hdr.bh1.num_pkts; i++) {
+                if (ring->skip_outgoing) {
+                        ll = (struct sockaddr_ll *) ((u_char *) ppd + FRAME_HDR_LEN);
+                        if (ll->sll_pkttype == PACKET_OUTGOING) {
+                                ppd = (struct tpacket3_hdr *) ((u_char *) ppd + ppd->tp_next_offset);
+                                continue;
+                        }
+                }
+
+                header = &batch->headers[batch->count];
+                header->ts.tv_sec = ppd->tp_sec;
+                header->ts.tv_usec = ppd->tp_nsec / 1000;
+                header->caplen = ppd->tp_snaplen;
+                header->len = ppd->tp_len;
+
+                if ((ppd->tp_status & TP_STATUS_VLAN_VALID) && ring->filter.bf_insns &&
+                    (restore_vlan_tag(ring, ppd, header) == 0)) {
+                        ppd = (struct tpacket3_hdr *) ((u_char *) ppd + ppd->tp_next_offset);
+                        continue;
+                }
+
+                batch->pkts[batch->count++] = (u_char *) ppd + ppd->tp_mac;
+
+                if (batch->count == batch->size) {
+                        handler(args, batch);
+                        batch->count = 0;
+                }
+
+                ppd = (struct tpacket3_hdr *) ((u_char *) ppd + ppd->tp_next_offset);
+        }
+
+        /* The block is handed back once we return, so nothing may be
+           left waiting in the batch */
+        if (batch->count > 0) {
+                handler(args, batch);
+                batch->count = 0;
+        }
+
+        return;
+}
+
+/* Put a VLAN tag the device stripped back between the MAC addresses
+   and the ethernet type, moving the frame start into the reserved
+   headroom, then run the filter the kernel skipped; returns the new
+   capture length, or 0 if the filter drops the frame */
+unsigned int restore_vlan_tag(RING *ring, struct tpacket3_hdr *ppd, struct pcap_pkthdr *header) {
+        u_char *frame = (u_char *) ppd + ppd->tp_mac;
+        unsigned int tpid = ETH_P_8021Q, keep;
+
+        if (header->caplen >= 2 * ETH_ALEN) {
+#ifdef TP_STATUS_VLAN_TPID_VALID
+                if (ppd->tp_status & TP_STATUS_VLAN_TPID_VALID)
+                        tpid = ppd->hv1.tp_vlan_tpid;
+#endif
+
+                memmove(frame - VLAN_TAG_LEN, frame, 2 * ETH_ALEN);
+                frame -= VLAN_TAG_LEN;
+                frame[2 * ETH_ALEN] = tpid >> 8;
+                frame[2 * ETH_ALEN + 1] = tpid & 0xff;
+                frame[2 * ETH_ALEN + 2] = ppd->hv1.tp_vlan_tci >> 8;
+                frame[2 * ETH_ALEN + 3] = ppd->hv1.tp_vlan_tci & 0xff;
+
+                ppd->tp_mac -= VLAN_TAG_LEN;
+                ppd->tp_status &= ~TP_STATUS_VLAN_VALID;
+                header->caplen += VLAN_TAG_LEN;
+                header->len += VLAN_TAG_LEN;
+        }
+
+        keep = bpf_filter(ring->filter.bf_insns, frame, header->len, header->caplen);
+        if (keep < header->caplen) header->caplen = keep;
+
+        return keep;
+}
+
+/* Main capture loop; mirrors pcap_loop() return values */
+int ring_loop(RING *ring, PACKET_BATCH *batch, batch_handler handler, u_char *args) {
+        struct tpacket_block_desc *bd;
+        struct pollfd pfd;
+
+#ifdef DEBUG
+        ASSERT(ring);
+        ASSERT(batch);
+        ASSERT(handler);
+#endif
+
+        if (ring->pcap_hnd) return ring_loop_offline(ring, batch, handler, args);
+
+        pfd.fd = ring->fd;
+        pfd.events = POLLIN | POLLERR;
+        pfd.revents = 0;
+
+        while (!ring->break_loop) {
+                bd = (struct tpacket_block_desc *) (ring->map + ((size_t) ring->cur_block * ring->block_size));
+
+                if ((__atomic_load_n(&bd->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0) {
+                        /* Wake up periodically so a break request is noticed */
+                        if ((poll(&pfd, 1, ring->timeout ? ring->timeout : 1000) == -1) && (errno != EINTR))
+                                return -1;
+                        continue;
+                }
+
+                /* A block is always walked to the end, so the loop can
+                   be entered again after a break without seeing any
+                   packet twice */
+                walk_block(ring, bd, batch, handler, args);
+
+                __atomic_store_n(&bd->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+                ring->cur_block = (ring->cur_block + 1) % ring->block_num;
+        }
+
+        ring->break_loop = 0;
+
+        return -2;
+}
+
+/* Copy packets from the capture file into a block using the same
+   layout the kernel would; returns the number of packets added */
+int fill_block(RING *ring, struct tpacket_block_desc *bd) {
+        struct tpacket3_hdr *ppd, *prev = NULL;
+        struct pcap_pkthdr *header;
+        const u_char *pkt;
+        unsigned int offset = BLOCK_DESC_LEN;
+
+        memset(bd, 0, sizeof(struct tpacket_block_desc));
+        bd->version = TPACKET_V3;
+        bd->hdr.bh1.offset_to_first_pkt = offset;
+
+        while (offset + ring->max_frame <= ring->block_size) {
+                if (pcap_next_ex(ring->pcap_hnd, &header, &pkt) != 1) break;
+
+                ppd = (struct tpacket3_hdr *) ((u_char *) bd + offset);
+                memset(ppd, 0, FRAME_HDR_LEN);
+                ppd->tp_sec = header->ts.tv_sec;
+                ppd->tp_nsec = header->ts.tv_usec * 1000;
+                ppd->tp_snaplen = header->caplen;
+                ppd->tp_len = header->len;
+                ppd->tp_mac = FRAME_HDR_LEN;
+                ppd->tp_net = FRAME_HDR_LEN;
+                ppd->tp_status = TP_STATUS_USER;
+                memcpy((u_char *) ppd + ppd->tp_mac, pkt, header->caplen);
+
+                if (prev) prev->tp_next_offset = (u_char *) ppd - (u_char *) prev;
+                prev = ppd;
+
+                if (bd->hdr.bh1.num_pkts == 0) {
+                        bd->hdr.bh1.ts_first_pkt.ts_sec = ppd->tp_sec;
+                        bd->hdr.bh1.ts_first_pkt.ts_nsec = ppd->tp_nsec;
+                }
+                bd->hdr.bh1.ts_last_pkt.ts_sec = ppd->tp_sec;
+                bd->hdr.bh1.ts_last_pkt.ts_nsec = ppd->tp_nsec;
+                bd->hdr.bh1.num_pkts++;
+
+                offset += TPACKET_ALIGN(FRAME_HDR_LEN + header->caplen);
+                ring->totals.ps_recv++;
+        }
+
+        bd->hdr.bh1.blk_len = offset;
+        if (bd->hdr.bh1.num_pkts > 0)
+                bd->hdr.bh1.block_status = TP_STATUS_USER;
+
+        return bd->hdr.bh1.num_pkts;
+}
+
+/* Offline variant of the capture loop; fills every free block from
+   the capture file and then walks them in ring order */
+int ring_loop_offline(RING *ring, PACKET_BATCH *batch, batch_handler handler, u_char *args) {
+        struct tpacket_block_desc *bd;
+        unsigned int i, filled;
+
+        while (!ring->break_loop) {
+                for (filled = 0; filled < ring->block_num; filled++) {
+                        bd = (struct tpacket_block_desc *) (ring->map + ((size_t) filled * ring->block_size));
+                        if (fill_block(ring, bd) == 0) break;
+                }
+
+                if (filled == 0) return 0;
+
+                for (i = 0; i < filled; i++) {
+                        bd = (struct tpacket_block_desc *) (ring->map + ((size_t) i * ring->block_size));
+                        walk_block(ring, bd, batch, handler, args);
+                        bd->hdr.bh1.block_status = TP_STATUS_KERNEL;
+                }
+        }
+
+        ring->break_loop = 0;
+
+        return -2;
+}
+
+/* Request that the capture loop return after the current batch */
+void ring_breakloop(RING *ring) {
+        if (ring) ring->break_loop = 1;
+
+        return;
+}
+
+/* Retrieve capture statistics; the kernel resets its counters on
+   each read, so running totals are kept in the handle */
+int ring_stats(RING *ring, struct pcap_stat *ps) {
+        struct tpacket_stats_v3 st;
+        socklen_t len = sizeof(st);
+
+#ifdef DEBUG
+        ASSERT(ring);
+        ASSERT(ps);
+#endif
+
+        if (ring->fd != -1) {
+                if (getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &st, &len) == -1) {
+                        WARN("Cannot obtain ring capture statistics: %s", strerror(errno));
+                        return -1;
+                }
+
+                ring->totals.ps_recv += st.tp_packets;
+                ring->totals.ps_drop += st.tp_drops;
+        }
+
+        *ps = ring->totals;
+
+        return 0;
+}
+
+/* Unmap the ring and release the socket */
+void ring_close(RING *ring) {
+        if (!ring) return;
+
+        if (ring->fd != -1) {
+                if (ring->map && (ring->map != MAP_FAILED))
+                        munmap(ring->map, ring->map_len);
+                close(ring->fd);
+        } else {
+                free(ring->map);
+        }
+
+        free(ring->filter.bf_insns);
+
+        free(ring);
+
+        return;
+}
+
+#else /* ! __linux__ */
+
+RING *ring_open(char *dev, int promisc, struct bpf_program *filter,
+                unsigned int block_size, unsigned int block_num, unsigned int timeout,
+                int fanout_id) {
+        LOG_DIE("Ring capture is only supported on Linux");
+        return NULL;
+}
+
+RING *ring_open_offline(pcap_t *pcap_hnd, unsigned int block_size, unsigned int block_num) {
+        LOG_DIE("Ring capture is only supported on Linux");
+        return NULL;
+}
+
+int ring_datalink(char *dev) {
+        LOG_DIE("Ring capture is only supported on Linux");
+        return -1;
+}
+
+int ring_loop(RING *ring, PACKET_BATCH *batch, batch_handler handler, u_char *args) { return -1; }
+void ring_breakloop(RING *ring) { return; }
+int ring_stats(RING *ring, struct pcap_stat *ps) { return -1; }
+void ring_close(RING *ring) { return; }
+
+#endif /* __linux__ */
@@ -0,0 +1,30 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_RING_H
+#define _HAVE_RING_H
+
+#include <pcap.h>
+#include "batch.h"
+
+typedef struct ring RING;
+
+int ring_datalink(char *dev);
+RING *ring_open(char *dev, int promisc, struct bpf_program *filter,
+                unsigned int block_size, unsigned int block_num, unsigned int timeout,
+                int fanout_id);
+RING *ring_open_offline(pcap_t *pcap_hnd, unsigned int block_size, unsigned int block_num);
+int ring_loop(RING *ring, PACKET_BATCH *batch, batch_handler handler, u_char *args);
+void ring_breakloop(RING *ring);
+int ring_stats(RING *ring, struct pcap_stat *ps);
+void ring_close(RING *ring);
+
+#endif /* ! _HAVE_RING_H */
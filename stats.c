@@ -0,0 +1,290 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Parser counters are kept per capture worker, each in a cache line
+  of its own, and are bumped with plain increments on the packet path;
+  nothing there takes a lock or issues an atomic instruction. Readers
+  sum the sets with relaxed loads, so a report may be a packet behind
+  but never blocks or slows a worker.
+
+  Stage times are kept in read_cycles() units, which are converted to
+  nanoseconds by timing the counter against the monotonic clock from
+  the moment the counters are created.
+
+  A reporter thread can print a line every few seconds with the rates
+  and rejection counts since the previous line, so a drop in
+  throughput can be traced to the packets that caused it.
+*/
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "error.h"
+#include "stats.h"
+#include "utility.h"
+
+void create_reporter_thread();
+void *run_reporter(void *args);
+void report_interval(PARSE_STATS *prev, double seconds);
+unsigned long long monotonic_ns();
+
+static PARSE_STATS *sets = NULL;
+static int num_sets = 0;
+static unsigned long long start_ns = 0;
+static unsigned long long start_cycles = 0;
+static pthread_t thread;
+static int thread_created = 0;
+static unsigned int report_interval_sec = 0;
+static int report_timed = 0;
+
+static const char *reject_names[NUM_REJECTS] = {
+        "non-ip", "non-tcp", "short-header", "no-payload", "not-method", "malformed"
+};
+
+static const char *stage_names[NUM_STAGES] = {
+        "decode", "filter", "scan", "emit"
+};
+
+/* Allocate a zeroed set of counters for each of count workers */
+PARSE_STATS *stats_new(int count) {
+        void *mem = NULL;
+
+#ifdef DEBUG
+        ASSERT(count > 0);
+#endif
+
+        if (posix_memalign(&mem, sizeof(PARSE_STATS), count * sizeof(PARSE_STATS)) != 0)
+                LOG_DIE("Cannot allocate memory for parser counters");
+        memset(mem, 0, count * sizeof(PARSE_STATS));
+
+        sets = (PARSE_STATS *) mem;
+        num_sets = count;
+        start_ns = monotonic_ns();
+        start_cycles = read_cycles();
+
+        return sets;
+}
+
+/* Add up the counters of every worker into total */
+void stats_sum(PARSE_STATS *total) {
+        unsigned long long *dst, *src;
+        size_t i, n = sizeof(PARSE_STATS) / sizeof(unsigned long long);
+        int w;
+
+        memset(total, 0, sizeof(PARSE_STATS));
+
+        for (w = 0; w < num_sets; w++) {
+                dst = (unsigned long long *) total;
+                src = (unsigned long long *) &sets[w];
+                for (i = 0; i < n; i++)
+                        dst[i] += __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+        }
+
+        return;
+}
+
+/* Return the nanoseconds per read_cycles() unit measured so far */
+double stats_ns_per_cycle() {
+        unsigned long long cycles = read_cycles() - start_cycles;
+
+        if (cycles == 0) return 1.0;
+
+        return (double) (monotonic_ns() - start_ns) / cycles;
+}
+
+/* Return the name of a REJECT_* reason */
+const char *stats_reject_name(int reason) {
+        return reject_names[reason - 1];
+}
+
+/* Return the name of a parser stage */
+const char *stats_stage_name(int stage) {
+        return stage_names[stage];
+}
+
+/* Print a line with the rates since the previous one every interval
+   seconds; stage times are only reported if timed is set */
+void stats_start_reporter(unsigned int interval, int timed) {
+        if (!sets || thread_created) return;
+
+        report_interval_sec = interval;
+        report_timed = timed;
+        create_reporter_thread();
+
+        return;
+}
+
+/* Spawn the reporter thread, keeping signals for the main thread */
+void create_reporter_thread() {
+        sigset_t set;
+        int s;
+
+        sigemptyset(&set);
+        sigaddset(&set, SIGINT);
+        sigaddset(&set, SIGHUP);
+        sigaddset(&set, SIGTERM);
+
+        s = pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Stats reporter signal blocking failed with error %d", s);
+
+        s = pthread_create(&thread, NULL, run_reporter, NULL);
+        if (s != 0)
+                LOG_DIE("Stats reporter creation failed with error %d", s);
+
+        s = pthread_sigmask(SIG_UNBLOCK, &set, NULL);
+        if (s != 0)
+                LOG_DIE("Stats reporter signal unblocking failed with error %d", s);
+
+        thread_created = 1;
+
+        return;
+}
+
+/* Cancel the reporter thread, if running */
+void stats_stop_reporter() {
+        int s;
+
+        if (!thread_created) return;
+
+        s = pthread_cancel(thread);
+        if (s != 0)
+                LOG_WARN("Stats reporter cancellation failed with error %d", s);
+
+        s = pthread_join(thread, NULL);
+        if (s != 0)
+                LOG_WARN("Stats reporter join failed with error %d", s);
+
+        thread_created = 0;
+
+        return;
+}
+
+/* This is the reporter thread */
+void *run_reporter(void *args) {
+        PARSE_STATS prev;
+        unsigned long long last, now;
+        int state;
+
+        stats_sum(&prev);
+        last = monotonic_ns();
+
+        while (1) {
+                sleep(report_interval_sec);
+
+                /* Don't get cancelled halfway through a line */
+                pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, &state);
+                now = monotonic_ns();
+                report_interval(&prev, (now - last) / 1e9);
+                last = now;
+                pthread_setcancelstate(state, NULL);
+        }
+
+        return (void *) 0;
+}
+
+/* Print the rates since prev, which is then updated to the current
+   counts */
+void report_interval(PARSE_STATS *prev, double seconds) {
+        PARSE_STATS curr;
+        unsigned long long packets;
+        char line[512];
+        size_t len;
+        double ns_per_cycle;
+        int i;
+
+        stats_sum(&curr);
+        if (seconds <= 0) seconds = 1;
+        packets = curr.packets - prev->packets;
+
+        len = snprintf(line, sizeof(line), "%0.0f packets/s, %0.2f MB/s, %0.0f records/s, %0.2f MB/s out;",
+                       (curr.packets - prev->packets) / seconds,
+                       (curr.bytes - prev->bytes) / seconds / 1e6,
+                       (curr.records - prev->records) / seconds,
+                       (curr.out_bytes - prev->out_bytes) / seconds / 1e6);
+
+        for (i = 0; (i < NUM_REJECTS) && (len < sizeof(line)); i++) {
+                len += snprintf(line + len, sizeof(line) - len, " %llu %s",
+                                curr.rejected[i] - prev->rejected[i], reject_names[i]);
+        }
+
+        if (report_timed && packets) {
+                ns_per_cycle = stats_ns_per_cycle();
+                for (i = 0; (i < NUM_STAGES) && (len < sizeof(line)); i++) {
+                        len += snprintf(line + len, sizeof(line) - len, "%s %s %0.1f ns",
+                                        i ? "," : ";", stage_names[i],
+                                        (curr.stage_cycles[i] - prev->stage_cycles[i]) * ns_per_cycle / packets);
+                }
+                if (len < sizeof(line))
+                        snprintf(line + len, sizeof(line) - len, " per packet");
+        }
+
+        LOG_PRINT("%s", line);
+
+        memcpy(prev, &curr, sizeof(PARSE_STATS));
+
+        return;
+}
+
+/* Print the totals counted since the start */
+void stats_print_totals(int timed) {
+        PARSE_STATS total;
+        char line[512];
+        size_t len;
+        double ns_per_cycle;
+        int i;
+
+        if (!sets) return;
+
+        stats_sum(&total);
+
+        LOG_PRINT("%llu packets decoded (%llu bytes, %llu scanned); %llu records logged (%llu bytes)", \
+             total.packets, total.bytes, total.scanned, total.records, total.out_bytes);
+
+        len = snprintf(line, sizeof(line), "Packets rejected:");
+        for (i = 0; (i < NUM_REJECTS) && (len < sizeof(line)); i++) {
+                len += snprintf(line + len, sizeof(line) - len, "%s %llu %s",
+                                i ? "," : "", total.rejected[i], reject_names[i]);
+        }
+        LOG_PRINT("%s", line);
+
+        if (timed) {
+                ns_per_cycle = stats_ns_per_cycle();
+                for (i = 0; i < NUM_STAGES; i++) {
+                        LOG_PRINT("  %-8s %0.3f seconds", stage_names[i],
+                             total.stage_cycles[i] * ns_per_cycle / 1e9);
+                }
+        }
+
+        return;
+}
+
+/* Free the counters; the reporter must be stopped first */
+void stats_free() {
+        free(sets);
+        sets = NULL;
+        num_sets = 0;
+
+        return;
+}
+
+/* Return the monotonic clock in nanoseconds */
+unsigned long long monotonic_ns() {
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
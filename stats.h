@@ -0,0 +1,48 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_STATS_H
+#define _HAVE_STATS_H
+
+#include "packet.h"
+
+/* Parser stages, timed when stage timing is enabled */
+#define STAGE_DECODE 0
+#define STAGE_FILTER 1
+#define STAGE_SCAN   2
+#define STAGE_EMIT   3
+#define NUM_STAGES   4
+
+/* Counters kept by a single capture worker and only ever written by
+   it; each set is aligned to a cache line of its own */
+typedef struct parse_stats {
+        unsigned long long packets;       /* Packets handed to the parser */
+        unsigned long long bytes;         /* Bytes captured of them */
+        unsigned long long scanned;       /* Payload bytes scanned for headers */
+        unsigned long long records;       /* Messages logged */
+        unsigned long long out_bytes;     /* Output written for them */
+        unsigned long long rejected[NUM_REJECTS];
+        unsigned long long stage_cycles[NUM_STAGES];
+} __attribute__((aligned(64))) PARSE_STATS;
+
+#define COUNT_REJECT(stats, reason) ((stats)->rejected[(reason) - 1]++)
+
+PARSE_STATS *stats_new(int count);
+void stats_sum(PARSE_STATS *total);
+double stats_ns_per_cycle();
+const char *stats_reject_name(int reason);
+const char *stats_stage_name(int stage);
+void stats_start_reporter(unsigned int interval, int timed);
+void stats_stop_reporter();
+void stats_print_totals(int timed);
+void stats_free();
+
+#endif /* ! _HAVE_STATS_H */
@@ -0,0 +1,284 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  A stream table buffers the start of HTTP messages whose headers are
+  split across TCP segments, until the end of the headers is seen or
+  the byte cap is reached. Each capture worker owns its own table, so
+  no locking is done here.
+
+  All streams come from a pool allocated up front, so memory use is
+  bounded by the number of streams times the byte cap no matter what
+  arrives on the wire. Streams are kept on a list in order of last
+  activity; when the pool runs dry the least recently used stream is
+  handed to the flush callback and reused, and streams idle for longer
+  than the timeout are flushed the same way by stream_expire(). Only
+  payloads that look like the start of a message ever take a stream,
+  so bare SYNs and other empty segments cost nothing.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "stream.h"
+
+struct stream_table {
+        STREAM *pool;
+        STREAM **buckets;
+        unsigned int hash_mask;
+        STREAM *free_list;
+        STREAM *lru_head, *lru_tail;     /* Most and least recently used */
+        unsigned int max_streams;
+        size_t max_bytes;
+        unsigned int timeout;
+        STREAM_FLUSH flush;
+        void *arg;
+        struct stream_stats stats;
+};
+
+void lru_unlink(STREAM_TABLE *table, STREAM *stream);
+void lru_push(STREAM_TABLE *table, STREAM *stream);
+
+/* Create a table of up to max_streams streams of max_bytes each;
+   streams idle for timeout seconds are dropped by stream_expire() */
+STREAM_TABLE *stream_table_new(unsigned int max_streams, size_t max_bytes, unsigned int timeout,
+                               STREAM_FLUSH flush, void *arg) {
+        STREAM_TABLE *table;
+        unsigned int size, i;
+
+#ifdef DEBUG
+        ASSERT(max_streams > 0);
+        ASSERT(max_bytes > 0);
+        ASSERT(flush);
+#endif
+
+        if ((table = (STREAM_TABLE *) calloc(1, sizeof(STREAM_TABLE))) == NULL)
+                LOG_DIE("Cannot allocate memory for stream table");
+
+        if ((table->pool = (STREAM *) calloc(max_streams, sizeof(STREAM))) == NULL)
+                LOG_DIE("Cannot allocate memory for stream pool");
+
+        for (size = 1; size < max_streams * 2; size <<= 1);
+        if ((table->buckets = (STREAM **) calloc(size, sizeof(STREAM *))) == NULL)
+                LOG_DIE("Cannot allocate memory for stream hash");
+
+        for (i = 0; i < max_streams; i++) {
+                table->pool[i].next = table->free_list;
+                table->free_list = &table->pool[i];
+        }
+
+        table->hash_mask = size - 1;
+        table->max_streams = max_streams;
+        table->max_bytes = max_bytes;
+        table->timeout = timeout;
+        table->flush = flush;
+        table->arg = arg;
+
+        return table;
+}
+
+/* Return the stream buffering the given flow, or NULL */
+STREAM *stream_find(STREAM_TABLE *table, const FLOW_KEY *key) {
+        STREAM *stream;
+
+        for (stream = table->buckets[hash_flow(key) & table->hash_mask]; stream; stream = stream->next) {
+                if (flow_equal(&stream->key, key))
+                        return stream;
+        }
+
+        return NULL;
+}
+
+/* Start buffering a new message for the flow, flushing the least
+   recently used stream if the pool is exhausted */
+STREAM *stream_new(STREAM_TABLE *table, const FLOW_KEY *key, const struct timeval *ts) {
+        STREAM *stream, **bucket;
+
+#ifdef DEBUG
+        ASSERT(stream_find(table, key) == NULL);
+#endif
+
+        if (!table->free_list) {
+                stream = table->lru_tail;
+                table->flush(stream, table->arg);
+                stream_release(table, stream);
+                table->stats.evicted++;
+        }
+
+        stream = table->free_list;
+        table->free_list = stream->next;
+
+        /* Buffers are allocated the first time a stream is used and
+           then kept for the life of the table */
+        if (!stream->data && ((stream->data = (char *) malloc(table->max_bytes + 1)) == NULL))
+                LOG_DIE("Cannot allocate memory for stream buffer");
+
+        memcpy(&stream->key, key, sizeof(FLOW_KEY));
+        stream->ts = *ts;
+        stream->len = 0;
+        stream->data[0] = '\0';
+        stream->last_seen = ts->tv_sec;
+
+        bucket = &table->buckets[hash_flow(key) & table->hash_mask];
+        stream->next = *bucket;
+        *bucket = stream;
+        lru_push(table, stream);
+
+        table->stats.started++;
+
+        return stream;
+}
+
+/* Append a segment to the stream; returns 1 once the stream holds the
+   end of the headers or has reached the byte cap, 0 otherwise */
+int stream_append(STREAM_TABLE *table, STREAM *stream, const char *data, size_t len, time_t now) {
+        size_t from;
+
+        from = (stream->len > 3) ? stream->len - 3 : 0;
+        if (len > table->max_bytes - stream->len)
+                len = table->max_bytes - stream->len;
+
+        memcpy(stream->data + stream->len, data, len);
+        stream->len += len;
+        stream->data[stream->len] = '\0';
+        stream->last_seen = now;
+
+        lru_unlink(table, stream);
+        lru_push(table, stream);
+
+        if (find_header_end(stream->data, stream->len, from)) {
+                table->stats.completed++;
+                return 1;
+        }
+
+        if (stream->len == table->max_bytes) {
+                table->stats.capped++;
+                return 1;
+        }
+
+        return 0;
+}
+
+/* Return the stream to the pool */
+void stream_release(STREAM_TABLE *table, STREAM *stream) {
+        STREAM **node;
+
+        for (node = &table->buckets[hash_flow(&stream->key) & table->hash_mask]; *node; node = &(*node)->next) {
+                if (*node == stream) {
+                        *node = stream->next;
+                        break;
+                }
+        }
+
+        lru_unlink(table, stream);
+
+        stream->next = table->free_list;
+        table->free_list = stream;
+
+        return;
+}
+
+/* Flush and release every stream that has been idle for the timeout */
+void stream_expire(STREAM_TABLE *table, time_t now) {
+        STREAM *stream;
+
+        while ((stream = table->lru_tail) && (now - stream->last_seen >= table->timeout)) {
+                table->flush(stream, table->arg);
+                stream_release(table, stream);
+                table->stats.expired++;
+        }
+
+        return;
+}
+
+/* Flush and release every stream, oldest first */
+void stream_flush_all(STREAM_TABLE *table) {
+        STREAM *stream;
+
+        if (!table) return;
+
+        while ((stream = table->lru_tail)) {
+                table->flush(stream, table->arg);
+                stream_release(table, stream);
+        }
+
+        return;
+}
+
+void stream_stats(STREAM_TABLE *table, struct stream_stats *stats) {
+        memcpy(stats, &table->stats, sizeof(struct stream_stats));
+
+        return;
+}
+
+void stream_table_free(STREAM_TABLE *table) {
+        unsigned int i;
+
+        if (!table) return;
+
+        for (i = 0; i < table->max_streams; i++)
+                free(table->pool[i].data);
+
+        free(table->pool);
+        free(table->buckets);
+        free(table);
+
+        return;
+}
+
+/* Return the offset just past the blank line that ends a header block,
+   looking for the line break at or after from, or 0 if not found */
+size_t find_header_end(const char *data, size_t len, size_t from) {
+        const char *p, *end = data + len;
+
+        for (p = data + from; (p = memchr(p, '\n', end - p)); p++) {
+                if ((p + 1 < end) && (p[1] == '\n'))
+                        return p + 2 - data;
+                if ((p + 2 < end) && (p[1] == '\r') && (p[2] == '\n'))
+                        return p + 3 - data;
+        }
+
+        return 0;
+}
+
+void lru_unlink(STREAM_TABLE *table, STREAM *stream) {
+        if (stream->prev_lru) {
+                stream->prev_lru->next_lru = stream->next_lru;
+        } else {
+                table->lru_head = stream->next_lru;
+        }
+
+        if (stream->next_lru) {
+                stream->next_lru->prev_lru = stream->prev_lru;
+        } else {
+                table->lru_tail = stream->prev_lru;
+        }
+
+        stream->prev_lru = stream->next_lru = NULL;
+
+        return;
+}
+
+void lru_push(STREAM_TABLE *table, STREAM *stream) {
+        stream->prev_lru = NULL;
+        stream->next_lru = table->lru_head;
+
+        if (table->lru_head) {
+                table->lru_head->prev_lru = stream;
+        } else {
+                table->lru_tail = stream;
+        }
+        table->lru_head = stream;
+
+        return;
+}
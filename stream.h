@@ -0,0 +1,57 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_STREAM_H
+#define _HAVE_STREAM_H
+
+#include <sys/time.h>
+#include <sys/types.h>
+#include "flow.h"
+
+typedef struct stream STREAM;
+struct stream {
+        FLOW_KEY key;
+        struct timeval ts;        /* Capture time of the first segment */
+        unsigned int next_seq;    /* Sequence number of the next segment */
+        char *data;               /* Buffered message, NUL terminated */
+        size_t len;
+        time_t last_seen;
+        STREAM *next;             /* Hash chain or free list */
+        STREAM *prev_lru, *next_lru;
+};
+
+typedef struct stream_table STREAM_TABLE;
+
+/* Called with a stream that is about to be dropped by stream_expire()
+   or to make room for a new stream, so it can be logged as is */
+typedef void (*STREAM_FLUSH)(STREAM *stream, void *arg);
+
+struct stream_stats {
+        unsigned int started;     /* Streams buffered */
+        unsigned int completed;   /* Reached the end of the headers */
+        unsigned int capped;      /* Reached the byte cap */
+        unsigned int expired;     /* Idle for longer than the timeout */
+        unsigned int evicted;     /* Dropped to make room */
+};
+
+STREAM_TABLE *stream_table_new(unsigned int max_streams, size_t max_bytes, unsigned int timeout,
+                               STREAM_FLUSH flush, void *arg);
+STREAM *stream_find(STREAM_TABLE *table, const FLOW_KEY *key);
+STREAM *stream_new(STREAM_TABLE *table, const FLOW_KEY *key, const struct timeval *ts);
+int stream_append(STREAM_TABLE *table, STREAM *stream, const char *data, size_t len, time_t now);
+void stream_release(STREAM_TABLE *table, STREAM *stream);
+void stream_expire(STREAM_TABLE *table, time_t now);
+void stream_flush_all(STREAM_TABLE *table);
+void stream_stats(STREAM_TABLE *table, struct stream_stats *stats);
+void stream_table_free(STREAM_TABLE *table);
+size_t find_header_end(const char *data, size_t len, size_t from);
+
+#endif /* ! _HAVE_STREAM_H */
@@ -0,0 +1,395 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  A string table maps keys to values with open addressing and Robin
+  Hood probing: an entry being inserted takes the slot of any entry
+  closer to its home slot, which keeps probe lengths short and even,
+  and lets a lookup stop as soon as it passes where the key would be.
+  Each slot holds the full hash next to the key, so the key itself is
+  only compared on a hash match. Removal shifts the following entries
+  back, leaving no tombstones.
+
+  When the table reaches its load limit a table twice the size is
+  started, and every later call moves a few entries from the old one
+  until it is empty, so growing never stops the caller for long.
+  Lookups check both tables in the meantime.
+
+  Keys are copied into a string arena of large chunks, each counting
+  the keys it holds; a chunk is freed once all of its keys have been
+  removed, so a table of short host names doesn't pay for the longest
+  one they could be.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "strtab.h"
+
+#define MIN_SIZE 16
+#define MIGRATE_STEP 32
+#define ARENA_CHUNK_SIZE 16384
+#define LOAD_LIMIT(size) ((size) / 4 * 3)
+
+struct arena_chunk {
+        struct arena_chunk *next;
+        size_t size, used;
+        unsigned int live;        /* Keys still in use */
+        char data[];
+};
+
+struct slot {
+        unsigned int hash;
+        unsigned short dist;      /* Distance from the home slot */
+        unsigned short dead;      /* Marked for removal by a walk */
+        char *key;                /* NULL if the slot is empty */
+        void *value;
+};
+
+struct table {
+        struct slot *slots;
+        unsigned int size, count;
+};
+
+struct strtab {
+        struct table cur, old;
+        unsigned int migrate_pos;
+        struct arena_chunk *chunks;      /* Chunk being filled first */
+        unsigned int num_chunks;
+};
+
+void table_alloc(struct table *t, unsigned int size);
+struct slot *table_find(struct table *t, unsigned int hash, const char *key);
+void table_insert(struct table *t, unsigned int hash, char *key, void *value);
+void table_delete(struct table *t, unsigned int pos);
+void table_sweep(STRTAB *tab, struct table *t);
+void migrate(STRTAB *tab, unsigned int steps);
+char *intern_key(STRTAB *tab, const char *key);
+void release_key(STRTAB *tab, char *key);
+
+STRTAB *strtab_new(unsigned int size) {
+        STRTAB *tab;
+        unsigned int n;
+
+        if ((tab = (STRTAB *) calloc(1, sizeof(STRTAB))) == NULL)
+                LOG_DIE("Cannot allocate memory for string table");
+
+        for (n = MIN_SIZE; n < size; n <<= 1);
+        table_alloc(&tab->cur, n);
+
+        return tab;
+}
+
+/* Return the value stored for key, or NULL */
+void *strtab_get(STRTAB *tab, const char *key) {
+        struct slot *s;
+        unsigned int hash = strtab_hash(key);
+
+        migrate(tab, MIGRATE_STEP);
+
+        if ((s = table_find(&tab->cur, hash, key))) return s->value;
+        if ((s = table_find(&tab->old, hash, key))) return s->value;
+
+        return NULL;
+}
+
+/* Add a key that is not yet in the table; returns the table's own
+   copy of the key, which lasts until the entry is removed */
+const char *strtab_insert(STRTAB *tab, const char *key, void *value) {
+        char *copy;
+
+#ifdef DEBUG
+        ASSERT(strtab_get(tab, key) == NULL);
+#endif
+
+        migrate(tab, MIGRATE_STEP);
+
+        if (tab->cur.count >= LOAD_LIMIT(tab->cur.size)) {
+                /* Finish any earlier move before starting another */
+                while (tab->old.slots) migrate(tab, tab->old.size);
+
+                tab->old = tab->cur;
+                tab->migrate_pos = 0;
+                table_alloc(&tab->cur, tab->old.size * 2);
+        }
+
+        copy = intern_key(tab, key);
+        table_insert(&tab->cur, strtab_hash(key), copy, value);
+
+        return copy;
+}
+
+/* Call fn for every entry, removing those it returns nonzero for */
+void strtab_walk(STRTAB *tab, STRTAB_WALK fn, void *arg) {
+        struct table *tables[2] = { &tab->cur, &tab->old };
+        unsigned int i, t, dead = 0;
+
+        for (t = 0; t < 2; t++) {
+                for (i = 0; i < tables[t]->size; i++) {
+                        if (!tables[t]->slots[i].key) continue;
+
+                        if (fn(tables[t]->slots[i].key, tables[t]->slots[i].value, arg)) {
+                                tables[t]->slots[i].dead = 1;
+                                dead++;
+                        }
+                }
+        }
+
+        /* Entries shift while others are removed, so removal waits
+           until every entry has been seen once */
+        if (dead) {
+                table_sweep(tab, &tab->cur);
+                table_sweep(tab, &tab->old);
+        }
+
+        return;
+}
+
+/* Remove every entry, calling fn on each first if given */
+void strtab_clear(STRTAB *tab, STRTAB_WALK fn, void *arg) {
+        struct arena_chunk *chunk;
+
+        if (fn) strtab_walk(tab, fn, arg);
+
+        free(tab->old.slots);
+        memset(&tab->old, 0, sizeof(struct table));
+
+        memset(tab->cur.slots, 0, tab->cur.size * sizeof(struct slot));
+        tab->cur.count = 0;
+
+        while ((chunk = tab->chunks)) {
+                tab->chunks = chunk->next;
+                free(chunk);
+        }
+        tab->num_chunks = 0;
+
+        return;
+}
+
+unsigned int strtab_count(STRTAB *tab) {
+        return tab->cur.count + tab->old.count;
+}
+
+void strtab_stats(STRTAB *tab, struct strtab_stats *stats) {
+        struct table *tables[2] = { &tab->cur, &tab->old };
+        unsigned int i, t;
+
+        memset(stats, 0, sizeof(struct strtab_stats));
+        stats->size = tab->cur.size;
+        stats->count = strtab_count(tab);
+        stats->migrating = tab->old.count;
+        stats->arena_chunks = tab->num_chunks;
+
+        for (t = 0; t < 2; t++) {
+                for (i = 0; i < tables[t]->size; i++) {
+                        if (tables[t]->slots[i].key && (tables[t]->slots[i].dist > stats->max_probe))
+                                stats->max_probe = tables[t]->slots[i].dist;
+                }
+        }
+
+        return;
+}
+
+void strtab_free(STRTAB *tab) {
+        if (!tab) return;
+
+        strtab_clear(tab, NULL, NULL);
+        free(tab->cur.slots);
+        free(tab);
+
+        return;
+}
+
+/* FNV-1a */
+unsigned int strtab_hash(const char *key) {
+        unsigned int hash = 2166136261U;
+
+        while (*key) {
+                hash ^= (unsigned char) *key++;
+                hash *= 16777619U;
+        }
+
+        return hash;
+}
+
+void table_alloc(struct table *t, unsigned int size) {
+        if ((t->slots = (struct slot *) calloc(size, sizeof(struct slot))) == NULL)
+                LOG_DIE("Cannot allocate memory for string table slots");
+
+        t->size = size;
+        t->count = 0;
+
+        return;
+}
+
+struct slot *table_find(struct table *t, unsigned int hash, const char *key) {
+        struct slot *s;
+        unsigned int i, dist;
+
+        if (!t->slots) return NULL;
+
+        for (i = hash & (t->size - 1), dist = 0; ; i = (i + 1) & (t->size - 1), dist++) {
+                s = &t->slots[i];
+
+                /* Past the point the key would have been placed */
+                if (!s->key || (s->dist < dist)) return NULL;
+
+                if ((s->hash == hash) && (strcmp(s->key, key) == 0)) return s;
+        }
+}
+
+void table_insert(struct table *t, unsigned int hash, char *key, void *value) {
+        struct slot entry, tmp;
+        unsigned int i;
+
+        memset(&entry, 0, sizeof(entry));
+        entry.hash = hash;
+        entry.key = key;
+        entry.value = value;
+
+        for (i = hash & (t->size - 1); ; i = (i + 1) & (t->size - 1), entry.dist++) {
+                if (!t->slots[i].key) {
+                        t->slots[i] = entry;
+                        t->count++;
+                        return;
+                }
+
+                /* Take the place of an entry nearer its home slot */
+                if (t->slots[i].dist < entry.dist) {
+                        tmp = t->slots[i];
+                        t->slots[i] = entry;
+                        entry = tmp;
+                }
+        }
+}
+
+/* Empty a slot, shifting back the entries that follow it */
+void table_delete(struct table *t, unsigned int pos) {
+        unsigned int next;
+
+        for (;;) {
+                next = (pos + 1) & (t->size - 1);
+                if (!t->slots[next].key || (t->slots[next].dist == 0)) break;
+
+                t->slots[pos] = t->slots[next];
+                t->slots[pos].dist--;
+                pos = next;
+        }
+
+        memset(&t->slots[pos], 0, sizeof(struct slot));
+        t->count--;
+
+        return;
+}
+
+/* Remove the entries marked dead; a slot is looked at again after a
+   removal since the next entry may have shifted into it */
+void table_sweep(STRTAB *tab, struct table *t) {
+        unsigned int i = 0;
+
+        while (i < t->size) {
+                if (t->slots[i].key && t->slots[i].dead) {
+                        release_key(tab, t->slots[i].key);
+                        table_delete(t, i);
+                } else {
+                        i++;
+                }
+        }
+
+        return;
+}
+
+/* Move up to steps entries from the old table into the current one */
+void migrate(STRTAB *tab, unsigned int steps) {
+        struct slot *s;
+
+        while (tab->old.slots && steps--) {
+                if ((tab->old.count == 0) || (tab->migrate_pos >= tab->old.size)) {
+                        free(tab->old.slots);
+                        memset(&tab->old, 0, sizeof(struct table));
+                        break;
+                }
+
+                s = &tab->old.slots[tab->migrate_pos];
+                if (!s->key) {
+                        tab->migrate_pos++;
+                        continue;
+                }
+
+                table_insert(&tab->cur, s->hash, s->key, s->value);
+                table_delete(&tab->old, tab->migrate_pos);
+        }
+
+        return;
+}
+
+/* Copy a key into the arena; each copy is preceded by a pointer to
+   the chunk it lives in */
+char *intern_key(STRTAB *tab, const char *key) {
+        struct arena_chunk *chunk = tab->chunks;
+        size_t len, need;
+        char *copy;
+
+        len = strlen(key) + 1;
+        need = (sizeof(struct arena_chunk *) + len + 7) & ~((size_t) 7);
+
+        if (!chunk || (chunk->size - chunk->used < need)) {
+                len = (need > ARENA_CHUNK_SIZE) ? need : ARENA_CHUNK_SIZE;
+                if ((chunk = (struct arena_chunk *) malloc(sizeof(struct arena_chunk) + len)) == NULL)
+                        LOG_DIE("Cannot allocate memory for string arena");
+
+                chunk->size = len;
+                chunk->used = 0;
+                chunk->live = 0;
+                chunk->next = tab->chunks;
+                tab->chunks = chunk;
+                tab->num_chunks++;
+
+                len = strlen(key) + 1;
+        }
+
+        memcpy(chunk->data + chunk->used, &chunk, sizeof(struct arena_chunk *));
+        copy = chunk->data + chunk->used + sizeof(struct arena_chunk *);
+        memcpy(copy, key, len);
+
+        chunk->used += need;
+        chunk->live++;
+
+        return copy;
+}
+
+/* Drop a key copy, freeing its chunk once nothing else is in it */
+void release_key(STRTAB *tab, char *key) {
+        struct arena_chunk *chunk, **link;
+
+        memcpy(&chunk, key - sizeof(struct arena_chunk *), sizeof(struct arena_chunk *));
+        if (--chunk->live > 0) return;
+
+        /* The chunk being filled is kept and simply reused */
+        if (chunk == tab->chunks) {
+                chunk->used = 0;
+                return;
+        }
+
+        for (link = &tab->chunks; *link; link = &(*link)->next) {
+                if (*link == chunk) {
+                        *link = chunk->next;
+                        break;
+                }
+        }
+
+        free(chunk);
+        tab->num_chunks--;
+
+        return;
+}
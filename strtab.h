@@ -0,0 +1,38 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_STRTAB_H
+#define _HAVE_STRTAB_H
+
+typedef struct strtab STRTAB;
+
+/* Called for each entry by strtab_walk(); return nonzero to remove it */
+typedef int (*STRTAB_WALK)(const char *key, void *value, void *arg);
+
+struct strtab_stats {
+        unsigned int size;        /* Slots in the current table */
+        unsigned int count;       /* Entries in both tables */
+        unsigned int migrating;   /* Entries left in the old table */
+        unsigned int max_probe;   /* Longest probe distance */
+        unsigned int arena_chunks;
+};
+
+STRTAB *strtab_new(unsigned int size);
+void *strtab_get(STRTAB *tab, const char *key);
+const char *strtab_insert(STRTAB *tab, const char *key, void *value);
+void strtab_walk(STRTAB *tab, STRTAB_WALK fn, void *arg);
+void strtab_clear(STRTAB *tab, STRTAB_WALK fn, void *arg);
+unsigned int strtab_count(STRTAB *tab);
+void strtab_stats(STRTAB *tab, struct strtab_stats *stats);
+void strtab_free(STRTAB *tab);
+unsigned int strtab_hash(const char *key);
+
+#endif /* ! _HAVE_STRTAB_H */
@@ -0,0 +1,340 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Write a synthetic capture file for benchmarking, with a chosen mix
+  of HTTP requests, responses, body segments, bare ACKs and non-TCP
+  packets spread over a number of connections. A share of the packets
+  can be given a VLAN tag, or be sent over IPv6, optionally behind
+  hop-by-hop and destination options extension headers. Build with
+  'make bench' and replay the file with httpry -X.
+
+  The default capture filter matches neither VLAN tagged packets nor
+  TCP behind IPv6 extension headers, so replay such files with a filter
+  that passes them, such as 'tcp or vlan or ip6'.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+
+#define DEFAULT_PACKETS 100000
+#define DEFAULT_FLOWS 1000
+#define DEFAULT_MIX "10,10,50,25,5"
+#define BODY_LEN 1400
+#define MAX_FRAME 2048
+
+#define KIND_REQUEST  0
+#define KIND_RESPONSE 1
+#define KIND_BODY     2
+#define KIND_ACK      3
+#define KIND_OTHER    4
+#define NUM_KINDS     5
+
+struct pcap_file_header_v2 {
+        unsigned int magic;
+        unsigned short version_major;
+        unsigned short version_minor;
+        int thiszone;
+        unsigned int sigfigs;
+        unsigned int snaplen;
+        unsigned int linktype;
+};
+
+struct pcap_record_header {
+        unsigned int ts_sec;
+        unsigned int ts_usec;
+        unsigned int caplen;
+        unsigned int len;
+};
+
+size_t build_packet(u_char *frame, unsigned int n, int kind);
+int percent(unsigned int share);
+void put16(u_char *p, unsigned int v);
+void put32(u_char *p, unsigned int v);
+void parse_mix(char *spec);
+void display_usage();
+
+static const char *requests[] = {
+        "GET /search?q=http+logging&source=hp HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Connection: keep-alive\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 (KHTML, like Gecko) Chrome/39.0.2171.95 Safari/537.36\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,image/webp,*/*;q=0.8\r\n"
+        "Referer: http://www.example.com/\r\n"
+        "Accept-Encoding: gzip, deflate, sdch\r\n"
+        "Accept-Language: en-US,en;q=0.8\r\n"
+        "Cookie: SID=DQAAAGcBAABcWv0L5pZl; HSID=AYQEVnDKrdst; APISID=y0L6hXwGiLFLZ\r\n"
+        "\r\n",
+
+        "POST /api/v2/events HTTP/1.1\r\n"
+        "Host: api.example.com\r\n"
+        "User-Agent: curl/7.38.0\r\n"
+        "Accept: application/json\r\n"
+        "Content-Type: application/json\r\n"
+        "Content-Length: 68\r\n"
+        "\r\n"
+        "{\"event\":\"click\",\"ts\":1418342400,\"target\":\"#login\",\"user\":\"a1b2c3\"}",
+
+        "GET /favicon.ico HTTP/1.1\r\n"
+        "Host: www.example.com\r\n"
+        "Accept: */*\r\n"
+        "\r\n",
+
+        NULL
+};
+
+static const char *responses[] = {
+        "HTTP/1.1 200 OK\r\n"
+        "Date: Fri, 12 Dec 2014 00:00:00 GMT\r\n"
+        "Server: Apache/2.4.10 (Debian)\r\n"
+        "Last-Modified: Thu, 11 Dec 2014 18:21:07 GMT\r\n"
+        "ETag: \"2b60-50a0c2d3a5b80-gzip\"\r\n"
+        "Vary: Accept-Encoding\r\n"
+        "Content-Encoding: gzip\r\n"
+        "Cache-Control: max-age=3600, public\r\n"
+        "Content-Length: 3152\r\n"
+        "Content-Type: text/html; charset=UTF-8\r\n"
+        "\r\n",
+
+        "HTTP/1.1 304 Not Modified\r\n"
+        "Date: Fri, 12 Dec 2014 00:00:00 GMT\r\n"
+        "ETag: \"2b60-50a0c2d3a5b80-gzip\"\r\n"
+        "\r\n",
+
+        NULL
+};
+
+static unsigned int num_flows = DEFAULT_FLOWS;
+static unsigned int mix[NUM_KINDS];
+static unsigned int vlan_share = 0;
+static unsigned int ip6_share = 0;
+static unsigned int ext_share = 0;
+
+int main(int argc, char **argv) {
+        struct pcap_file_header_v2 fh;
+        struct pcap_record_header rh;
+        u_char frame[MAX_FRAME];
+        unsigned int num_packets = DEFAULT_PACKETS, total = 0, i, pick, k;
+        unsigned long usec = 0;
+        char mix_spec[] = DEFAULT_MIX;
+        size_t len;
+        FILE *fp;
+        int opt;
+        extern char *optarg;
+        extern int optind;
+
+        parse_mix(mix_spec);
+
+        while ((opt = getopt(argc, argv, "e:f:hm:n:s:v:6:")) != -1) {
+                switch (opt) {
+                        case 'e': ext_share = atoi(optarg); break;
+                        case 'f': num_flows = atoi(optarg); break;
+                        case 'h': display_usage(); break;
+                        case 'm': parse_mix(optarg); break;
+                        case 'n': num_packets = atoi(optarg); break;
+                        case 's': srand(atoi(optarg)); break;
+                        case 'v': vlan_share = atoi(optarg); break;
+                        case '6': ip6_share = atoi(optarg); break;
+                        default: display_usage();
+                }
+        }
+
+        if (num_flows == 0) num_flows = 1;
+        for (k = 0; k < NUM_KINDS; k++) total += mix[k];
+        if (total == 0) {
+                fprintf(stderr, "Packet mix must not be empty\n");
+                return EXIT_FAILURE;
+        }
+
+        if (!argv[optind] || (strcmp(argv[optind], "-") == 0)) {
+                fp = stdout;
+        } else if ((fp = fopen(argv[optind], "wb")) == NULL) {
+                fprintf(stderr, "Cannot open output file '%s'\n", argv[optind]);
+                return EXIT_FAILURE;
+        }
+
+        memset(&fh, 0, sizeof(fh));
+        fh.magic = 0xa1b2c3d4;
+        fh.version_major = 2;
+        fh.version_minor = 4;
+        fh.snaplen = 65535;
+        fh.linktype = 1;                         /* Ethernet */
+        fwrite(&fh, sizeof(fh), 1, fp);
+
+        for (i = 0; i < num_packets; i++) {
+                pick = rand() % total;
+                for (k = 0; pick >= mix[k]; k++)
+                        pick -= mix[k];
+
+                len = build_packet(frame, i, k);
+
+                usec += 20;
+                rh.ts_sec = 1418342400 + usec / 1000000;
+                rh.ts_usec = usec % 1000000;
+                rh.caplen = rh.len = len;
+                fwrite(&rh, sizeof(rh), 1, fp);
+                fwrite(frame, len, 1, fp);
+        }
+
+        if (fp != stdout) fclose(fp);
+
+        return EXIT_SUCCESS;
+}
+
+/* Build the nth packet of the given kind; returns its length */
+size_t build_packet(u_char *frame, unsigned int n, int kind) {
+        unsigned int flow = rand() % num_flows;
+        int to_server = (kind != KIND_RESPONSE);
+        int ip6 = percent(ip6_share), ext = ip6 && percent(ext_share);
+        const char *payload = NULL;
+        size_t off = 12, ip_off, l4_off, len = 0, l4_len, i;
+
+        memset(frame, 0, MAX_FRAME);
+        frame[0] = 0x02; frame[5] = 0x01;       /* Locally administered MACs */
+        frame[6] = 0x02; frame[11] = 0x02;
+
+        if (percent(vlan_share)) {
+                put16(frame + off, 0x8100);
+                put16(frame + off + 2, 1 + flow % 4094);
+                off += 4;
+        }
+        put16(frame + off, ip6 ? 0x86dd : 0x0800);
+        ip_off = off + 2;
+
+        switch (kind) {
+                case KIND_REQUEST: payload = requests[n % 3]; break;
+                case KIND_RESPONSE: payload = responses[n % 2]; break;
+                case KIND_BODY: len = BODY_LEN; break;
+                case KIND_OTHER: len = 48; break;
+        }
+        if (payload) len = strlen(payload);
+
+        l4_len = (kind == KIND_OTHER) ? 8 + len : 20 + len;
+
+        if (ip6) {
+                frame[ip_off] = 0x60;
+                put16(frame + ip_off + 4, l4_len + (ext ? 16 : 0));
+                frame[ip_off + 7] = 64;
+                frame[ip_off + 8] = 0xfd;        /* fd00::/8 addresses */
+                frame[ip_off + 21] = to_server ? 1 : 2;
+                put16(frame + ip_off + 22, flow);
+                frame[ip_off + 24] = 0xfd;
+                frame[ip_off + 37] = to_server ? 2 : 1;
+                put16(frame + ip_off + 38, flow);
+                l4_off = ip_off + 40;
+
+                if (ext) {
+                        /* Hop-by-hop options, then destination options */
+                        frame[ip_off + 6] = 0;
+                        frame[l4_off] = 60;
+                        frame[l4_off + 8] = (kind == KIND_OTHER) ? 17 : 6;
+                        for (i = 0; i < 16; i += 8) {
+                                frame[l4_off + i + 2] = 1;       /* PadN */
+                                frame[l4_off + i + 3] = 4;
+                        }
+                        l4_off += 16;
+                } else {
+                        frame[ip_off + 6] = (kind == KIND_OTHER) ? 17 : 6;
+                }
+        } else {
+                frame[ip_off] = 0x45;
+                put16(frame + ip_off + 2, 20 + l4_len);
+                frame[ip_off + 8] = 64;
+                frame[ip_off + 9] = (kind == KIND_OTHER) ? 17 : 6;
+                frame[ip_off + 12] = 10;         /* 10.0.x.x and 10.1.x.x */
+                put16(frame + ip_off + 14, flow);
+                frame[ip_off + 13] = to_server ? 0 : 1;
+                frame[ip_off + 16] = 10;
+                put16(frame + ip_off + 18, flow);
+                frame[ip_off + 17] = to_server ? 1 : 0;
+                l4_off = ip_off + 20;
+        }
+
+        if (kind == KIND_OTHER) {
+                /* A DNS sized UDP datagram */
+                put16(frame + l4_off, 1024 + flow % 60000);
+                put16(frame + l4_off + 2, 53);
+                put16(frame + l4_off + 4, l4_len);
+                for (i = 0; i < len; i++) frame[l4_off + 8 + i] = (u_char) (n + i);
+
+                return l4_off + l4_len;
+        }
+
+        put16(frame + l4_off, to_server ? 1024 + flow % 60000 : 80);
+        put16(frame + l4_off + 2, to_server ? 80 : 1024 + flow % 60000);
+        put32(frame + l4_off + 4, n * 1400);
+        put32(frame + l4_off + 8, n * 700);
+        frame[l4_off + 12] = 5 << 4;
+        frame[l4_off + 13] = len ? 0x18 : 0x10;  /* PSH|ACK or a bare ACK */
+        put16(frame + l4_off + 14, 65535);
+
+        if (payload) {
+                memcpy(frame + l4_off + 20, payload, len);
+        } else {
+                for (i = 0; i < len; i++) frame[l4_off + 20 + i] = (u_char) (n * 31 + i * 7);
+        }
+
+        return l4_off + l4_len;
+}
+
+/* Return 1 for the given percentage of calls */
+int percent(unsigned int share) {
+        return share && ((unsigned int) (rand() % 100) < share);
+}
+
+void put16(u_char *p, unsigned int v) {
+        p[0] = (v >> 8) & 0xff;
+        p[1] = v & 0xff;
+
+        return;
+}
+
+void put32(u_char *p, unsigned int v) {
+        put16(p, v >> 16);
+        put16(p + 2, v & 0xffff);
+
+        return;
+}
+
+/* Parse the relative weights of each kind of packet */
+void parse_mix(char *spec) {
+        char *tok, *pos = spec;
+        int k;
+
+        for (k = 0; k < NUM_KINDS; k++) {
+                tok = pos;
+                if (tok && (pos = strchr(tok, ','))) *pos++ = '\0';
+                mix[k] = (tok && *tok) ? atoi(tok) : 0;
+        }
+
+        return;
+}
+
+void display_usage() {
+        printf("Usage: synth [ -h ] [ -n packets ] [ -f flows ] [ -m mix ] [ -v percent ]\n"
+               "             [ -6 percent ] [ -e percent ] [ -s seed ] [ file ]\n\n");
+
+        printf("   -e percent   share of IPv6 packets sent behind extension headers\n"
+               "   -f flows     number of connections (default %d)\n"
+               "   -h           print this help information\n"
+               "   -m mix       weights of requests,responses,body,acks,other (default %s)\n"
+               "   -n packets   number of packets to write (default %d)\n"
+               "   -s seed      random seed\n"
+               "   -v percent   share of packets with a VLAN tag\n"
+               "   -6 percent   share of packets sent over IPv6\n"
+               "   file         capture file to write; standard output if not given\n\n",
+               DEFAULT_FLOWS, DEFAULT_MIX, DEFAULT_PACKETS);
+
+        exit(EXIT_SUCCESS);
+}
@@ -0,0 +1,124 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Packet timestamps arrive in order and many packets share the same
+  second, so the date and time portion of each string is rendered only
+  when the second changes. For every other packet only the millisecond
+  digits are patched into the cached string. Each returned string is
+  owned by the cache and remains valid until the next call for the same
+  encoding.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "timestamp.h"
+
+#define LOCAL_PREFIX_LEN 19   /* YYYY-MM-DD HH:MM:SS */
+#define UTC_PREFIX_LEN 19     /* YYYY-MM-DDTHH:MM:SS */
+
+void put_millis(char *str, unsigned int ms);
+
+/* Reset a cache so the next call of each encoding renders in full */
+void init_ts_cache(TS_CACHE *cache) {
+
+#ifdef DEBUG
+        ASSERT(cache);
+#endif
+
+        /* localtime_r() is not required to pick up the time zone itself */
+        tzset();
+
+        cache->local_sec = -1;
+        cache->utc_sec = -1;
+
+        return;
+}
+
+/* Write three millisecond digits at str */
+void put_millis(char *str, unsigned int ms) {
+        str[0] = '0' + (ms / 100);
+        str[1] = '0' + (ms / 10) % 10;
+        str[2] = '0' + ms % 10;
+
+        return;
+}
+
+/* Local time in the form 'YYYY-MM-DD HH:MM:SS.mmm' */
+char *format_ts_local(TS_CACHE *cache, const struct timeval *tv) {
+        struct tm tm;
+
+#ifdef DEBUG
+        ASSERT(cache);
+        ASSERT(tv);
+#endif
+
+        if (tv->tv_sec != cache->local_sec) {
+                localtime_r(&tv->tv_sec, &tm);
+                strftime(cache->local, MAX_TIME_LEN, "%Y-%m-%d %H:%M:%S", &tm);
+                cache->local[LOCAL_PREFIX_LEN] = '.';
+                cache->local[LOCAL_PREFIX_LEN + 4] = '\0';
+                cache->local_sec = tv->tv_sec;
+        }
+
+        put_millis(cache->local + LOCAL_PREFIX_LEN + 1, tv->tv_usec / 1000);
+
+        return cache->local;
+}
+
+/* RFC3339 UTC time in the form 'YYYY-MM-DDTHH:MM:SS.mmmZ' */
+char *format_ts_utc(TS_CACHE *cache, const struct timeval *tv) {
+        struct tm tm;
+
+#ifdef DEBUG
+        ASSERT(cache);
+        ASSERT(tv);
+#endif
+
+        if (tv->tv_sec != cache->utc_sec) {
+                gmtime_r(&tv->tv_sec, &tm);
+                strftime(cache->utc, MAX_TIME_LEN, "%Y-%m-%dT%H:%M:%S", &tm);
+                cache->utc[UTC_PREFIX_LEN] = '.';
+                cache->utc[UTC_PREFIX_LEN + 4] = 'Z';
+                cache->utc[UTC_PREFIX_LEN + 5] = '\0';
+                cache->utc_sec = tv->tv_sec;
+        }
+
+        put_millis(cache->utc + UTC_PREFIX_LEN + 1, tv->tv_usec / 1000);
+
+        return cache->utc;
+}
+
+/* Milliseconds since the epoch as a decimal integer */
+char *format_ts_epoch_ms(TS_CACHE *cache, const struct timeval *tv) {
+        unsigned long long ms;
+        char digits[MAX_TIME_LEN];
+        int i = 0, j = 0;
+
+#ifdef DEBUG
+        ASSERT(cache);
+        ASSERT(tv);
+#endif
+
+        ms = (unsigned long long) tv->tv_sec * 1000 + tv->tv_usec / 1000;
+
+        do {
+                digits[i++] = '0' + (ms % 10);
+                ms /= 10;
+        } while (ms);
+
+        while (i) cache->epoch_ms[j++] = digits[--i];
+        cache->epoch_ms[j] = '\0';
+
+        return cache->epoch_ms;
+}
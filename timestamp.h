@@ -0,0 +1,33 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_TIMESTAMP_H
+#define _HAVE_TIMESTAMP_H
+
+#include <sys/time.h>
+#include <time.h>
+#include "config.h"
+
+/* Per-worker cache of the most recently formatted second */
+typedef struct ts_cache {
+        time_t local_sec;
+        char local[MAX_TIME_LEN];
+        time_t utc_sec;
+        char utc[MAX_TIME_LEN];
+        char epoch_ms[MAX_TIME_LEN];
+} TS_CACHE;
+
+void init_ts_cache(TS_CACHE *cache);
+char *format_ts_local(TS_CACHE *cache, const struct timeval *tv);
+char *format_ts_utc(TS_CACHE *cache, const struct timeval *tv);
+char *format_ts_epoch_ms(TS_CACHE *cache, const struct timeval *tv);
+
+#endif /* ! _HAVE_TIMESTAMP_H */
@@ -0,0 +1,270 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  A top-K summary estimates the most frequent keys in a stream with a
+  fixed number of counters, using the Space-Saving algorithm. A key
+  that is already counted has its count increased; a new key takes a
+  free counter, or once all are in use replaces the key with the
+  smallest count and inherits that count. Counts therefore never fall
+  short of the true count of a key still held, overshoot it by at most
+  N / capacity for a stream of N, and any key making up more than that
+  share of the stream is always held.
+
+  The counters are kept in a binary min-heap so the smallest is found
+  at the root, and chained in a hash on the key so a key is found in
+  one probe. All memory is allocated when the summary is created.
+*/
+
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "topk.h"
+
+#define NIL ((unsigned int) -1)
+
+struct topk_node {
+        TOPK_ENTRY entry;
+        unsigned int hash;
+        unsigned int next;        /* Hash chain */
+        unsigned int heap_pos;
+};
+
+struct topk {
+        struct topk_node *nodes;
+        unsigned int *heap;       /* Node indexes, smallest count first */
+        unsigned int *buckets;
+        unsigned int hash_mask;
+        unsigned int capacity;
+        unsigned int num_nodes;
+        unsigned int total;       /* Sum of all counts added */
+};
+
+unsigned int hash_key(const char *key);
+unsigned int find_key(TOPK *topk, const char *key, unsigned int hash);
+void unlink_key(TOPK *topk, unsigned int index);
+void sift_up(TOPK *topk, unsigned int pos);
+void sift_down(TOPK *topk, unsigned int pos);
+int compare_entries(const void *a, const void *b);
+
+/* Create a summary holding up to capacity keys */
+TOPK *topk_new(unsigned int capacity) {
+        TOPK *topk;
+        unsigned int size;
+
+#ifdef DEBUG
+        ASSERT(capacity > 0);
+#endif
+
+        if ((topk = (TOPK *) calloc(1, sizeof(TOPK))) == NULL)
+                LOG_DIE("Cannot allocate memory for top-K summary");
+
+        if ((topk->nodes = (struct topk_node *) calloc(capacity, sizeof(struct topk_node))) == NULL)
+                LOG_DIE("Cannot allocate memory for top-K counters");
+
+        if ((topk->heap = (unsigned int *) calloc(capacity, sizeof(unsigned int))) == NULL)
+                LOG_DIE("Cannot allocate memory for top-K heap");
+
+        for (size = 1; size < capacity * 2; size <<= 1);
+        if ((topk->buckets = (unsigned int *) malloc(size * sizeof(unsigned int))) == NULL)
+                LOG_DIE("Cannot allocate memory for top-K hash");
+
+        topk->hash_mask = size - 1;
+        topk->capacity = capacity;
+        topk_clear(topk);
+
+        return topk;
+}
+
+/* Add count occurrences of key */
+void topk_add(TOPK *topk, const char *key, unsigned int count) {
+        struct topk_node *node;
+        unsigned int hash, index;
+
+        topk->total += count;
+        hash = hash_key(key);
+
+        if ((index = find_key(topk, key, hash)) != NIL) {
+                topk->nodes[index].entry.count += count;
+                sift_down(topk, topk->nodes[index].heap_pos);
+                return;
+        }
+
+        if (topk->num_nodes < topk->capacity) {
+                /* Take a free counter */
+                index = topk->num_nodes++;
+                node = &topk->nodes[index];
+                node->entry.count = count;
+                node->heap_pos = index;
+                topk->heap[index] = index;
+        } else {
+                /* Replace the key with the smallest count */
+                index = topk->heap[0];
+                node = &topk->nodes[index];
+                unlink_key(topk, index);
+                node->entry.count += count;
+        }
+
+        strncpy(node->entry.key, key, TOPK_KEY_LEN - 1);
+        node->entry.key[TOPK_KEY_LEN - 1] = '\0';
+        node->hash = hash;
+        node->next = topk->buckets[hash & topk->hash_mask];
+        topk->buckets[hash & topk->hash_mask] = index;
+
+        if (node->heap_pos == 0) {
+                sift_down(topk, 0);
+        } else {
+                sift_up(topk, node->heap_pos);
+        }
+
+        return;
+}
+
+/* Add every key counted in src to dst */
+void topk_merge(TOPK *dst, TOPK *src) {
+        unsigned int i;
+
+        for (i = 0; i < src->num_nodes; i++)
+                topk_add(dst, src->nodes[i].entry.key, src->nodes[i].entry.count);
+
+        /* Counts lost to replacement in src are still part of the stream */
+        dst->total += src->total;
+        for (i = 0; i < src->num_nodes; i++)
+                dst->total -= src->nodes[i].entry.count;
+
+        return;
+}
+
+/* Copy the keys held into entries, which must have room for the
+   capacity, largest count first; returns the number copied */
+unsigned int topk_sorted(TOPK *topk, TOPK_ENTRY *entries) {
+        unsigned int i;
+
+        for (i = 0; i < topk->num_nodes; i++)
+                memcpy(&entries[i], &topk->nodes[i].entry, sizeof(TOPK_ENTRY));
+
+        qsort(entries, topk->num_nodes, sizeof(TOPK_ENTRY), compare_entries);
+
+        return topk->num_nodes;
+}
+
+/* Return the number of occurrences added since the last clear */
+unsigned int topk_total(TOPK *topk) {
+        return topk->total;
+}
+
+void topk_clear(TOPK *topk) {
+        memset(topk->buckets, 0xff, (topk->hash_mask + 1) * sizeof(unsigned int));
+        topk->num_nodes = 0;
+        topk->total = 0;
+
+        return;
+}
+
+void topk_free(TOPK *topk) {
+        if (!topk) return;
+
+        free(topk->nodes);
+        free(topk->heap);
+        free(topk->buckets);
+        free(topk);
+
+        return;
+}
+
+/* FNV-1a over the part of the key that is kept */
+unsigned int hash_key(const char *key) {
+        unsigned int hash = 2166136261U;
+        int i;
+
+        for (i = 0; key[i] && (i < TOPK_KEY_LEN - 1); i++) {
+                hash ^= (unsigned char) key[i];
+                hash *= 16777619U;
+        }
+
+        return hash;
+}
+
+/* Return the index of the node holding key, or NIL */
+unsigned int find_key(TOPK *topk, const char *key, unsigned int hash) {
+        unsigned int index;
+
+        for (index = topk->buckets[hash & topk->hash_mask]; index != NIL; index = topk->nodes[index].next) {
+                if ((topk->nodes[index].hash == hash) &&
+                    (strncmp(topk->nodes[index].entry.key, key, TOPK_KEY_LEN - 1) == 0))
+                        return index;
+        }
+
+        return NIL;
+}
+
+/* Remove a node from its hash chain */
+void unlink_key(TOPK *topk, unsigned int index) {
+        unsigned int *link;
+
+        for (link = &topk->buckets[topk->nodes[index].hash & topk->hash_mask]; *link != NIL;
+             link = &topk->nodes[*link].next) {
+                if (*link == index) {
+                        *link = topk->nodes[index].next;
+                        break;
+                }
+        }
+
+        return;
+}
+
+void sift_up(TOPK *topk, unsigned int pos) {
+        unsigned int index = topk->heap[pos], parent;
+
+        while (pos > 0) {
+                parent = (pos - 1) / 2;
+                if (topk->nodes[topk->heap[parent]].entry.count <= topk->nodes[index].entry.count) break;
+
+                topk->heap[pos] = topk->heap[parent];
+                topk->nodes[topk->heap[pos]].heap_pos = pos;
+                pos = parent;
+        }
+
+        topk->heap[pos] = index;
+        topk->nodes[index].heap_pos = pos;
+
+        return;
+}
+
+void sift_down(TOPK *topk, unsigned int pos) {
+        unsigned int index = topk->heap[pos], child;
+
+        while ((child = pos * 2 + 1) < topk->num_nodes) {
+                if ((child + 1 < topk->num_nodes) &&
+                    (topk->nodes[topk->heap[child + 1]].entry.count < topk->nodes[topk->heap[child]].entry.count))
+                        child++;
+                if (topk->nodes[index].entry.count <= topk->nodes[topk->heap[child]].entry.count) break;
+
+                topk->heap[pos] = topk->heap[child];
+                topk->nodes[topk->heap[pos]].heap_pos = pos;
+                pos = child;
+        }
+
+        topk->heap[pos] = index;
+        topk->nodes[index].heap_pos = pos;
+
+        return;
+}
+
+int compare_entries(const void *a, const void *b) {
+        const TOPK_ENTRY *x = (const TOPK_ENTRY *) a, *y = (const TOPK_ENTRY *) b;
+
+        if (x->count != y->count) return (x->count < y->count) ? 1 : -1;
+
+        return strcmp(x->key, y->key);
+}
@@ -0,0 +1,33 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_TOPK_H
+#define _HAVE_TOPK_H
+
+/* Keys longer than this, less one, are truncated */
+#define TOPK_KEY_LEN 128
+
+typedef struct topk_entry {
+        char key[TOPK_KEY_LEN];
+        unsigned int count;
+} TOPK_ENTRY;
+
+typedef struct topk TOPK;
+
+TOPK *topk_new(unsigned int capacity);
+void topk_add(TOPK *topk, const char *key, unsigned int count);
+void topk_merge(TOPK *dst, TOPK *src);
+unsigned int topk_sorted(TOPK *topk, TOPK_ENTRY *entries);
+unsigned int topk_total(TOPK *topk);
+void topk_clear(TOPK *topk);
+void topk_free(TOPK *topk);
+
+#endif /* ! _HAVE_TOPK_H */
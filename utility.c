@@ -13,6 +13,7 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <time.h>
 #include "error.h"
 
 /* Strip leading and trailing spaces from parameter string, modifying
@@ -129,3 +130,17 @@ unsigned int hash_str(char *str, unsigned int hashsize) {
            hashsize must be a power of 2 */
         return (unsigned int) (hash & (hashsize - 1));
 }
+
+/* Read a cheap, steadily increasing count for timing short stretches
+   of code: the time stamp counter on x86, nanoseconds elsewhere */
+unsigned long long read_cycles() {
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+        return __builtin_ia32_rdtsc();
+#else
+        struct timespec ts;
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+
+        return (unsigned long long) ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+}
@@ -18,5 +18,6 @@ int str_compare(const char *str1, const char *str2);
 int str_copy(char *dest, const char *src, size_t len);
 char *str_duplicate(const char *str);
 unsigned int hash_str(char *key, unsigned int hashsize);
+unsigned long long read_cycles();
 
 #endif /* ! _HAVE_UTILITY_H */
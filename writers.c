@@ -0,0 +1,335 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+/*
+  Rate statistics and aggregation both let every capture thread count
+  into tables of its own, so the packet path takes no lock, and fold
+  those tables into the reporter's at each report. This holds the
+  parts they share.
+
+  Every writer has two tables, and a global epoch selects which one is
+  written. To take a snapshot the reporter bumps the epoch, waits for
+  any update still running against the old table to finish, and then
+  owns the old tables outright while the capture threads carry on
+  writing into the other one.
+
+  A writer marks each update by making its sequence number odd before
+  it reads the epoch, and even again afterwards. Both the epoch bump
+  and the mark are sequentially consistent, so an update that read the
+  old epoch is always seen in progress by the reporter.
+
+  A writer table maps keys to fixed size entries with open addressing.
+  It belongs to one thread at a time, so when it reaches its load
+  limit the writer simply doubles the slots and places every entry
+  again. Entries and keys live in chunks that are never moved, so an
+  entry may point into itself, and both are simply dropped when the
+  reporter clears the table after folding it in; the chunks are kept
+  for the next interval. Only keys past WRITER_MAX_SIZE are counted as
+  missed, which bounds the memory a flood of distinct keys can take.
+*/
+
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "error.h"
+#include "strtab.h"
+#include "writers.h"
+
+#define WRITER_MIN_SIZE 2048
+#define WRITER_MAX_SIZE 65536
+#define CHUNK_ENTRIES 256
+#define LOAD_LIMIT(size) ((size) / 4 * 3)
+
+struct writer_seq {
+        unsigned int seq;         /* Odd while an update is running */
+} __attribute__((aligned(64)));
+
+struct writers {
+        unsigned int epoch;
+        int count;
+        struct writer_seq *seqs;
+};
+
+struct writer_slot {
+        unsigned int hash;
+        unsigned int entry;       /* Index of the entry plus one, 0 if empty */
+};
+
+struct writer_table {
+        struct writer_slot *slots;
+        unsigned int size;
+        unsigned int *used;       /* Slot of each entry, for clearing */
+        unsigned int num_used;
+        char **chunks;            /* CHUNK_ENTRIES entries each */
+        unsigned int num_chunks;
+        size_t entry_size;
+        char **names;             /* names_size bytes each */
+        unsigned int num_names;
+        unsigned int cur_names;   /* Buffer being filled */
+        size_t names_size;
+        size_t names_used;
+        unsigned int missed;
+};
+
+char *get_entry(WRITER_TABLE *tab, unsigned int i);
+char *copy_key(WRITER_TABLE *tab, const char *key, size_t len);
+void grow_table(WRITER_TABLE *tab);
+
+/* Allocate the update marks for count writers */
+WRITERS *writers_new(int count) {
+        WRITERS *set;
+
+#ifdef DEBUG
+        ASSERT(count > 0);
+#endif
+
+        if ((set = (WRITERS *) calloc(1, sizeof(WRITERS))) == NULL)
+                LOG_DIE("Cannot allocate memory for writers");
+
+        if (posix_memalign((void **) &set->seqs, sizeof(struct writer_seq), count * sizeof(struct writer_seq)) != 0)
+                LOG_DIE("Cannot allocate memory for writers");
+        memset(set->seqs, 0, count * sizeof(struct writer_seq));
+        set->count = count;
+
+        return set;
+}
+
+/* Mark an update by the writer as running and return which of its
+   two tables to write; each writer must only be updated from a single
+   thread */
+unsigned int writers_begin(WRITERS *set, int writer) {
+#ifdef DEBUG
+        ASSERT((writer >= 0) && (writer < set->count));
+#endif
+
+        /* Mark the update as running before reading the epoch */
+        __atomic_add_fetch(&set->seqs[writer].seq, 1, __ATOMIC_SEQ_CST);
+
+        return __atomic_load_n(&set->epoch, __ATOMIC_SEQ_CST) & 1;
+}
+
+/* Mark the writer's update as finished */
+void writers_end(WRITERS *set, int writer) {
+        __atomic_add_fetch(&set->seqs[writer].seq, 1, __ATOMIC_RELEASE);
+
+        return;
+}
+
+/* Point the writers at their other table and wait out any update
+   still running against the old one; returns the old table, which
+   the caller then owns until the next swap */
+unsigned int writers_swap(WRITERS *set) {
+        unsigned int old, seq;
+        int i;
+
+        old = __atomic_fetch_add(&set->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+        for (i = 0; i < set->count; i++) {
+                seq = __atomic_load_n(&set->seqs[i].seq, __ATOMIC_SEQ_CST);
+                if (seq & 1) {
+                        while (__atomic_load_n(&set->seqs[i].seq, __ATOMIC_ACQUIRE) == seq)
+                                sched_yield();
+                }
+        }
+
+        return old;
+}
+
+void writers_free(WRITERS *set) {
+        if (!set) return;
+
+        free(set->seqs);
+        free(set);
+
+        return;
+}
+
+/* Allocate a table of entries of entry_size bytes, keeping their keys
+   in buffers of names_size bytes */
+WRITER_TABLE *writer_table_new(size_t entry_size, size_t names_size) {
+        WRITER_TABLE *tab;
+
+#ifdef DEBUG
+        ASSERT(entry_size >= sizeof(const char *));
+#endif
+
+        if ((tab = (WRITER_TABLE *) calloc(1, sizeof(WRITER_TABLE))) == NULL)
+                LOG_DIE("Cannot allocate memory for writer table");
+
+        /* Keep every entry aligned for any member */
+        tab->entry_size = (entry_size + sizeof(void *) - 1) & ~(sizeof(void *) - 1);
+        tab->names_size = names_size;
+
+        tab->size = WRITER_MIN_SIZE;
+        if ((tab->slots = (struct writer_slot *) calloc(tab->size, sizeof(struct writer_slot))) == NULL)
+                LOG_DIE("Cannot allocate memory for writer table");
+        if ((tab->used = (unsigned int *) calloc(LOAD_LIMIT(tab->size), sizeof(unsigned int))) == NULL)
+                LOG_DIE("Cannot allocate memory for writer table");
+
+        return tab;
+}
+
+/* Find the entry for the len byte key, adding a zeroed one if there
+   is room and setting added if so; returns NULL if the table is
+   full */
+void *writer_table_get(WRITER_TABLE *tab, const char *key, size_t len, int *added) {
+        struct writer_slot *slot;
+        char *entry;
+        unsigned int hash, i;
+
+#ifdef DEBUG
+        ASSERT(len < tab->names_size);
+#endif
+
+        hash = strtab_hash(key);
+        *added = 0;
+
+        for (i = hash & (tab->size - 1); ; i = (i + 1) & (tab->size - 1)) {
+                slot = &tab->slots[i];
+
+                if (slot->entry == 0) {
+                        if (tab->num_used == LOAD_LIMIT(tab->size)) {
+                                if (tab->size == WRITER_MAX_SIZE) {
+                                        tab->missed++;
+                                        return NULL;
+                                }
+
+                                /* The key is still missing after growing */
+                                grow_table(tab);
+                                return writer_table_get(tab, key, len, added);
+                        }
+
+                        entry = get_entry(tab, tab->num_used);
+                        memset(entry, 0, tab->entry_size);
+                        *(const char **) entry = copy_key(tab, key, len);
+
+                        slot->hash = hash;
+                        tab->used[tab->num_used++] = i;
+                        slot->entry = tab->num_used;
+                        *added = 1;
+
+                        return entry;
+                }
+
+                entry = get_entry(tab, slot->entry - 1);
+                if ((slot->hash == hash) && (strcmp(*(const char **) entry, key) == 0))
+                        return entry;
+        }
+}
+
+/* Return entry i, allocating its chunk if it is the first one there */
+char *get_entry(WRITER_TABLE *tab, unsigned int i) {
+        char **chunks;
+
+        if (i / CHUNK_ENTRIES == tab->num_chunks) {
+                if ((chunks = (char **) realloc(tab->chunks, (tab->num_chunks + 1) * sizeof(char *))) == NULL)
+                        LOG_DIE("Cannot allocate memory for writer table");
+                tab->chunks = chunks;
+
+                if ((tab->chunks[tab->num_chunks] = (char *) malloc(CHUNK_ENTRIES * tab->entry_size)) == NULL)
+                        LOG_DIE("Cannot allocate memory for writer table");
+                tab->num_chunks++;
+        }
+
+        return tab->chunks[i / CHUNK_ENTRIES] + (i % CHUNK_ENTRIES) * tab->entry_size;
+}
+
+/* Copy a len byte key into the name buffers, moving on to the next
+   buffer if it doesn't fit in this one */
+char *copy_key(WRITER_TABLE *tab, const char *key, size_t len) {
+        char **names, *copy;
+
+        if ((tab->num_names == 0) || (tab->names_used + len + 1 > tab->names_size)) {
+                if (tab->num_names > 0) tab->cur_names++;
+                tab->names_used = 0;
+        }
+
+        if (tab->cur_names == tab->num_names) {
+                if ((names = (char **) realloc(tab->names, (tab->num_names + 1) * sizeof(char *))) == NULL)
+                        LOG_DIE("Cannot allocate memory for writer table");
+                tab->names = names;
+
+                if ((tab->names[tab->num_names] = (char *) malloc(tab->names_size)) == NULL)
+                        LOG_DIE("Cannot allocate memory for writer table");
+                tab->num_names++;
+        }
+
+        copy = memcpy(tab->names[tab->cur_names] + tab->names_used, key, len + 1);
+        tab->names_used += len + 1;
+
+        return copy;
+}
+
+/* Double the slots and place every entry again */
+void grow_table(WRITER_TABLE *tab) {
+        struct writer_slot *slots, *old;
+        unsigned int *used, size = tab->size * 2, i, j;
+
+        if ((slots = (struct writer_slot *) calloc(size, sizeof(struct writer_slot))) == NULL)
+                LOG_DIE("Cannot grow writer table");
+        if ((used = (unsigned int *) realloc(tab->used, LOAD_LIMIT(size) * sizeof(unsigned int))) == NULL)
+                LOG_DIE("Cannot grow writer table");
+        tab->used = used;
+
+        for (i = 0; i < tab->num_used; i++) {
+                old = &tab->slots[tab->used[i]];
+                for (j = old->hash & (size - 1); slots[j].entry; j = (j + 1) & (size - 1));
+
+                slots[j] = *old;
+                tab->used[i] = j;
+        }
+
+        free(tab->slots);
+        tab->slots = slots;
+        tab->size = size;
+
+        return;
+}
+
+/* Call fn for every entry and then empty the table; returns how many
+   keys were missed since the last clear */
+unsigned int writer_table_clear(WRITER_TABLE *tab, WRITER_TABLE_WALK fn, void *arg) {
+        unsigned int i, missed;
+
+        for (i = 0; i < tab->num_used; i++) {
+                if (fn) fn(get_entry(tab, i), arg);
+                tab->slots[tab->used[i]].entry = 0;
+        }
+        tab->num_used = 0;
+        tab->cur_names = 0;
+        tab->names_used = 0;
+
+        missed = tab->missed;
+        tab->missed = 0;
+
+        return missed;
+}
+
+void writer_table_free(WRITER_TABLE *tab) {
+        unsigned int i;
+
+        if (!tab) return;
+
+        for (i = 0; i < tab->num_chunks; i++)
+                free(tab->chunks[i]);
+        for (i = 0; i < tab->num_names; i++)
+                free(tab->names[i]);
+
+        free(tab->slots);
+        free(tab->used);
+        free(tab->chunks);
+        free(tab->names);
+        free(tab);
+
+        return;
+}
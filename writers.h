@@ -0,0 +1,35 @@
+/*
+
+  ----------------------------------------------------
+  httpry - HTTP logging and information retrieval tool
+  ----------------------------------------------------
+
+  Copyright (c) 2005-2014 Jason Bittel <jason.bittel@gmail.com>
+  Licensed under GPLv2. For further information, see COPYING file.
+
+*/
+
+#ifndef _HAVE_WRITERS_H
+#define _HAVE_WRITERS_H
+
+#include <stddef.h>
+
+typedef struct writers WRITERS;
+typedef struct writer_table WRITER_TABLE;
+
+/* Called for each entry by writer_table_clear() */
+typedef void (*WRITER_TABLE_WALK)(void *entry, void *arg);
+
+WRITERS *writers_new(int count);
+unsigned int writers_begin(WRITERS *set, int writer);
+void writers_end(WRITERS *set, int writer);
+unsigned int writers_swap(WRITERS *set);
+void writers_free(WRITERS *set);
+
+/* Entries must start with a const char * the table points at their key */
+WRITER_TABLE *writer_table_new(size_t entry_size, size_t names_size);
+void *writer_table_get(WRITER_TABLE *tab, const char *key, size_t len, int *added);
+unsigned int writer_table_clear(WRITER_TABLE *tab, WRITER_TABLE_WALK fn, void *arg);
+void writer_table_free(WRITER_TABLE *tab);
+
+#endif /* ! _HAVE_WRITERS_H */